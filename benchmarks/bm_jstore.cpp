@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <jstore.hpp>
+
+#include <filesystem>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace bench {
+
+/*
+ * Struct with many members (wide tree)
+ */
+struct wide {
+    bool b0 = false;    bool b1 = true;     bool b2 = false;
+    int i0 = 0;         int i1 = 1;         int i2 = 2;
+    string s0 = "zero"; string s1 = "one";  string s2 = "two";
+    vector<int> v0;     vector<int> v1;     vector<int> v2;
+
+    bool operator==(const wide &) const = default;
+};
+
+/*
+ * Map value struct (map-heavy tree)
+ */
+struct profile {
+    string name;
+    vector<uint8_t> ssid;
+    vector<uint8_t> psk;
+    bool hidden = false;
+    int priority = 0;
+
+    bool operator==(const profile &) const = default;
+};
+
+struct root {
+    wide settings;
+    map<int, profile> profiles;
+    map<string, map<string, map<string, vector<int>>>> deep;
+
+    bool operator==(const root &) const = default;
+};
+
+} /* namespace bench */
+
+VISITABLE_STRUCT(bench::wide, b0, b1, b2, i0, i1, i2, s0, s1, s2, v0, v1, v2);
+VISITABLE_STRUCT(bench::profile, name, ssid, psk, hidden, priority);
+VISITABLE_STRUCT(bench::root, settings, profiles, deep);
+
+namespace bench {
+
+static const size_t SIZES[] = { 100, 10000 };
+
+/*
+ * Build a synthetic tree with about `size` leaves in each of its subtrees.
+ */
+static root make_tree(size_t size)
+{
+    root r;
+
+    r.settings.i2 = static_cast<int>(size);
+    r.settings.v0.assign(size, 7);
+
+    for (size_t i = 0; i < size; ++i) {
+        auto &p = r.profiles[static_cast<int>(i)];
+
+        p.name = fmt::format("profile {}", i);
+        p.ssid = { 'n', 'e', 't', static_cast<uint8_t>(i) };
+        p.priority = static_cast<int>(i % 10);
+    }
+
+    for (size_t i = 0; i < size / 10; ++i) {
+        r.deep[fmt::format("a{}", i % 10)][fmt::format("b{}", i)]["c"] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    }
+
+    return r;
+}
+
+} /* namespace bench */
+
+
+TEST_CASE("serialization", "[benchmark]")
+{
+    for (size_t size : bench::SIZES) {
+        const bench::root tree = bench::make_tree(size);
+        json j;
+
+        jstore::serialize(j, tree);
+
+        BENCHMARK(fmt::format("serialize wide [{}]", size))
+        {
+            json out;
+            return jstore::serialize(out, tree.settings, true);
+        };
+
+        BENCHMARK(fmt::format("serialize map [{}]", size))
+        {
+            json out;
+            return jstore::serialize(out, tree.profiles, true);
+        };
+
+        BENCHMARK(fmt::format("serialize deep [{}]", size))
+        {
+            json out;
+            return jstore::serialize(out, tree.deep, true);
+        };
+
+        BENCHMARK(fmt::format("dump_json [{}]", size))
+        {
+            return jstore::dump_json(tree, true);
+        };
+
+        BENCHMARK_ADVANCED(fmt::format("deserialize [{}]", size))(Catch::Benchmark::Chronometer meter)
+        {
+            vector<bench::root> out(meter.runs());
+
+            meter.measure([&](int i) { return jstore::deserialize(j, out[i]); });
+        };
+
+        BENCHMARK_ADVANCED(fmt::format("deserialize in place [{}]", size))(Catch::Benchmark::Chronometer meter)
+        {
+            vector<bench::root> out(meter.runs(), tree);
+
+            meter.measure([&](int i) { return jstore::deserialize(j, out[i], {}, true); });
+        };
+
+        BENCHMARK_ADVANCED(fmt::format("deserialize parallel [{}]", size))(Catch::Benchmark::Chronometer meter)
+        {
+            vector<bench::root> out(meter.runs());
+
+            meter.measure([&](int i) { return jstore::deserialize_parallel(j, out[i], 4); });
+        };
+    }
+}
+
+TEST_CASE("path lookup", "[benchmark]")
+{
+    for (size_t size : bench::SIZES) {
+        bench::root tree = bench::make_tree(size);
+        const string path = fmt::format("profiles/{}/name", size / 2);
+        const string &node = tree.profiles.at(static_cast<int>(size / 2)).name;
+        auto compiled = jstore::compiled_path<bench::root>::compile(path);
+
+        REQUIRE(compiled.has_value());
+
+        BENCHMARK(fmt::format("visit_path [{}]", size))
+        {
+            return jstore::visit_path(tree, path, [](auto &) {});
+        };
+
+        BENCHMARK(fmt::format("compiled_path::visit [{}]", size))
+        {
+            return compiled->visit(tree, [](auto &) {});
+        };
+
+        BENCHMARK(fmt::format("path_to [{}]", size))
+        {
+            return jstore::path_to(tree, node);
+        };
+
+        json j;
+
+        jstore::serialize(j, tree, true);
+
+        BENCHMARK(fmt::format("serialize_path [{}]", size))
+        {
+            bool changed = false;
+            return jstore::serialize_path(j, tree, path, changed, true);
+        };
+    }
+}
+
+TEST_CASE("save", "[benchmark]")
+{
+    const filesystem::path file = "/tmp/bench/jstore/data.json";
+
+    for (size_t size : bench::SIZES) {
+        filesystem::remove_all(file);
+        filesystem::create_directories(file.parent_path());
+
+        jstore::tree<bench::root> conf{file, {}, {}, bench::make_tree(size)};
+
+        conf.save();
+
+        BENCHMARK(fmt::format("save unchanged [{}]", size))
+        {
+            conf.save();
+        };
+
+        BENCHMARK(fmt::format("save changed [{}]", size))
+        {
+            ++conf->settings.i0;
+            conf.save();
+        };
+
+        BENCHMARK(fmt::format("load [{}]", size))
+        {
+            conf.load();
+        };
+    }
+
+    filesystem::remove_all(file.parent_path());
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <jstore.hpp>
+
+#include <filesystem>
+
+#include <sdbus-c++/sdbus-c++.h>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+using namespace std;
+
+static const sdbus::ServiceName SERVICE { "io.davidleeds.Bench.JStore" };
+static const sdbus::ObjectPath OBJECT   { "/io/davidleeds/Bench/JStore" };
+static const filesystem::path file      { "/tmp/bench/jstore/dbus.json" };
+
+namespace bench_dbus {
+
+struct profile {
+    string name;
+    vector<uint8_t> ssid;
+    int priority = 0;
+
+    bool operator==(const profile &) const = default;
+};
+
+struct root {
+    string country = "US";
+    map<string, profile> profiles;
+
+    bool operator==(const root &) const = default;
+};
+
+} /* namespace bench_dbus */
+
+VISITABLE_STRUCT(bench_dbus::profile, name, ssid, priority);
+VISITABLE_STRUCT(bench_dbus::root, country, profiles);
+
+
+TEST_CASE("dbus", "[benchmark]")
+{
+    filesystem::remove_all(file);
+    filesystem::create_directories(file.parent_path());
+
+    /* Service and client each use their own bus connection */
+    unique_ptr<sdbus::IConnection> service_conn{sdbus::createSessionBusConnection(SERVICE)};
+    service_conn->enterEventLoopAsync();
+
+    unique_ptr<sdbus::IConnection> client_conn{sdbus::createSessionBusConnection()};
+    client_conn->enterEventLoopAsync();
+    unique_ptr<sdbus::IProxy> proxy{sdbus::createProxy(*client_conn, SERVICE, OBJECT)};
+
+    for (size_t size : { 10, 1000 }) {
+        jstore::tree<bench_dbus::root> conf{file};
+
+        for (size_t i = 0; i < size; ++i) {
+            conf->profiles[fmt::format("p{}", i)] = { fmt::format("profile {}", i), { 'n', 'e', 't' }, static_cast<int>(i) };
+        }
+
+        unique_ptr<sdbus::IObject> service_object{sdbus::createObject(*service_conn, OBJECT)};
+        conf.register_dbus(*service_object);
+
+        const string path = fmt::format("profiles/p{}/name", size / 2);
+
+        BENCHMARK(fmt::format("Get [{}]", size))
+        {
+            string result;
+            proxy->callMethod("Get").onInterface(jstore::DBUS_INTERFACE).withArguments(path).storeResultsTo(result);
+            return result;
+        };
+
+        BENCHMARK(fmt::format("GetAll [{}]", size))
+        {
+            map<string, string> result;
+            proxy->callMethod("GetAll").onInterface(jstore::DBUS_INTERFACE).storeResultsTo(result);
+            return result;
+        };
+
+        BENCHMARK(fmt::format("emit_values_changed [{}]", size))
+        {
+            conf.dbus().emit_values_changed(conf->profiles);
+        };
+
+        conf.unregister_dbus();
+    }
+
+    filesystem::remove_all(file.parent_path());
+}
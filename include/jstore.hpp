@@ -7,20 +7,53 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <fmt/core.h>
 #include <nlohmann/json.hpp>
 #include <visit_struct/visit_struct.hpp>
 
+#include <jstore/compiled_path.hpp>
+#include <jstore/compression.hpp>
+#include <jstore/defaults.hpp>
+#include <jstore/deserialize_changes.hpp>
+#include <jstore/deserialize_parallel.hpp>
+#include <jstore/file_stamp.hpp>
 #include <jstore/for_each.hpp>
+#include <jstore/format.hpp>
+#include <jstore/lazy.hpp>
+#include <jstore/members.hpp>
+#include <jstore/observer.hpp>
+#include <jstore/path_to.hpp>
+#include <jstore/read_file.hpp>
 #include <jstore/serialization.hpp>
+#include <jstore/serialize_path.hpp>
+#include <jstore/staged_file.hpp>
 #include <jstore/stdio_fstream.hpp>
 #include <jstore/traits.hpp>
 #include <jstore/utilities.hpp>
 #include <jstore/visit_path.hpp>
+#include <jstore/watcher.hpp>
+#include <jstore/worker.hpp>
+#include <jstore/writer.hpp>
 
 #if JSTORE_SDBUSCPP
 #include <jstore/dbus.hpp>
@@ -30,14 +63,101 @@ namespace jstore {
 
 using json = nlohmann::json;
 
+/*
+ * Optional JSON Storage behavior.
+ */
+struct tree_options {
+    /*
+     * Set if no other process writes the file. When set, save() never
+     * re-reads the file, and unknown keys are preserved from the content
+     * cached on the last load() or save(). Otherwise, the file is only
+     * re-read when its inode, size, or modification time has changed.
+     */
+    bool sole_writer = false;
+
+    /*
+     * Set if the application reports every change using mark_dirty() or
+     * modify(). When set, save() only re-serializes the modified nodes into
+     * the cached file content, instead of serializing and comparing the
+     * whole tree. Changes that were not reported are not saved. The tree is
+     * serialized once on load(), and on the first save() after reload() or
+     * after another process changed the file, so saved content matches a
+     * full serialization.
+     */
+    bool track_changes = false;
+
+    /*
+     * Codec used to compress the file on save(). Files are decompressed on
+     * load() based on their header, so compressed and uncompressed files
+     * are always readable.
+     */
+    compression codec = compression::NONE;
+
+    /* Codec-specific compression level (0 selects the default) */
+    int compression_level = 0;
+
+    /*
+     * Window in which save_async() calls are coalesced into one disk write.
+     * The write is deferred until the delay has elapsed since the first
+     * pending save_async().
+     */
+    std::chrono::milliseconds save_delay{0};
+
+    /*
+     * Maximum journal size in bytes (0 disables journaling). When non-zero
+     * and change tracking is enabled, save() appends the modified nodes to a
+     * journal file (the file path with a ".journal" suffix), instead of
+     * rewriting the whole file. load() applies the journal on top of the
+     * file. Once the journal would exceed this size, it is compacted into a
+     * rewritten file.
+     */
+    size_t journal_limit = 0;
+
+    /*
+     * Top-level members (or map keys) of the root that are each persisted
+     * to a separate file, named after the member, in a directory next to the
+     * file (the file path with a ".d" suffix). save() only rewrites the files
+     * whose content changed, and load() reads the files in parallel.
+     * Sharding may not be combined with journaling.
+     */
+    std::vector<std::string> shards;
+
+    /*
+     * Number of threads used by load() to deserialize large arrays and maps
+     * (0 or 1 deserializes on the calling thread). Elements are split into
+     * contiguous chunks and merged in order, so the result and the errors
+     * reported are the same as with serial deserialization.
+     */
+    size_t load_threads = 0;
+
+    /*
+     * Reuse the existing elements of arrays and maps when loading, rather
+     * than clearing and rebuilding the tree. This avoids reallocating most
+     * of a large tree on each reload. User-defined from_json() functions
+     * must then assign every field of the value.
+     */
+    bool update_in_place = false;
+
+    /*
+     * Observer invoked with the duration (and byte count, if applicable) of
+     * each phase of load() and save(), and of D-Bus requests. If not set,
+     * nothing is measured.
+     */
+    observer_func observer;
+};
+
 /*
  * JSON Storage wrapper public API
+ *
+ * The Format policy selects the on-disk encoding (see format.hpp).
  */
 
-template <typename Root>
+template <typename Root, typename Format = json_format>
 class tree final {
 public:
     using root_type = Root;
+    using format_type = Format;
+    using change_func = std::function<void(const std::vector<std::string> &)>;
 
     /*
      * Construct a new JSON Storage object.
@@ -45,10 +165,32 @@ public:
      */
     template <typename ...RootArgs>
     explicit tree(const std::filesystem::path &path, error_func on_error = {}, RootArgs &&...args) :
+        tree(path, tree_options{}, std::move(on_error), std::forward<RootArgs>(args)...)
+    {
+    }
+
+    /*
+     * Construct a new JSON Storage object with non-default options.
+     */
+    template <typename ...RootArgs>
+    tree(const std::filesystem::path &path, tree_options options, error_func on_error = {}, RootArgs &&...args) :
         path_(path.is_relative() ? std::filesystem::absolute(path) : path),
+        options_(std::move(options)),
         on_error_(std::move(on_error)),
-        root_(forward<RootArgs>(args)...)
+        lazy_error_(std::make_shared<const error_func>(on_error_)),
+        root_(std::forward<RootArgs>(args)...),
+        shard_stamps_(options_.shards.size())
     {
+        for (auto &shard : options_.shards) {
+            if (shard.empty() || shard.find('/') != std::string::npos || shard == "." || shard == "..") {
+                throw std::invalid_argument(fmt::format("invalid shard name: '{}'", shard));
+            }
+        }
+
+        if (!options_.shards.empty() && options_.journal_limit > 0) {
+            throw std::invalid_argument("journaling is not supported for sharded trees");
+        }
+
         /* Attempt to load existing content (uses defaults on failure) */
         try {
             load();
@@ -59,74 +201,278 @@ public:
 
     /*
      * Load persisted data and overwrite the current in-memory state.
+     * Pending background saves are completed first.
      */
     void load()
     {
-        if (!std::filesystem::exists(path_)) {
-            return;
+        if (coalescing_worker *writer = get_writer()) {
+            writer->flush();
+        }
+
+        std::unique_lock root_lock(root_mutex_);
+        std::lock_guard lock(io_mutex_);
+
+        load_content();
+    }
+
+    /*
+     * Load persisted data if it was changed by another process, and only
+     * deserialize the nodes whose content changed (see deserialize_changes()).
+     * Returns the paths of the changed nodes, or the empty path if the
+     * whole tree was loaded. Unlike load(), the nodes that did not change on
+     * disk are left as-is, including any unsaved changes.
+     *
+     * Journaled trees are fully loaded when the file changes. Records
+     * appended to the journal by another process are not detected.
+     */
+    std::vector<std::string> reload()
+    {
+        if (coalescing_worker *writer = get_writer()) {
+            writer->flush();
+        }
+
+        std::unique_lock root_lock(root_mutex_);
+        std::unique_lock lock(io_mutex_);
+        std::vector<std::string> changed;
+
+        /* Files are renamed into place before their stamps are recorded, so wait for the tree's own saves */
+        commits_done_.wait(lock, [this]() { return commits_ == 0; });
+
+        if (cache_.has_value() && files_current()) {
+            return changed;
         }
 
-        std::ifstream file(path_);
+        if (!cache_.has_value() || options_.journal_limit > 0) {
+            /* Journaled changes are applied to the tree, not to the cached content, so load the whole tree */
+            load_content();
+            changed.emplace_back();
+            return changed;
+        }
+
+        std::optional<file_stamp> stamp;
+        std::vector<std::optional<file_stamp>> shard_stamps;
+        std::optional<json> content = read_content(stamp, shard_stamps);
         json in;
 
-        file >> in;
+        /* As with load(), the tree is unchanged if there is no file */
+        if (content.has_value()) {
+            phase_timer timer(options_.observer, io_phase::DESERIALIZE);
+            lazy_scope scope(lazy_error_);
 
-        /* Deserialize tree (nlohmann::json serializer must be available for each value type) */
-        deserialize(in, root_, on_error_);
+            in = std::move(content.value());
+            changed = deserialize_changes(*cache_, in, root_, on_error_);
+        }
+
+        /* Nodes not changed on disk may have unsaved changes, so the file content is cached as-is */
+        cache_ = std::move(in);
+        cache_serialized_ = false;
+        stamp_ = stamp;
+        shard_stamps_ = std::move(shard_stamps);
+        ++generation_;
+
+#if JSTORE_SDBUSCPP
+        if (dbus_) {
+            for (auto &path : changed) {
+                dbus_->invalidate(path);
+            }
+        }
+#endif
+
+        return changed;
     }
 
     /*
-     * Persist the current in-memory state.
+     * Watch the file for changes made by other processes. When the file is
+     * replaced, modified, or removed, reload() is invoked on a background
+     * thread, and `on_change` is invoked there with the changed paths. If
+     * the D-Bus interface is registered, a ValuesChanged signal is emitted
+     * for them too. Saves of this tree are not reported.
+     *
+     * Reloads take the same locks as load(), so threads that access the tree
+     * concurrently must use read() and write(). The D-Bus interface must be
+     * registered and unregistered while the file is not watched.
      */
-    void save()
+    void watch(change_func on_change = {})
     {
-        json old;
+        std::vector<file_watcher::target> targets = { { path_.parent_path(), { path_.filename().string() } } };
+
+        if (!options_.shards.empty()) {
+            std::filesystem::path shard_dir = shard_path(0).parent_path();
+
+            targets[0].names.insert(shard_dir.filename().string());
+            targets.push_back({ shard_dir, { options_.shards.begin(), options_.shards.end() } });
+        }
 
-        if (std::filesystem::exists(path_)) {
-            /* Attempt to load existing content, if file is already present */
+        watcher_.reset();
+        watcher_ = std::make_unique<file_watcher>(std::move(targets), [this, on_change = std::move(on_change)]() {
             try {
-                std::ifstream file(path_);
+                std::vector<std::string> paths = reload();
 
-                file >> old;
+                if (paths.empty()) {
+                    return;
+                }
+
+#if JSTORE_SDBUSCPP
+                if (dbus_) {
+                    dbus_->emit_paths_changed(paths);
+                }
+#endif
+
+                if (on_change) {
+                    on_change(paths);
+                }
             } catch (const std::exception &e) {
-                handle_error(on_error_, "failed to load {}: {}", path_.string(), e.what());
-                old = json{};
+                handle_error(on_error_, "failed to reload {}: {}", path_.string(), e.what());
             }
+        });
+    }
+
+    /*
+     * Stop watching the file.
+     */
+    void unwatch()
+    {
+        watcher_.reset();
+    }
+
+    /*
+     * Persist the current in-memory state.
+     * Pending background saves are completed first. Saves from several
+     * threads are written in turn, each replacing the file with the state
+     * serialized by the latest save.
+     */
+    void save()
+    {
+        if (!prepare_save()) {
+            flush();
+        } else if (coalescing_worker *writer = get_writer()) {
+            /* Submit with (or after) pending background saves to preserve ordering */
+            writer->submit([this]() { commit(); }, true).get();
         } else {
-            /* Ensure parent directory exists */
-            std::filesystem::create_directories(path_.parent_path());
+            commit();
         }
+    }
 
-        /*
-         * Serialization is performed on top of on-disk content to preserve any
-         * unknown keys. This enhances compatibility when interacting with files
-         * created by different software versions.
-         */
-        json out = old;
+    /*
+     * Persist the current in-memory state on a background thread.
+     *
+     * The tree is serialized before returning, so the application may
+     * continue modifying it. Only the disk write is deferred: saves within
+     * tree_options::save_delay of the first pending save are coalesced into a
+     * single write. The returned future completes when the data is durable,
+     * and rethrows any error encountered while writing.
+     */
+    std::shared_future<void> save_async()
+    {
+        coalescing_worker *writer = get_writer(true);
 
-        /* Serialize tree (nlohmann::json serializer must be available for value types) */
-        if (!serialize(out, root_, true, on_error_)) {
-            /* No serialized content, so remove the file */
-            std::filesystem::remove(path_);
-            return;
+        if (!prepare_save()) {
+            return writer->future();
         }
 
-        /* Skip the disk write if content is unchanged */
-        if (out == old) {
-            return;
+        return writer->submit([this]() { commit(); });
+    }
+
+    /*
+     * Complete pending background saves. Rethrows an error encountered while
+     * writing them. Errors of saves that completed before the call are only
+     * reported through the futures returned by save_async().
+     */
+    void flush()
+    {
+        if (coalescing_worker *writer = get_writer()) {
+            writer->flush().get();
         }
+    }
 
-        /* Write to temp file */
-        std::filesystem::path temp_path = path_.string() + "~";
-        stdio_fstream file(temp_path, std::ios_base::out);
+    /*
+     * Report that a node in the tree was modified.
+     * Used when change tracking is enabled (see tree_options::track_changes).
+     *
+     * May be called inside write(), or from any thread, as modified nodes
+     * are recorded under their own lock. Outside of write(), the node is
+     * found without locking the tree, so (as with root()) other threads must
+     * not modify the tree concurrently.
+     */
+    template <typename Node>
+    void mark_dirty(const Node &node)
+    {
+        std::optional<std::string> path = path_to(root_, node);
 
-        file << out;
+        if (!path.has_value()) {
+            throw std::invalid_argument(fmt::format("{} node is not in the tree", typestr<Node>()));
+        }
 
-        file.fsync();
-        file.close();
+        mark_dirty_path(path.value());
+    }
+
+    /*
+     * Report that the node at the specified path was modified. May be called
+     * inside write(), or from any thread.
+     */
+    void mark_dirty_path(std::string_view path)
+    {
+        {
+            std::lock_guard lock(dirty_mutex_);
+            dirty_.emplace(path);
+        }
+
+#if JSTORE_SDBUSCPP
+        if (dbus_) {
+            dbus_->invalidate(std::string{path});
+        }
+#endif
+    }
+
+    /*
+     * Invoke the supplied function with the node at the specified path,
+     * and mark it as modified. Map keys are inserted if not present.
+     * Returns false if the path does not exist.
+     */
+    template <typename Func>
+    bool modify(std::string_view path, const Func &func)
+    {
+        std::unique_lock lock(root_mutex_);
+
+        if (!jstore::visit_path(root_, path, func, true, on_error_)) {
+            return false;
+        }
+
+        mark_dirty_path(path);
+        return true;
+    }
+
+    /*
+     * Invoke `func` with a const reference to the root node, and return its
+     * result. A shared lock is held, so concurrent read() calls, D-Bus reads,
+     * and the serialization of saves do not block each other, but are
+     * excluded by write(). Saves from several threads are written in turn.
+     *
+     * Synchronized operations (read(), write(), modify(), load(), save(),
+     * save_async(), and D-Bus requests and emit_values_changed()) MUST NOT be
+     * called from `func`. Unsynchronized access through root(), operator->(),
+     * and for_each() is the application's responsibility.
+     */
+    template <typename Func>
+    decltype(auto) read(Func &&func) const
+    {
+        std::shared_lock lock(root_mutex_);
+
+        return std::forward<Func>(func)(root_);
+    }
+
+    /*
+     * Invoke `func` with a reference to the root node, and return its
+     * result. An exclusive lock is held. `func` may call mark_dirty() and
+     * mark_dirty_path(), but MUST NOT call other synchronized operations
+     * (see read()).
+     */
+    template <typename Func>
+    decltype(auto) write(Func &&func)
+    {
+        std::unique_lock lock(root_mutex_);
 
-        /* Atomically overwrite output file */
-        std::filesystem::rename(temp_path, path_);
+        return std::forward<Func>(func)(root_);
     }
 
     const std::filesystem::path &path() const
@@ -173,6 +519,16 @@ public:
         jstore::for_each<LEAF>(root_, func);
     }
 
+    /*
+     * Invoke the supplied function with the lazily formatted path (see
+     * jstore::lazy_path) and value of each node.
+     */
+    template <typename LeafFunc>
+    void for_each_lazy(const LeafFunc &func)
+    {
+        jstore::for_each_lazy<LEAF>(root_, func);
+    }
+
 #if JSTORE_SDBUSCPP
     using dbus_type = jstore::dbus<Root>;
 
@@ -183,7 +539,11 @@ public:
      */
     void register_dbus(sdbus::IObject &object, dbus_type::filter_func filter = {})
     {
-        dbus_ = std::make_unique<dbus_type>(root_, object, std::move(filter));
+        /* Values set remotely are saved like changes reported by modify() */
+        dbus_ = std::make_unique<dbus_type>(root_, object, std::move(filter), &root_mutex_, [this](const std::string &path) {
+            mark_dirty_path(path);
+        });
+        dbus_->set_observer(options_.observer);
     }
 
     /*
@@ -208,9 +568,959 @@ private:
 #endif /* JSTORE_SDBUSCPP */
 
 private:
-    std::filesystem::path path_;
-    error_func on_error_;
-    root_type root_;
+    friend class save_group;
+
+    /*
+     * File updates produced by prepare_save(), and not yet written by commit().
+     * Updates from successive saves are merged, so coalesced background saves
+     * write everything that was saved.
+     */
+    struct pending_write {
+        enum class action {
+            NONE,
+            WRITE,
+            REMOVE
+        };
+
+        /* Snapshot file update, and encoded content for WRITE */
+        action file = action::NONE;
+        std::string data;
+
+        /* Records to append to the journal (written after the snapshot) */
+        std::string journal;
+
+        /* Shard file updates by shard index: encoded content, or std::nullopt to remove */
+        std::map<size_t, std::optional<std::string>> shards;
+
+        /* Set if the parent directory may not exist */
+        bool create_directories = false;
+
+        /* Cache generation the updates were serialized from */
+        uint64_t generation = 0;
+
+        bool empty() const
+        {
+            return file == action::NONE && journal.empty() && shards.empty();
+        }
+    };
+
+    /*
+     * Serialize the tree on top of the cached file content, update the cache
+     * to the new content, and queue the file updates to be written by commit().
+     * Returns false if there is nothing to write.
+     */
+    bool prepare_save()
+    {
+        /* Concurrent writers are excluded, so a consistent tree is serialized */
+        std::shared_lock root_lock(root_mutex_);
+        std::lock_guard lock(io_mutex_);
+        std::lock_guard dirty_lock(dirty_mutex_);
+
+        bool current = refresh_cache();
+        const json &old = *cache_;
+
+        /*
+         * Serialization is performed on top of on-disk content to preserve any
+         * unknown keys. This enhances compatibility when interacting with files
+         * created by different software versions.
+         */
+        json out;
+        bool changed = false;
+        std::optional<bool> populated;
+        std::optional<std::string> records;
+        phase_timer serialize_timer(options_.observer, io_phase::SERIALIZE);
+
+        if (options_.track_changes && current && cache_serialized_) {
+            if (dirty_.empty()) {
+                return !pending_.empty();
+            }
+
+            /* Only re-serialize modified nodes */
+            out = old;
+            populated = serialize_dirty(out, changed);
+
+            if (populated.value_or(false) && changed && journal_writable()) {
+                records = journal_dirty();
+            }
+        }
+
+        if (!populated.has_value()) {
+            out = old;
+
+            /* Serialize tree (nlohmann::json serializer must be available for value types) */
+            populated = serialize(out, root_, true, on_error_);
+            changed = (out != old);
+        }
+
+        serialize_timer.stop();
+        dirty_.clear();
+        cache_serialized_ = true;
+
+        if (!populated.value()) {
+            /* No serialized content, so remove the file */
+            if (!stamp_.has_value() && old.is_null() && pending_.empty()) {
+                return false;
+            }
+
+            pending_.file = pending_write::action::REMOVE;
+            pending_.data.clear();
+            pending_.journal.clear();
+
+            for (size_t i = 0; i < options_.shards.size(); ++i) {
+                pending_.shards.insert_or_assign(i, std::nullopt);
+            }
+
+            journal_size_.reset();
+            cache_ = json{};
+        } else if (!changed) {
+            /* Skip the disk write if content is unchanged */
+            observe(options_.observer, io_phase::SKIP_WRITE);
+            return !pending_.empty();
+        } else if (records.has_value() && journal_size_.value() + records->size() <= options_.journal_limit) {
+            /* Append the modified nodes to the journal */
+            pending_.journal += records.value();
+            journal_size_.value() += records->size();
+            cache_ = std::move(out);
+        } else if (!options_.shards.empty() && out.is_object()) {
+            /* Only write the files with changed content */
+            prepare_shards(out);
+            cache_ = std::move(out);
+        } else {
+            /* Write a new snapshot (this also compacts the journal) */
+            pending_.file = pending_write::action::WRITE;
+            pending_.data = encode(out);
+            pending_.journal.clear();
+            pending_.create_directories |= !stamp_.has_value();
+            journal_size_ = options_.journal_limit > 0 ? std::optional<size_t>{0} : std::nullopt;
+            cache_ = std::move(out);
+        }
+
+        pending_.generation = ++generation_;
+        return true;
+    }
+
+    /*
+     * Queue writes of the shard files and the file for the changed parts of
+     * the serialized tree `out`, compared to the cached content.
+     */
+    void prepare_shards(json &out)
+    {
+        json &old = *cache_;
+        std::vector<std::optional<json>> values(options_.shards.size());
+
+        /* Move shard members out of the cached and new content, so the rest can be compared */
+        for (size_t i = 0; i < options_.shards.size(); ++i) {
+            const std::string &name = options_.shards[i];
+            std::optional<json> old_value;
+
+            if (auto it = out.find(name); it != out.end()) {
+                values[i] = std::move(*it);
+                out.erase(it);
+            }
+
+            if (old.is_object()) {
+                if (auto it = old.find(name); it != old.end()) {
+                    old_value = std::move(*it);
+                    old.erase(it);
+                }
+            }
+
+            if (values[i] != old_value || values[i].has_value() != shard_stamps_[i].has_value()) {
+                pending_.shards.insert_or_assign(i, values[i].has_value() ? std::optional{encode(values[i].value())} : std::nullopt);
+            }
+        }
+
+        bool changed = old.is_null() ? !out.empty() : (old != out);
+
+        if (changed || !stamp_.has_value()) {
+            pending_.file = pending_write::action::WRITE;
+            pending_.data = encode(out);
+            pending_.create_directories |= !stamp_.has_value();
+        }
+
+        for (size_t i = 0; i < options_.shards.size(); ++i) {
+            if (values[i].has_value()) {
+                out[options_.shards[i]] = std::move(values[i].value());
+            }
+        }
+    }
+
+    /*
+     * File updates taken from the queue by stage_commit(), with the new
+     * files written to temporary files.
+     */
+    struct staged_commit {
+        pending_write write;
+
+        /* Shard files in shard index order, followed by the file */
+        std::vector<staged_file> files;
+
+        /* Set until the commit is installed or aborted (see commits_) */
+        bool in_flight = false;
+
+        /* Held until the commit is installed or aborted, so commits are installed in order */
+        std::unique_lock<std::mutex> lock;
+    };
+
+    /*
+     * Write file updates queued by prepare_save() to disk.
+     */
+    void commit()
+    {
+        staged_commit staged = stage_commit();
+
+        try {
+            for (auto &file : staged.files) {
+                file.fsync(options_.observer);
+            }
+
+            install_commit(staged);
+        } catch (...) {
+            abort_commit(staged);
+            throw;
+        }
+    }
+
+    /*
+     * Take the file updates queued by prepare_save(), and write the new
+     * files' content to temporary files. Nothing is renamed into place until
+     * install_commit(), and the temporary files must be flushed to storage
+     * first.
+     */
+    staged_commit stage_commit()
+    {
+        staged_commit staged;
+
+        /* Commits take the pending updates in the same order they install them */
+        staged.lock = std::unique_lock(commit_mutex_);
+
+        {
+            std::lock_guard lock(io_mutex_);
+            std::swap(staged.write, pending_);
+            staged.in_flight = true;
+            ++commits_;
+        }
+
+        try {
+            for (auto &[index, data] : staged.write.shards) {
+                if (data.has_value()) {
+                    staged.files.emplace_back(shard_path(index), data.value(), true, options_.observer);
+                }
+            }
+
+            if (staged.write.file == pending_write::action::WRITE) {
+                staged.files.emplace_back(path_, staged.write.data, staged.write.create_directories, options_.observer);
+            }
+        } catch (...) {
+            abort_commit(staged);
+            throw;
+        }
+
+        return staged;
+    }
+
+    /*
+     * Rename the staged files into place, and apply the remaining file
+     * updates (removals and journal records).
+     */
+    void install_commit(staged_commit &staged)
+    {
+        const pending_write &write = staged.write;
+        auto file = staged.files.begin();
+        std::optional<file_stamp> stamp;
+        std::map<size_t, std::optional<file_stamp>> shard_stamps;
+
+        for (auto &[index, data] : write.shards) {
+            if (data.has_value()) {
+                shard_stamps[index] = (file++)->install(options_.observer);
+            } else {
+                std::filesystem::remove(shard_path(index));
+                shard_stamps[index] = std::nullopt;
+            }
+        }
+
+        switch (write.file) {
+        case pending_write::action::WRITE:
+            stamp = (file++)->install(options_.observer);
+            if (options_.journal_limit > 0) {
+                /* Journal is compacted into the snapshot */
+                std::filesystem::remove(journal_path());
+            }
+            break;
+        case pending_write::action::REMOVE:
+            std::filesystem::remove(path_);
+            if (options_.journal_limit > 0) {
+                std::filesystem::remove(journal_path());
+            }
+            break;
+        case pending_write::action::NONE:
+            break;
+        }
+
+        if (!write.journal.empty()) {
+            append_journal(write.journal);
+        }
+
+        std::lock_guard lock(io_mutex_);
+
+        /* The cache may have been replaced by a newer load() or save() while writing */
+        if (generation_ == write.generation) {
+            if (write.file != pending_write::action::NONE) {
+                stamp_ = stamp;
+            }
+
+            for (auto &[index, shard_stamp] : shard_stamps) {
+                shard_stamps_[index] = shard_stamp;
+            }
+        }
+
+        end_commit(staged);
+    }
+
+    /*
+     * Discard staged files that were not installed, after a failure.
+     */
+    void abort_commit(staged_commit &staged) noexcept
+    {
+        for (auto &file : staged.files) {
+            file.discard();
+        }
+
+        /* Cached content was not persisted, so re-read the file on the next save */
+        std::lock_guard lock(io_mutex_);
+
+        if (generation_ == staged.write.generation) {
+            cache_.reset();
+        }
+
+        end_commit(staged);
+    }
+
+    /*
+     * Record that a staged commit is no longer in flight.
+     * The I/O lock must be held.
+     */
+    void end_commit(staged_commit &staged) noexcept
+    {
+        if (std::exchange(staged.in_flight, false) && --commits_ == 0) {
+            commits_done_.notify_all();
+        }
+
+        if (staged.lock.owns_lock()) {
+            staged.lock.unlock();
+        }
+    }
+
+    /*
+     * Return the background save thread, or nullptr if not started. If
+     * `create` is set, the thread is started.
+     */
+    coalescing_worker *get_writer(bool create = false)
+    {
+        std::lock_guard lock(io_mutex_);
+
+        if (!writer_ && create) {
+            writer_ = std::make_unique<coalescing_worker>(options_.save_delay);
+        }
+
+        return writer_.get();
+    }
+
+    std::filesystem::path journal_path() const
+    {
+        return path_.string() + ".journal";
+    }
+
+    std::filesystem::path shard_path(size_t index) const
+    {
+        return std::filesystem::path(path_.string() + ".d") / options_.shards[index];
+    }
+
+    /*
+     * Return true if modified nodes may be appended to the journal, instead
+     * of writing a snapshot.
+     */
+    bool journal_writable() const
+    {
+        if (!journal_size_.has_value()) {
+            return false;
+        }
+
+        /* Journal records are applied on top of an existing snapshot */
+        switch (pending_.file) {
+        case pending_write::action::WRITE:
+            return true;
+        case pending_write::action::REMOVE:
+            return false;
+        case pending_write::action::NONE:
+            break;
+        }
+
+        return stamp_.has_value();
+    }
+
+    /*
+     * Identifies the snapshot a journal applies to. Records in a journal left
+     * behind by an interrupted compaction are not applied to the new snapshot.
+     */
+    static json journal_header(const file_stamp &stamp)
+    {
+        return {
+            { "dev", stamp.dev },
+            { "ino", stamp.ino },
+            { "size", stamp.size },
+            { "mtime", { stamp.mtime.tv_sec, stamp.mtime.tv_nsec } }
+        };
+    }
+
+    /*
+     * Serialize the dirty nodes into journal records. Each record is a line
+     * of text JSON with the node path and its complete serialization:
+     *
+     *   { "p": "m/x", "v": 11 }
+     *
+     * If a node was removed, its nearest remaining ancestor is recorded
+     * instead. Returns std::nullopt if the root must be recorded.
+     */
+    std::optional<std::string> journal_dirty()
+    {
+        std::string records;
+
+        for (auto &dirty : dirty_) {
+            if (has_dirty_ancestor(dirty)) {
+                continue;
+            }
+
+            std::string_view path = dirty;
+            json value;
+
+            auto serialize_node = [&](const auto &node) {
+                jstore::serialize(value, node, false, on_error_);
+            };
+
+            while (!jstore::visit_path(root_, path, serialize_node)) {
+                auto pos = path.rfind('/');
+                path = path.substr(0, pos == std::string_view::npos ? 0 : pos);
+            }
+
+            if (path.empty()) {
+                return std::nullopt;
+            }
+
+            records += json{ { "p", path }, { "v", std::move(value) } }.dump();
+            records += '\n';
+        }
+
+        return records;
+    }
+
+    /*
+     * Append journal records, starting a new journal for the current snapshot if needed.
+     */
+    void append_journal(const std::string &records)
+    {
+        std::filesystem::path journal = journal_path();
+        bool exists = std::filesystem::exists(journal);
+        stdio_fstream file(journal, std::ios_base::out | std::ios_base::app);
+
+        if (!file) {
+            throw std::runtime_error("failed to open journal");
+        }
+
+        if (!exists) {
+            auto stamp = file_stamp::of(path_);
+
+            if (!stamp.has_value()) {
+                throw std::runtime_error("journal snapshot is missing");
+            }
+
+            file << journal_header(stamp.value()).dump() << '\n';
+        }
+
+        phase_timer write_timer(options_.observer, io_phase::WRITE, journal.native());
+        file.write(records.data(), records.size());
+        write_timer.stop(records.size());
+
+        phase_timer fsync_timer(options_.observer, io_phase::FSYNC, journal.native());
+        file.fsync();
+        fsync_timer.stop();
+
+        if (!file) {
+            throw std::runtime_error("failed to write journal");
+        }
+    }
+
+    /*
+     * Apply journaled changes to the tree. Returns true if any were applied.
+     */
+    bool replay_journal(const file_stamp &snapshot)
+    {
+        std::ifstream file(journal_path(), std::ios_base::in | std::ios_base::binary);
+        std::string line;
+        size_t size = 0;
+        bool applied = false;
+
+        journal_size_ = 0;
+
+        if (!file || !std::getline(file, line)) {
+            return false;
+        }
+
+        json header = json::parse(line, nullptr, false);
+
+        if (header != journal_header(snapshot)) {
+            /* Force a new snapshot on the next save to discard the stale journal */
+            handle_error(on_error_, "ignoring stale journal for {}", path_.string());
+            journal_size_.reset();
+            return false;
+        }
+
+        size += line.size() + 1;
+
+        while (std::getline(file, line)) {
+            json record = json::parse(line, nullptr, false);
+
+            /* A truncated record is left by an interrupted append */
+            if (file.eof() || !record.is_object() || !record.contains("v") ||
+                    !record.contains("p") || !record["p"].is_string()) {
+                handle_error(on_error_, "ignoring truncated journal for {}", path_.string());
+                journal_size_.reset();
+                break;
+            }
+
+            std::string path = record["p"].get<std::string>();
+
+            auto deserialize_node = [&](auto &node) {
+                if constexpr (!std::is_const_v<std::remove_reference_t<decltype(node)>>) {
+                    jstore::deserialize(record["v"], node, on_error_);
+                }
+            };
+
+            if (jstore::visit_path(root_, path, deserialize_node, true, on_error_)) {
+                applied = true;
+            }
+
+            size += line.size() + 1;
+        }
+
+        if (journal_size_.has_value()) {
+            journal_size_ = size;
+        }
+
+        return applied;
+    }
+
+    /*
+     * Load persisted data and overwrite the current in-memory state.
+     * The root and I/O locks must be held.
+     */
+    void load_content()
+    {
+        lazy_scope scope(lazy_error_);
+
+        cache_.reset();
+        ++generation_;
+        journal_size_.reset();
+
+        /* Stamps are taken before reading, so concurrent changes are detected on the next save */
+        std::optional<file_stamp> stamp;
+        std::vector<std::optional<file_stamp>> shard_stamps;
+        std::optional<json> content = read_content(stamp, shard_stamps);
+
+        shard_stamps_ = std::move(shard_stamps);
+
+        if (!content.has_value()) {
+            cache_ = json{};
+            cache_serialized_ = false;
+            stamp_.reset();
+            return;
+        }
+
+        json in = std::move(content.value());
+
+        /* Deserialize tree (nlohmann::json serializer must be available for each value type) */
+        {
+            phase_timer timer(options_.observer, io_phase::DESERIALIZE);
+
+            if (options_.load_threads > 1) {
+                deserialize_parallel(in, root_, options_.load_threads, on_error_, options_.update_in_place);
+            } else {
+                deserialize(in, root_, on_error_, options_.update_in_place);
+            }
+        }
+
+        bool replayed = options_.journal_limit > 0 && stamp.has_value() && replay_journal(stamp.value());
+
+        if (replayed || options_.track_changes) {
+            /* Cache reflects the snapshot with journaled changes applied, as serialized by save() */
+            serialize(in, root_, true, on_error_);
+        }
+
+        cache_ = std::move(in);
+        cache_serialized_ = replayed || options_.track_changes;
+        stamp_ = stamp;
+
+        {
+            std::lock_guard lock(dirty_mutex_);
+            dirty_.clear();
+        }
+
+#if JSTORE_SDBUSCPP
+        if (dbus_) {
+            dbus_->invalidate_all();
+        }
+#endif
+    }
+
+    /*
+     * Return true if the file and shard files are the versions reflected by
+     * the cache.
+     */
+    bool files_current() const
+    {
+        if (!(file_stamp::of(path_) == stamp_)) {
+            return false;
+        }
+
+        for (size_t i = 0; i < options_.shards.size(); ++i) {
+            if (!(file_stamp::of(shard_path(i)) == shard_stamps_[i])) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /*
+     * Ensure the cache holds the persisted content that save() serializes on
+     * top of. The file is only read if the cached copy may be out of date.
+     * Returns false if the cached copy was replaced.
+     */
+    bool refresh_cache()
+    {
+        if (cache_.has_value() && options_.sole_writer) {
+            return true;
+        }
+
+        if (cache_.has_value() && files_current()) {
+            return true;
+        }
+
+        cache_ = json{};
+        cache_serialized_ = false;
+        stamp_ = file_stamp::of(path_);
+        ++generation_;
+
+        /* Attempt to load existing content, if files are already present */
+        try {
+            std::optional<file_stamp> read_stamp;
+            std::vector<std::optional<file_stamp>> shard_stamps;
+            std::optional<json> content = read_content(read_stamp, shard_stamps);
+
+            if (content.has_value()) {
+                cache_ = std::move(content.value());
+            }
+
+            stamp_ = read_stamp;
+            shard_stamps_ = std::move(shard_stamps);
+        } catch (const std::exception &e) {
+            handle_error(on_error_, "failed to load {}: {}", path_.string(), e.what());
+            cache_ = json{};
+        }
+
+        return false;
+    }
+
+    /*
+     * Read and decode the persisted content: the file, with the content of
+     * each shard file at its top-level key. Shard files are read in parallel.
+     * Returns std::nullopt if no file exists. Sets `stamp` and `shard_stamps`
+     * to the versions of the files read.
+     */
+    std::optional<json> read_content(std::optional<file_stamp> &stamp, std::vector<std::optional<file_stamp>> &shard_stamps) const
+    {
+        auto read_decoded = [this](const std::filesystem::path &path, std::optional<file_stamp> &read_stamp) -> std::optional<json> {
+            file_stamp version;
+            phase_timer read_timer(options_.observer, io_phase::READ, path.native());
+            std::optional<std::string> data = read_file(path, version);
+
+            if (!data.has_value()) {
+                read_stamp.reset();
+                return std::nullopt;
+            }
+
+            read_timer.stop(data->size());
+            read_stamp = version;
+
+            phase_timer decode_timer(options_.observer, io_phase::DECODE, path.native());
+            return decode(std::move(data.value()));
+        };
+
+        std::vector<std::future<std::optional<json>>> reads;
+
+        shard_stamps.assign(options_.shards.size(), std::nullopt);
+
+        for (size_t i = 0; i < options_.shards.size(); ++i) {
+            reads.push_back(std::async(std::launch::async, read_decoded, shard_path(i), std::ref(shard_stamps[i])));
+        }
+
+        std::optional<json> content = read_decoded(path_, stamp);
+
+        for (size_t i = 0; i < reads.size(); ++i) {
+            std::optional<json> value = reads[i].get();
+
+            if (value.has_value()) {
+                if (!content.has_value() || !content->is_object()) {
+                    content = json::object();
+                }
+
+                (*content)[options_.shards[i]] = std::move(value.value());
+            }
+        }
+
+        return content;
+    }
+
+    /*
+     * Encode content for persistence.
+     */
+    std::string encode(const json &content) const
+    {
+        phase_timer timer(options_.observer, io_phase::ENCODE);
+        std::string data = compress(format_type::encode(content), options_.codec, options_.compression_level);
+
+        timer.stop(data.size());
+        return data;
+    }
+
+    /*
+     * Decode the persisted content.
+     */
+    static json decode(std::string &&data)
+    {
+        if (is_compressed(data)) {
+            data = decompress(data);
+        }
+
+        return format_type::decode(data);
+    }
+
+    /*
+     * Re-serialize dirty nodes on top of `out`. Returns std::nullopt if the
+     * full tree must be serialized instead.
+     */
+    std::optional<bool> serialize_dirty(json &out, bool &changed)
+    {
+        std::optional<bool> populated;
+
+        /* Root is serialized on top of unknown keys by the full serialization */
+        if (dirty_.contains("")) {
+            return populated;
+        }
+
+        for (auto &path : dirty_) {
+            if (has_dirty_ancestor(path)) {
+                continue;
+            }
+
+            populated = serialize_path(out, root_, path, changed, true, on_error_);
+            if (!populated.has_value()) {
+                break;
+            }
+        }
+
+        return populated;
+    }
+
+    /*
+     * Return true if `path` is a descendant of another dirty node.
+     */
+    bool has_dirty_ancestor(std::string_view path) const
+    {
+        if (path.empty()) {
+            return false;
+        }
+
+        if (dirty_.contains("")) {
+            return true;
+        }
+
+        for (auto pos = path.rfind('/'); pos != std::string_view::npos && pos > 0; pos = path.rfind('/', pos - 1)) {
+            if (dirty_.contains(std::string{path.substr(0, pos)})) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    std::filesystem::path path_;
+    tree_options options_;
+    error_func on_error_;
+
+    /* Error handler of lazy nodes, which may report errors after the tree is destroyed */
+    std::shared_ptr<const error_func> lazy_error_;
+
+    root_type root_;
+
+    /* Guards the tree during read(), write(), and synchronized operations */
+    mutable std::shared_mutex root_mutex_;
+
+    /* Content of the file at the last load() or save(), and the file version it reflects */
+    std::optional<json> cache_;
+    std::optional<file_stamp> stamp_;
+
+    /*
+     * Set if the cache holds the serialized tree, rather than file content with
+     * unknown keys below the root, so modified nodes may be serialized into it
+     */
+    bool cache_serialized_ = false;
+
+    /* Versions of the shard files reflected by the cache (see tree_options::shards) */
+    std::vector<std::optional<file_stamp>> shard_stamps_;
+
+    /*
+     * Paths of nodes modified since the last save() (see tree_options::track_changes),
+     * guarded separately as mark_dirty() may be called without the tree lock
+     */
+    std::mutex dirty_mutex_;
+    std::set<std::string> dirty_;
+
+    /* Guards the cache, stamp, and pending writes, which are accessed by background saves */
+    std::mutex io_mutex_;
+    pending_write pending_;
+    uint64_t generation_ = 0;
+
+    /* Number of staged commits not yet installed or aborted, and signaled when it drops to zero */
+    size_t commits_ = 0;
+    std::condition_variable commits_done_;
+
+    /* Held from staging to installing a commit, so concurrent saves write their files in turn */
+    std::mutex commit_mutex_;
+
+    /* Bytes in the journal, or std::nullopt if a snapshot must be written first */
+    std::optional<size_t> journal_size_;
+
+    /*
+     * Background save thread, started on the first save_async() (destroyed first to complete
+     * pending saves). Started and read under the I/O lock, see get_writer().
+     */
+    std::unique_ptr<coalescing_worker> writer_;
+
+    /* File watcher started by watch() (destroyed before the state it reloads) */
+    std::unique_ptr<file_watcher> watcher_;
+};
+
+/*
+ * Saves several trees together, with a single flush to storage.
+ *
+ * save() writes the new content of every tree to temporary files, flushes
+ * them all to storage (once per filesystem, where possible), and only then
+ * renames them into place and flushes their directories. If writing any
+ * tree fails, no file is replaced. Each rename is atomic, but the set of
+ * renames is not, so a crash while renaming may leave only some trees
+ * updated. Journal records (see tree_options::journal_limit) are appended
+ * after the renames.
+ *
+ * The trees must outlive the group. They may be saved by other threads
+ * during save(), but groups sharing a tree MUST NOT be saved concurrently.
+ * Flushes of the group are reported to `observer`.
+ */
+class save_group {
+public:
+    explicit save_group(observer_func observer = {}) :
+        observer_(std::move(observer))
+    {
+    }
+
+    /*
+     * Add a tree to the group.
+     */
+    template <typename Root, typename Format>
+    void add(tree<Root, Format> &t)
+    {
+        using staged_commit = typename tree<Root, Format>::staged_commit;
+
+        auto staged = std::make_shared<staged_commit>();
+
+        members_.push_back({
+            [&t, staged]() -> std::vector<staged_file> & {
+                /* Pending background saves are completed first to preserve ordering */
+                t.flush();
+                t.prepare_save();
+                *staged = t.stage_commit();
+                return staged->files;
+            },
+            [&t, staged]() {
+                t.install_commit(*staged);
+                *staged = staged_commit{};
+            },
+            [&t, staged]() {
+                t.abort_commit(*staged);
+                *staged = staged_commit{};
+            }
+        });
+    }
+
+    /*
+     * Persist the current in-memory state of every tree in the group.
+     */
+    void save()
+    {
+        std::vector<staged_file *> files;
+        size_t staged = 0;
+
+        try {
+            for (; staged < members_.size(); ++staged) {
+                for (auto &file : members_[staged].stage()) {
+                    files.push_back(&file);
+                }
+            }
+
+            fsync_files(files, observer_);
+        } catch (...) {
+            for (size_t i = 0; i < staged; ++i) {
+                members_[i].abort();
+            }
+            throw;
+        }
+
+        std::set<std::filesystem::path> dirs;
+
+        for (staged_file *file : files) {
+            dirs.insert(file->path().parent_path());
+        }
+
+        size_t installed = 0;
+
+        try {
+            for (; installed < members_.size(); ++installed) {
+                members_[installed].install();
+            }
+        } catch (...) {
+            for (size_t i = installed; i < members_.size(); ++i) {
+                members_[i].abort();
+            }
+            throw;
+        }
+
+        fsync_directories(dirs, observer_);
+    }
+
+private:
+    struct member {
+        /* Serialize the tree and write its temporary files */
+        std::function<std::vector<staged_file> &()> stage;
+
+        /* Rename the temporary files into place */
+        std::function<void()> install;
+
+        /* Discard the temporary files */
+        std::function<void()> abort;
+    };
+
+    observer_func observer_;
+    std::vector<member> members_;
 };
 
 } /* namespace jstore */
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <any>
+#include <charconv>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+#include <visit_struct/visit_struct.hpp>
+
+#include <jstore/members.hpp>
+#include <jstore/serialization.hpp>
+#include <jstore/traits.hpp>
+#include <jstore/utilities.hpp>
+#include <jstore/visit_path.hpp>
+
+namespace jstore {
+
+/*
+ * Path to a node in a tree of type Root, parsed and validated once.
+ *
+ * Visiting a compiled path is equivalent to calling visit_path() with the
+ * path string, but does not re-parse the path: struct members are resolved
+ * to indices, array indices are parsed, and map keys are converted to the
+ * map's key type when the path is compiled. Use this for paths that are
+ * looked up repeatedly.
+ */
+template <typename Root>
+class compiled_path {
+public:
+    using root_type = Root;
+
+    /*
+     * Compile a path. Returns std::nullopt if the path cannot exist in a
+     * tree of type Root (e.g. unknown struct members or malformed keys).
+     */
+    static std::optional<compiled_path> compile(std::string_view path, const error_func &on_error = {})
+    {
+        compiled_path compiled;
+
+        if (!compile_segments<root_type>(path, compiled.segments_, compiled.path_, on_error)) {
+            return std::nullopt;
+        }
+
+        return compiled;
+    }
+
+    /*
+     * Invoke `func` with the node at this path. Returns false if the node
+     * does not exist. If `insert_keys` is set, missing map keys are inserted.
+     */
+    template <typename Func>
+    bool visit(root_type &root, const Func &func, bool insert_keys = false) const
+    {
+        return visit_segments(root, 0, func, insert_keys);
+    }
+
+    template <typename Func>
+    bool visit(const root_type &root, const Func &func) const
+    {
+        return visit_segments(root, 0, func, false);
+    }
+
+    /*
+     * Invoke `func` with a modifiable copy of the node at this path, without
+     * modifying the tree. Missing map keys are treated as default constructed
+     * values, as if inserted by visit() with `insert_keys` set. Returns false
+     * if the node cannot be reached.
+     */
+    template <typename Func>
+    bool visit_copy(const root_type &root, const Func &func) const
+    {
+        return visit_copy_segments(root, 0, func);
+    }
+
+    /*
+     * Return the canonical form of the path string this was compiled from,
+     * as formatted by for_each() and path_to() (e.g. "m/1" if compiled from
+     * "m/01"). Paths to the same node have the same canonical form.
+     */
+    const std::string &str() const
+    {
+        return path_;
+    }
+
+private:
+    /*
+     * Resolved path segment: a struct member or array index, or a map key.
+     */
+    struct segment {
+        size_t index = 0;
+        std::any key;
+    };
+
+    compiled_path() = default;
+
+    template <typename T>
+    static bool compile_segments(std::string_view path, std::vector<segment> &segments, std::string &canonical,
+            const error_func &on_error)
+    {
+        if constexpr (traits::lazy<T>) {
+            /* Lazy nodes do not add a path segment */
+            return compile_segments<typename T::value_type>(path, segments, canonical, on_error);
+        } else if (path.empty()) {
+            return true;
+        }
+
+        auto [str, child_path] = split_path(path);
+        segment &seg = segments.emplace_back();
+
+        if (!canonical.empty()) {
+            canonical += '/';
+        }
+
+        if constexpr (traits::array<T>) {
+            auto [ptr, ec] = std::from_chars(str.begin(), str.end(), seg.index, 10);
+
+            if (ec != std::errc{}) {
+                handle_error(on_error, "malformed array index in path segment: '{}' ({})", str, std::make_error_code(ec).message());
+                return false;
+            }
+            if (ptr != str.data() + str.size()) {
+                handle_error(on_error, "malformed array index in path segment: '{}'", str);
+                return false;
+            }
+
+            fmt::format_to(std::back_inserter(canonical), "{}", seg.index);
+
+            return compile_segments<typename T::value_type>(child_path, segments, canonical, on_error);
+        } else if constexpr (traits::map<T>) {
+            using key_type = typename T::key_type;
+
+            if (str.empty()) {
+                handle_error(on_error, "empty map key not supported");
+                return false;
+            }
+
+            if constexpr (traits::path_string_key<key_type>) {
+                seg.key = make_key<key_type>(str);
+                canonical += str;
+            } else {
+                key_type key_value{};
+
+                if (!parse_key(str, key_value)) {
+                    handle_error(on_error, "malformed map key in path segment: '{}'", str);
+                    return false;
+                }
+
+                if constexpr (fmt::is_formattable<key_type>::value) {
+                    fmt::format_to(std::back_inserter(canonical), "{}", key_value);
+                } else if constexpr (std::is_enum_v<key_type>) {
+                    fmt::format_to(std::back_inserter(canonical), "{}", static_cast<std::underlying_type_t<key_type>>(key_value));
+                } else {
+                    canonical += str;
+                }
+
+                seg.key = std::move(key_value);
+            }
+
+            return compile_segments<typename T::mapped_type>(child_path, segments, canonical, on_error);
+        } else if constexpr (traits::visitable<T>) {
+            auto index = find_member<T>(str);
+
+            if (!index.has_value()) {
+                handle_error(on_error, "unknown member in path segment: '{}'", str);
+                return false;
+            }
+
+            seg.index = index.value();
+            canonical += str;
+
+            return dispatch_member<T>(seg.index, [&]<size_t I>(std::integral_constant<size_t, I>) {
+                using member_type = visit_struct::type_at<static_cast<int>(I), T>;
+                return compile_segments<std::remove_cv_t<member_type>>(child_path, segments, canonical, on_error);
+            });
+        } else {
+            handle_error(on_error, "unreachable path segment: '{}' ({} is not a container)", path, typestr<T>());
+            return false;
+        }
+    }
+
+    template <typename T, typename Func>
+    bool visit_segments(T &node, size_t pos, const Func &func, bool insert_keys) const
+    {
+        using type = std::remove_const_t<T>;
+
+        if constexpr (traits::lazy<type>) {
+            return visit_segments(node.get(), pos, func, insert_keys);
+        } else if (pos == segments_.size()) {
+            func(node);
+            return true;
+        }
+
+        const segment &seg = segments_[pos];
+
+        if constexpr (traits::array<type>) {
+            /* Index is out of bounds */
+            if (seg.index >= node.size()) {
+                return false;
+            }
+
+            return visit_segments(*std::next(node.begin(), seg.index), pos + 1, func, insert_keys);
+        } else if constexpr (traits::map<type>) {
+            const auto &key = std::any_cast<const typename type::key_type &>(seg.key);
+            auto it = node.end();
+
+            if constexpr (!std::is_const_v<T>) {
+                if (insert_keys) {
+                    it = node.try_emplace(key).first;
+                } else {
+                    it = node.find(key);
+                }
+            } else {
+                it = node.find(key);
+            }
+
+            /* Map key is not present and was not inserted */
+            if (it == node.end()) {
+                return false;
+            }
+
+            return visit_segments(it->second, pos + 1, func, insert_keys);
+        } else if constexpr (traits::visitable<type>) {
+            return dispatch_member<type>(seg.index, [&]<size_t I>(std::integral_constant<size_t, I>) {
+                return visit_segments(visit_struct::get<static_cast<int>(I)>(node), pos + 1, func, insert_keys);
+            });
+        } else {
+            /* Leaf paths are rejected when compiled */
+            return false;
+        }
+    }
+
+    template <typename T, typename Func>
+    bool visit_copy_segments(const T &node, size_t pos, const Func &func) const
+    {
+        if constexpr (traits::lazy<T>) {
+            return visit_copy_segments(node.get(), pos, func);
+        } else if (pos == segments_.size()) {
+            /* Copy with the node's allocator (std::pmr copies would use the default resource) */
+            T copy = [&]() {
+                if constexpr (requires { node.get_allocator(); }) {
+                    return std::make_obj_using_allocator<T>(node.get_allocator(), node);
+                } else {
+                    return node;
+                }
+            }();
+
+            func(copy);
+            return true;
+        }
+
+        const segment &seg = segments_[pos];
+
+        if constexpr (traits::array<T>) {
+            /* Index is out of bounds */
+            if (seg.index >= node.size()) {
+                return false;
+            }
+
+            return visit_copy_segments(*std::next(node.begin(), seg.index), pos + 1, func);
+        } else if constexpr (traits::map<T>) {
+            const auto &key = std::any_cast<const typename T::key_type &>(seg.key);
+
+            if (auto it = node.find(key); it != node.end()) {
+                return visit_copy_segments(it->second, pos + 1, func);
+            }
+
+            /* Continue with the value that visit() would insert, using the map's allocator */
+            const auto inserted = make_element<typename T::mapped_type>(node);
+
+            return visit_copy_segments(inserted, pos + 1, func);
+        } else if constexpr (traits::visitable<T>) {
+            return dispatch_member<T>(seg.index, [&]<size_t I>(std::integral_constant<size_t, I>) {
+                return visit_copy_segments(visit_struct::get<static_cast<int>(I)>(node), pos + 1, func);
+            });
+        } else {
+            /* Leaf paths are rejected when compiled */
+            return false;
+        }
+    }
+
+    std::string path_;
+    std::vector<segment> segments_;
+};
+
+} /* namespace jstore */
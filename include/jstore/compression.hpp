@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fmt/core.h>
+
+#ifndef JSTORE_ZSTD
+#define JSTORE_ZSTD 0
+#endif
+
+#ifndef JSTORE_LZ4
+#define JSTORE_LZ4 0
+#endif
+
+#if JSTORE_ZSTD
+#include <zstd.h>
+#endif
+
+#if JSTORE_LZ4
+#include <lz4.h>
+#endif
+
+namespace jstore {
+
+/*
+ * Compression codecs for persisted files.
+ * Codec support must be enabled at build time (JSTORE_ENABLE_ZSTD and
+ * JSTORE_ENABLE_LZ4 CMake options).
+ */
+enum class compression : uint8_t {
+    NONE    = 0,
+    ZSTD    = 1,
+    LZ4     = 2
+};
+
+/*
+ * Compressed files begin with a fixed-size header:
+ *
+ *   magic[4]       "\xffJSZ" (not valid at the start of any supported encoding)
+ *   codec[1]       jstore::compression value
+ *   reserved[3]    zero
+ *   size[8]        uncompressed size (little-endian)
+ *
+ * Files without the header are read as-is.
+ */
+inline constexpr std::string_view COMPRESSION_MAGIC{"\xffJSZ", 4};
+inline constexpr size_t COMPRESSION_HEADER_SIZE = 16;
+
+/*
+ * Return true if `data` begins with a compression header.
+ */
+inline bool is_compressed(std::string_view data)
+{
+    return data.size() >= COMPRESSION_HEADER_SIZE && data.starts_with(COMPRESSION_MAGIC);
+}
+
+/*
+ * Return true if the codec was enabled at build time.
+ */
+inline bool compression_supported(compression codec)
+{
+    switch (codec) {
+    case compression::NONE:
+        return true;
+    case compression::ZSTD:
+        return JSTORE_ZSTD;
+    case compression::LZ4:
+        return JSTORE_LZ4;
+    }
+
+    return false;
+}
+
+/*
+ * Compress `data` and prepend a compression header. If `codec` is NONE,
+ * `data` is returned unchanged, without a header.
+ * A `level` of 0 selects the codec's default compression level.
+ */
+inline std::string compress(std::string &&data, compression codec, [[maybe_unused]] int level = 0)
+{
+    if (codec == compression::NONE) {
+        return std::move(data);
+    }
+
+    if (!compression_supported(codec)) {
+        throw std::invalid_argument(fmt::format("compression codec {} not supported", static_cast<int>(codec)));
+    }
+
+    std::string out(COMPRESSION_HEADER_SIZE, '\0');
+    uint64_t size = data.size();
+
+    std::memcpy(out.data(), COMPRESSION_MAGIC.data(), COMPRESSION_MAGIC.size());
+    out[4] = static_cast<char>(codec);
+    for (size_t i = 0; i < sizeof(size); ++i) {
+        out[8 + i] = static_cast<char>(size >> (8 * i));
+    }
+
+    switch (codec) {
+#if JSTORE_ZSTD
+    case compression::ZSTD: {
+        out.resize(COMPRESSION_HEADER_SIZE + ZSTD_compressBound(data.size()));
+
+        size_t len = ZSTD_compress(out.data() + COMPRESSION_HEADER_SIZE, out.size() - COMPRESSION_HEADER_SIZE,
+                data.data(), data.size(), level);
+        if (ZSTD_isError(len)) {
+            throw std::runtime_error(fmt::format("zstd compression failed: {}", ZSTD_getErrorName(len)));
+        }
+
+        out.resize(COMPRESSION_HEADER_SIZE + len);
+        break;
+    }
+#endif
+#if JSTORE_LZ4
+    case compression::LZ4: {
+        if (data.size() > LZ4_MAX_INPUT_SIZE) {
+            throw std::length_error("lz4 compression failed: input too large");
+        }
+
+        out.resize(COMPRESSION_HEADER_SIZE + LZ4_compressBound(static_cast<int>(data.size())));
+
+        /* Level is used as the acceleration factor (higher is faster, with less compression) */
+        int len = LZ4_compress_fast(data.data(), out.data() + COMPRESSION_HEADER_SIZE,
+                static_cast<int>(data.size()), static_cast<int>(out.size() - COMPRESSION_HEADER_SIZE),
+                level > 0 ? level : 1);
+        if (len <= 0) {
+            throw std::runtime_error("lz4 compression failed");
+        }
+
+        out.resize(COMPRESSION_HEADER_SIZE + len);
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+
+    return out;
+}
+
+/*
+ * Decompress data with a compression header.
+ */
+inline std::string decompress(std::string_view data)
+{
+    if (!is_compressed(data)) {
+        throw std::invalid_argument("missing compression header");
+    }
+
+    auto codec = static_cast<compression>(data[4]);
+    uint64_t size = 0;
+
+    for (size_t i = 0; i < sizeof(size); ++i) {
+        size |= static_cast<uint64_t>(static_cast<uint8_t>(data[8 + i])) << (8 * i);
+    }
+
+    [[maybe_unused]] std::string_view payload = data.substr(COMPRESSION_HEADER_SIZE);
+    std::string out;
+
+    if (codec == compression::NONE || !compression_supported(codec)) {
+        throw std::runtime_error(fmt::format("compression codec {} not supported", static_cast<int>(codec)));
+    }
+
+    switch (codec) {
+#if JSTORE_ZSTD
+    case compression::ZSTD: {
+        /* Validate header against the frame before allocating */
+        if (ZSTD_getFrameContentSize(payload.data(), payload.size()) != size) {
+            throw std::runtime_error("zstd decompression failed: corrupt header");
+        }
+
+        out.resize(size);
+
+        size_t len = ZSTD_decompress(out.data(), out.size(), payload.data(), payload.size());
+        if (ZSTD_isError(len)) {
+            throw std::runtime_error(fmt::format("zstd decompression failed: {}", ZSTD_getErrorName(len)));
+        }
+        if (len != size) {
+            throw std::runtime_error("zstd decompression failed: size mismatch");
+        }
+        break;
+    }
+#endif
+#if JSTORE_LZ4
+    case compression::LZ4: {
+        /* LZ4 cannot exceed a compression ratio of 255 */
+        if (size > LZ4_MAX_INPUT_SIZE || size > payload.size() * 255) {
+            throw std::runtime_error("lz4 decompression failed: corrupt header");
+        }
+
+        out.resize(size);
+
+        int len = LZ4_decompress_safe(payload.data(), out.data(),
+                static_cast<int>(payload.size()), static_cast<int>(out.size()));
+        if (len < 0 || static_cast<uint64_t>(len) != size) {
+            throw std::runtime_error("lz4 decompression failed");
+        }
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+
+    return out;
+}
+
+} /* namespace jstore */
@@ -7,7 +7,17 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <fmt/core.h>
@@ -15,12 +25,17 @@
 #include <sdbus-c++/sdbus-c++.h>
 #include <visit_struct/visit_struct.hpp>
 
+#include <jstore/compiled_path.hpp>
 #include <jstore/for_each.hpp>
+#include <jstore/lazy.hpp>
+#include <jstore/observer.hpp>
 #include <jstore/path_to.hpp>
 #include <jstore/serialization.hpp>
 #include <jstore/traits.hpp>
 #include <jstore/utilities.hpp>
 #include <jstore/visit_path.hpp>
+#include <jstore/worker.hpp>
+#include <jstore/writer.hpp>
 
 namespace jstore {
 
@@ -37,32 +52,46 @@ public:
     using root_type = Root;
     using filter_func = std::function<bool(const std::string &, access_type)>;
     using set_func = std::function<void(const std::string &)>;
+    using set_many_func = std::function<void(const std::vector<std::string> &)>;
 
     /*
      * Add the io.davidleeds.JStore D-Bus interface to the supplied object.
      * This interface reflects the org.freedesktop.DBus.Properties interface,
      * but supports flexible path strings to access dynamically changing tree content.
+     *
+     * If `mutex` is supplied, a shared lock is held while reading the tree,
+     * and an exclusive lock while modifying it. Locks are released before
+     * on_set() and on_set_many() callbacks are invoked.
+     *
+     * If `on_change` is supplied, it is invoked with the path of each value
+     * set by Set or SetMany, while the exclusive lock is still held (e.g. to
+     * record changes before an on_set() callback saves the tree).
      */
-    dbus(root_type &root, sdbus::IObject &object, filter_func filter = {}) :
+    dbus(root_type &root, sdbus::IObject &object, filter_func filter = {}, std::shared_mutex *mutex = nullptr,
+            set_func on_change = {}) :
         root_(root),
         object_(object),
-        filter_(std::move(filter))
+        filter_(std::move(filter)),
+        mutex_(mutex),
+        on_change_(std::move(on_change))
     {
         std::vector<sdbus::VTableItem> vtable;
 
         vtable.emplace_back(
                 sdbus::registerMethod("Get")
                 .implementedAs([this](const std::string &path) {
+                    phase_timer timer(observer_, io_phase::DBUS_CALL, "Get");
                     std::string val;
+                    auto lock = read_lock();
 
-                    bool found = jstore::visit_path(root_, path, [this, &path, &val](const auto &member) {
+                    auto compiled = compile(path);
+
+                    bool found = compiled && compiled->visit(root_, [this, &path, &val, &compiled](const auto &member) {
                         if (filter_ && !filter_(path, access_type::READ)) {
                             throw sdbus::createError(EACCES, "no read access");
                         }
 
-                        json j;
-                        serialize(j, member, false);
-                        val = j.dump();
+                        val = serialized_value(compiled->str(), member);
                     });
 
                     if (!found) {
@@ -78,7 +107,9 @@ public:
         vtable.emplace_back(
                 sdbus::registerMethod("GetAll")
                 .implementedAs([this]() {
-                    values_builder builder{filter_};
+                    phase_timer timer(observer_, io_phase::DBUS_CALL, "GetAll");
+                    values_builder builder{*this};
+                    auto lock = read_lock();
 
                     builder.add("", root_);
 
@@ -87,43 +118,163 @@ public:
                 .withOutputParamNames("Values")
         );
 
+        vtable.emplace_back(
+                sdbus::registerMethod("GetSubtree")
+                .implementedAs([this](const std::string &path, uint32_t offset, uint32_t limit) {
+                    phase_timer timer(observer_, io_phase::DBUS_CALL, "GetSubtree");
+                    values_builder builder{*this, offset, limit};
+                    auto lock = read_lock();
+
+                    auto compiled = compile(path);
+
+                    /* Values are returned at canonical paths, as by GetAll */
+                    bool found = compiled && compiled->visit(root_, [&builder, &compiled](const auto &member) {
+                        builder.add(compiled->str(), member);
+                    });
+
+                    if (!found) {
+                        throw sdbus::createError(ENOENT, "unknown item");
+                    }
+
+                    /* Offset of the next page, or 0 if there are no more values */
+                    uint32_t next_offset = builder.more ? offset + static_cast<uint32_t>(builder.values.size()) : 0;
+
+                    return std::make_tuple(std::move(builder.values), next_offset);
+                })
+                .withInputParamNames("Path", "Offset", "Limit")
+                .withOutputParamNames("Values", "NextOffset")
+        );
+
         vtable.emplace_back(
                 sdbus::registerMethod("Set")
                 .implementedAs([this](const std::string &path, const std::string &val) {
-                    bool found = jstore::visit_path(root_, path, [this, &path, &val](auto &member) {
+                    phase_timer timer(observer_, io_phase::DBUS_CALL, "Set");
+                    auto lock = write_lock();
+
+                    auto compiled = compile(path);
+
+                    bool found = compiled && compiled->visit(root_, [this, &path, &val](auto &member) {
                         if (filter_ && !filter_(path, access_type::WRITE)) {
                             throw sdbus::createError(EACCES, "no write access");
                         }
 
-                        json j;
+                        deserialize_value(val, member);
+                    }, true /* insert_keys */);
+
+                    if (!found) {
+                        throw sdbus::createError(ENOENT, "unknown item");
+                    }
+
+                    invalidate(compiled->str());
+
+                    if (on_change_) {
+                        on_change_(compiled->str());
+                    }
+
+                    if (lock) {
+                        lock.unlock();
+                    }
+
+                    /* Notify application about remote set */
+                    if (on_set_) {
+                        on_set_(path);
+                    }
+                })
+                .withInputParamNames("Path", "Value")
+        );
+
+        vtable.emplace_back(
+                sdbus::registerMethod("GetMany")
+                .implementedAs([this](const std::vector<std::string> &paths) {
+                    phase_timer timer(observer_, io_phase::DBUS_CALL, "GetMany");
+                    std::map<std::string, std::string> values;
+                    auto lock = read_lock();
+
+                    for (auto &path : paths) {
+                        auto compiled = compile(path);
+
+                        /* Non-existent and unreadable values are omitted */
+                        if (compiled && (!filter_ || filter_(path, access_type::READ))) {
+                            compiled->visit(root_, [this, &values, &path, &compiled](const auto &member) {
+                                values.emplace(path, serialized_value(compiled->str(), member));
+                            });
+                        }
+                    }
+
+                    return values;
+                })
+                .withInputParamNames("Paths")
+                .withOutputParamNames("Values")
+        );
 
-                        try {
-                            j = json::parse(val);
-                        } catch (const std::exception &e) {
-                            throw sdbus::createError(EINVAL,
-                                    fmt::format("JSON parse error: {}", e.what()));
+        vtable.emplace_back(
+                sdbus::registerMethod("SetMany")
+                .implementedAs([this](const std::map<std::string, std::string> &values) {
+                    phase_timer timer(observer_, io_phase::DBUS_CALL, "SetMany");
+                    std::vector<std::function<void()>> updates;
+                    std::vector<std::string> paths;
+                    std::vector<std::string> canonical_paths;
+
+                    updates.reserve(values.size());
+                    paths.reserve(values.size());
+                    canonical_paths.reserve(values.size());
+
+                    auto lock = write_lock();
+
+                    /* Deserialize all values into copies, so the tree is unchanged on error */
+                    for (auto &[path, val] : values) {
+                        auto compiled = compile(path);
+
+                        bool found = compiled && compiled->visit_copy(root_, [&](auto &member) {
+                            if (filter_ && !filter_(path, access_type::WRITE)) {
+                                throw sdbus::createError(EACCES, "no write access");
+                            }
+
+                            deserialize_value(val, member);
+
+                            updates.emplace_back([this, target = compiled, value = std::move(member)]() mutable {
+                                target->visit(root_, [&value](auto &node) {
+                                    if constexpr (std::is_same_v<std::decay_t<decltype(node)>, std::decay_t<decltype(value)>>) {
+                                        node = std::move(value);
+                                    }
+                                }, true /* insert_keys */);
+                            });
+                        });
+
+                        if (!found) {
+                            throw sdbus::createError(ENOENT, fmt::format("unknown item: {}", path));
                         }
 
-                        std::string error_msg;
-                        auto on_error = [&error_msg](std::string &&msg) {
-                            error_msg = std::move(msg);
-                        };
+                        paths.push_back(path);
+                        canonical_paths.push_back(compiled->str());
+                    }
+
+                    for (auto &update : updates) {
+                        update();
+                    }
+
+                    for (auto &path : canonical_paths) {
+                        invalidate(path);
 
-                        if (!deserialize(j, member, on_error)) {
-                            throw sdbus::createError(EINVAL, error_msg);
+                        if (on_change_) {
+                            on_change_(path);
                         }
+                    }
+
+                    if (lock) {
+                        lock.unlock();
+                    }
 
-                        /* Notify application about remote set */
-                        if (on_set_) {
+                    /* Notify application about remote set */
+                    if (on_set_many_) {
+                        on_set_many_(paths);
+                    } else if (on_set_) {
+                        for (auto &path : paths) {
                             on_set_(path);
                         }
-                    }, true /* insert_keys */);
-
-                    if (!found) {
-                        throw sdbus::createError(ENOENT, "unknown item");
                     }
                 })
-                .withInputParamNames("Path", "Value")
+                .withInputParamNames("Values")
         );
 
         vtable.emplace_back(
@@ -144,7 +295,7 @@ public:
     {
         static_assert(sizeof...(nodes) > 0);
 
-        values_builder builder{filter_};
+        values_builder builder{*this};
 
         /* Lambda to find the specified tree node and populate it in the values map */
         auto add_node = [this, &builder](const auto &node) {
@@ -155,33 +306,389 @@ public:
                         typestr<std::decay_t<decltype(node)>>()));
             }
 
+            invalidate(path.value());
             builder.add(path.value(), node);
         };
 
         /* Add entries for each node in the parameter pack */
-        ((add_node(nodes)), ...);
+        {
+            auto lock = read_lock();
+
+            ((add_node(nodes)), ...);
+        }
+
+        emit_values(builder.values);
+    }
+
+    /*
+     * Emit a ValuesChanged signal with entries for the node at each path, as
+     * emit_values_changed() does for nodes. A path that no longer exists
+     * (e.g. a removed map entry) is replaced by its nearest existing
+     * ancestor.
+     */
+    void emit_paths_changed(const std::vector<std::string> &paths)
+    {
+        values_builder builder{*this};
+
+        {
+            auto lock = read_lock();
+
+            for (auto &changed : paths) {
+                std::string_view path = changed;
+
+                auto add_node = [&builder, &path](const auto &node) {
+                    builder.add(std::string{path}, node);
+                };
+
+                invalidate(changed);
+
+                while (!jstore::visit_path(root_, path, add_node)) {
+                    auto pos = path.rfind('/');
+                    path = path.substr(0, pos == std::string_view::npos ? 0 : pos);
+                }
+            }
+        }
+
+        emit_values(builder.values);
+    }
+
+    /*
+     * Coalesce ValuesChanged signals. If `interval` is non-zero,
+     * emit_values_changed() adds values to a pending set, and a single
+     * ValuesChanged signal with all pending values is emitted by a background
+     * thread once `interval` has elapsed since the first pending change. If
+     * zero (the default), each emit_values_changed() call emits a signal from
+     * the calling thread.
+     *
+     * The coalesced signals are sent from the background thread, not from
+     * the event loop of the object's connection. Coalescing MUST only be
+     * enabled if the application allows the connection to send messages from
+     * other threads while its event loop runs.
+     */
+    void set_values_changed_interval(std::chrono::milliseconds interval)
+    {
+        signal_worker_.reset();
+
+        if (interval.count() > 0) {
+            signal_worker_ = std::make_unique<coalescing_worker>(interval);
+        }
+    }
+
+    /*
+     * Cache the serialized values returned by Get, GetAll, GetMany, and
+     * GetSubtree, so values are only re-serialized after they change. Cached
+     * values are invalidated by Set, SetMany, emit_values_changed(), and
+     * invalidate(). If enabled, the application MUST report each change to
+     * the tree using one of these (jstore::tree invalidates cached values on
+     * load(), mark_dirty(), mark_dirty_path(), and modify()).
+     */
+    void set_value_cache(bool enable)
+    {
+        std::lock_guard lock(cache_mutex_);
+
+        value_cache_enabled_ = enable;
+        value_cache_.clear();
+    }
+
+    /*
+     * Invalidate cached serialized values affected by a change to the node
+     * at `path` (the node itself, and its ancestors and descendants).
+     */
+    void invalidate(const std::string &path)
+    {
+        std::lock_guard lock(cache_mutex_);
+
+        erase_related(value_cache_, path);
+    }
+
+    /*
+     * Invalidate all cached serialized values.
+     */
+    void invalidate_all()
+    {
+        std::lock_guard lock(cache_mutex_);
 
-        if (!builder.values.empty()) {
-            object_.emitSignal("ValuesChanged")
-                    .onInterface(DBUS_INTERFACE)
-                    .withArguments(builder.values);
+        value_cache_.clear();
+    }
+
+    /*
+     * Only emit values that differ from the last value emitted at the same
+     * path. If enabled, the last emitted values are kept, so applications
+     * may call emit_values_changed() with large parent nodes and only the
+     * changed values are sent.
+     */
+    void set_values_changed_delta(bool enable)
+    {
+        std::lock_guard lock(signal_mutex_);
+
+        delta_ = enable;
+        last_values_.clear();
+    }
+
+    /*
+     * Emit a ValuesChanged signal with any pending values now, and wait for
+     * it to be sent.
+     */
+    void flush_values_changed()
+    {
+        if (signal_worker_) {
+            signal_worker_->flush();
         }
     }
 
+    /*
+     * Register an observer invoked with the duration of each method call and
+     * ValuesChanged signal, and of each value serialization.
+     */
+    void set_observer(observer_func observer)
+    {
+        observer_ = std::move(observer);
+    }
+
     void on_set(set_func callback)
     {
         on_set_ = std::move(callback);
     }
 
+    /*
+     * Register a callback invoked once with the paths of all values set by a
+     * SetMany call. If not registered, the on_set() callback is invoked for
+     * each path instead.
+     */
+    void on_set_many(set_many_func callback)
+    {
+        on_set_many_ = std::move(callback);
+    }
+
 private:
+    /*
+     * Emit a ValuesChanged signal with the supplied values, or add them to
+     * the pending values if signals are coalesced.
+     */
+    void emit_values(std::map<std::string, std::string> &values)
+    {
+        if (values.empty()) {
+            return;
+        }
+
+        if (!signal_worker_) {
+            emit_signal(values);
+            return;
+        }
+
+        {
+            std::lock_guard lock(signal_mutex_);
+
+            /* Later values replace pending values at the same path */
+            for (auto &[path, value] : values) {
+                pending_values_.insert_or_assign(path, std::move(value));
+            }
+        }
+
+        signal_worker_->submit([this]() { emit_pending(); });
+    }
+
+    /* Maximum number of cached compiled paths */
+    static constexpr size_t PATH_CACHE_SIZE = 1024;
+
+    std::shared_lock<std::shared_mutex> read_lock()
+    {
+        return mutex_ ? std::shared_lock(*mutex_) : std::shared_lock<std::shared_mutex>{};
+    }
+
+    std::unique_lock<std::shared_mutex> write_lock()
+    {
+        return mutex_ ? std::unique_lock(*mutex_) : std::unique_lock<std::shared_mutex>{};
+    }
+
+    /*
+     * Return the compiled form of a path accessed by D-Bus clients, or
+     * nullptr if the path cannot exist in the tree. Clients typically access
+     * the same paths repeatedly, so compiled paths are cached. Methods that
+     * only read the tree run concurrently, so the cache has its own lock, and
+     * returned paths remain valid when the cache is cleared.
+     */
+    std::shared_ptr<const compiled_path<root_type>> compile(const std::string &path)
+    {
+        {
+            std::lock_guard lock(paths_mutex_);
+
+            if (auto it = paths_.find(path); it != paths_.end()) {
+                return it->second;
+            }
+        }
+
+        auto compiled = compiled_path<root_type>::compile(path);
+
+        if (!compiled.has_value()) {
+            return nullptr;
+        }
+
+        auto shared = std::make_shared<const compiled_path<root_type>>(std::move(compiled.value()));
+        std::lock_guard lock(paths_mutex_);
+
+        if (paths_.size() >= PATH_CACHE_SIZE) {
+            paths_.clear();
+        }
+
+        paths_.emplace(path, shared);
+        return shared;
+    }
+
+    void emit_signal(std::map<std::string, std::string> &values)
+    {
+        if (!remove_unchanged(values)) {
+            return;
+        }
+
+        phase_timer timer(observer_, io_phase::DBUS_CALL, "ValuesChanged");
+
+        object_.emitSignal("ValuesChanged")
+                .onInterface(DBUS_INTERFACE)
+                .withArguments(values);
+    }
+
+    /*
+     * Erase the entries at `path`, and at its ancestor and descendant paths.
+     */
+    static void erase_related(std::map<std::string, std::string> &values, const std::string &path)
+    {
+        if (path.empty()) {
+            values.clear();
+            return;
+        }
+
+        values.erase(values.lower_bound(path + '/'), values.lower_bound(path + char('/' + 1)));
+        values.erase(path);
+
+        for (size_t pos = path.find('/'); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+            values.erase(path.substr(0, pos));
+        }
+        values.erase("");
+    }
+
+    /*
+     * Return the JSON text serialization of a node, using the value cache if enabled.
+     */
+    template <typename T>
+    std::string serialized_value(const std::string &path, const T &member)
+    {
+        std::unique_lock lock(cache_mutex_);
+
+        if (!value_cache_enabled_) {
+            lock.unlock();
+            return dump_value(member);
+        }
+
+        if (auto it = value_cache_.find(path); it != value_cache_.end()) {
+            return it->second;
+        }
+
+        return value_cache_.emplace(path, dump_value(member)).first->second;
+    }
+
+    template <typename T>
+    std::string dump_value(const T &member)
+    {
+        phase_timer timer(observer_, io_phase::DBUS_SERIALIZE);
+        std::string val = dump_json(member);
+
+        timer.stop(val.size());
+        return val;
+    }
+
+    /*
+     * In delta mode, remove values equal to the last emitted value at the
+     * same path, and record the remaining values as emitted. Returns false if
+     * no values remain.
+     */
+    bool remove_unchanged(std::map<std::string, std::string> &values)
+    {
+        std::lock_guard lock(signal_mutex_);
+
+        if (!delta_) {
+            return true;
+        }
+
+        std::erase_if(values, [this](const auto &entry) {
+            auto it = last_values_.find(entry.first);
+            return it != last_values_.end() && it->second == entry.second;
+        });
+
+        /*
+         * Values emitted at ancestor and descendant paths are superseded
+         * (e.g. emitting an empty map invalidates cached map entries).
+         */
+        for (auto &[path, value] : values) {
+            erase_related(last_values_, path);
+        }
+
+        for (auto &[path, value] : values) {
+            last_values_.insert_or_assign(path, value);
+        }
+
+        return !values.empty();
+    }
+
+    void emit_pending()
+    {
+        std::map<std::string, std::string> values;
+
+        {
+            std::lock_guard lock(signal_mutex_);
+            values.swap(pending_values_);
+        }
+
+        if (!values.empty()) {
+            emit_signal(values);
+        }
+    }
+
+    /*
+     * Parse a JSON encoded value and deserialize it into `member`, including
+     * the content of lazy nodes. Throws an sdbus::Error on failure.
+     */
+    template <typename T>
+    static void deserialize_value(const std::string &val, T &member)
+    {
+        json j;
+
+        try {
+            j = json::parse(val);
+        } catch (const std::exception &e) {
+            throw sdbus::createError(EINVAL,
+                    fmt::format("JSON parse error: {}", e.what()));
+        }
+
+        std::string error_msg;
+        auto on_error = [&error_msg](std::string &&msg) {
+            error_msg = std::move(msg);
+        };
+
+        /* Lazy nodes are deserialized now, so invalid content fails the call */
+        lazy_scope scope(lazy_scope::eager);
+
+        if (!deserialize(j, member, on_error)) {
+            throw sdbus::createError(EINVAL, error_msg);
+        }
+    }
+
     /*
      * Builder object that selects which tree elements to export to keep
      * observers' caches consistent.
      */
     struct values_builder {
-        filter_func &filter_;
+        dbus &owner;
+
+        /* Number of leading values to skip, and maximum number of values to add (0 for no limit) */
+        size_t offset = 0;
+        size_t limit = 0;
+
         std::map<std::string, std::string> values;
 
+        /* Set if values were omitted due to the limit */
+        bool more = false;
+
         template <traits::array T>
         void add(const std::string &path, const T &container)
         {
@@ -205,6 +712,10 @@ private:
             } else {
                 /* Recurse into map values, as these can be individually applied */
                 for (auto &[key, value] : container) {
+                    if (more) {
+                        break;
+                    }
+
                     add(fmt::format("{}{}{}", path, path.empty() ? "" : "/", key), value);
                 }
             }
@@ -215,10 +726,18 @@ private:
         {
             /* Visitable structs have fixed content, so always push individual members */
             visit_struct::for_each(container, [this, &path](const char *key, auto &member) {
-                add(fmt::format("{}{}{}", path, path.empty() ? "" : "/", key), member);
+                if (!more) {
+                    add(fmt::format("{}{}{}", path, path.empty() ? "" : "/", key), member);
+                }
             });
         }
 
+        template <traits::lazy T>
+        void add(const std::string &path, const T &value)
+        {
+            add(path, value.get());
+        }
+
         template <traits::leaf T>
         void add(const std::string &path, const T &value)
         {
@@ -229,13 +748,21 @@ private:
         template <typename T>
         void add_internal(const std::string &path, const T &member)
         {
-            if (filter_ && !filter_(path, access_type::READ)) {
+            if (owner.filter_ && !owner.filter_(path, access_type::READ)) {
+                return;
+            }
+
+            if (offset > 0) {
+                --offset;
+                return;
+            }
+
+            if (limit > 0 && values.size() == limit) {
+                more = true;
                 return;
             }
 
-            json j;
-            serialize(j, member);
-            values.emplace(path, j.dump());
+            values.emplace(path, owner.serialized_value(path, member));
         }
     }; /* values_builder */
 
@@ -243,7 +770,21 @@ private:
     sdbus::IObject &object_;
     sdbus::Slot vtable_slot_;
     filter_func filter_;
+    std::shared_mutex *mutex_;
+    set_func on_change_;
     set_func on_set_;
+    set_many_func on_set_many_;
+    observer_func observer_;
+    std::mutex paths_mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const compiled_path<root_type>>> paths_;
+    std::mutex cache_mutex_;
+    std::map<std::string, std::string> value_cache_;
+    bool value_cache_enabled_ = false;
+    std::mutex signal_mutex_;
+    std::map<std::string, std::string> pending_values_;
+    std::map<std::string, std::string> last_values_;
+    bool delta_ = false;
+    std::unique_ptr<coalescing_worker> signal_worker_;
 };
 
 } /* namespace jstore */
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <visit_struct/visit_struct.hpp>
+
+#include <jstore/members.hpp>
+#include <jstore/traits.hpp>
+
+namespace jstore {
+
+/*
+ * Default values of visitable structs.
+ *
+ * Each struct type has a single, immutable default instance, shared by all
+ * threads. It is constructed on first use, so to avoid bugs, structs'
+ * initial values must not change.
+ */
+
+template <traits::visitable T, size_t I>
+using member_type_at = std::remove_cv_t<visit_struct::type_at<static_cast<int>(I), T>>;
+
+/*
+ * True if the default value of member I is a constant expression of a type
+ * that may be compared without a default instance (e.g. integers, enums).
+ * This requires T to be constructible in a constant expression.
+ */
+template <traits::visitable T, size_t I>
+inline constexpr bool has_constant_default = requires {
+    typename std::integral_constant<member_type_at<T, I>, visit_struct::get<static_cast<int>(I)>(T{})>;
+};
+
+/*
+ * True if member I is a container or string, which equals an empty default
+ * if and only if it is empty.
+ */
+template <traits::visitable T, size_t I>
+inline constexpr bool has_empty_check = traits::array<member_type_at<T, I>> || traits::map<member_type_at<T, I>> ||
+        traits::is_string_v<member_type_at<T, I>>;
+
+/*
+ * Return the shared default instance of T.
+ */
+template <traits::visitable T>
+const T &default_value()
+{
+    static const T defaults{};
+    return defaults;
+}
+
+/*
+ * Return the default value of member I of T.
+ */
+template <size_t I, traits::visitable T>
+const auto &default_member()
+{
+    return visit_struct::get<static_cast<int>(I)>(default_value<T>());
+}
+
+/*
+ * Return true for each member of T that is a container (or string) with an
+ * empty default value.
+ */
+template <traits::visitable T>
+const std::array<bool, member_count<T>> &empty_defaults()
+{
+    static const std::array<bool, member_count<T>> empty = []<size_t ...I>(std::index_sequence<I...>) {
+        auto is_empty = []<size_t J>(std::integral_constant<size_t, J>) {
+            if constexpr (has_empty_check<T, J>) {
+                return default_member<J, T>().empty();
+            } else {
+                return false;
+            }
+        };
+
+        return std::array<bool, member_count<T>>{ is_empty(std::integral_constant<size_t, I>{})... };
+    }(std::make_index_sequence<member_count<T>>{});
+
+    return empty;
+}
+
+/*
+ * Return true if member I of `container` has its default value. Constant
+ * defaults are compared without touching the default instance, and members
+ * with empty defaults are checked with empty() rather than deep comparison.
+ */
+template <size_t I, traits::visitable T>
+bool is_default_member(const T &container)
+{
+    const auto &value = visit_struct::get<static_cast<int>(I)>(container);
+
+    if constexpr (traits::lazy<member_type_at<T, I>>) {
+        /* Content that was not deserialized yet was saved, so it is not compared */
+        if (!value.loaded()) {
+            return false;
+        }
+    }
+
+    if constexpr (has_constant_default<T, I>) {
+        constexpr member_type_at<T, I> def = visit_struct::get<static_cast<int>(I)>(T{});
+
+        return value == def;
+    } else if constexpr (has_empty_check<T, I>) {
+        if (empty_defaults<T>()[I]) {
+            return value.empty();
+        }
+    }
+
+    return value == default_member<I, T>();
+}
+
+} /* namespace jstore */
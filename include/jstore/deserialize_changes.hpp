@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <visit_struct/visit_struct.hpp>
+
+#include <jstore/defaults.hpp>
+#include <jstore/members.hpp>
+#include <jstore/serialization.hpp>
+#include <jstore/traits.hpp>
+#include <jstore/utilities.hpp>
+
+namespace jstore {
+
+using json = nlohmann::json;
+
+/*
+ * Return the path of a child node.
+ */
+inline std::string child_path(const std::string &path, std::string_view key)
+{
+    std::string child;
+
+    child.reserve(path.size() + key.size() + 1);
+    child += path;
+    if (!path.empty()) {
+        child += '/';
+    }
+    child += key;
+
+    return child;
+}
+
+/*
+ * Replace `node` with a new value deserialized from `j`, starting from
+ * `initial`. As in a full deserialization, a value that fails to deserialize
+ * has its initial value.
+ */
+template <typename T>
+void deserialize_replacement(const json &j, T &node, const T &initial, const error_func &on_error)
+{
+    T value = initial;
+
+    deserialize(j, value, on_error);
+    node = std::move(value);
+}
+
+/*
+ * Update `node`, which was deserialized from `old` (see deserialize_changes()).
+ * A replaced node that fails to deserialize has the value `initial`, as in a
+ * newly deserialized tree.
+ */
+template <typename T>
+void deserialize_changed_node(const json &old, const json &j, T &node, const T &initial, const std::string &path,
+        std::vector<std::string> &changed, const error_func &on_error)
+{
+    if constexpr (traits::visitable<T>) {
+        if (!old.is_object() || !j.is_object()) {
+            deserialize_replacement(j, node, initial, on_error);
+            changed.push_back(path);
+            return;
+        }
+
+        auto update_member = [&]<size_t I>(std::integral_constant<size_t, I>) {
+            const std::string_view key = member_names<T>[I];
+            auto &value = visit_struct::get<static_cast<int>(I)>(node);
+            const auto &member_default = default_member<I, T>();
+            auto ot = old.find(key);
+            auto jt = j.find(key);
+
+            if (jt == j.end()) {
+                if (ot != old.end()) {
+                    /* Member was removed, so it has its default value */
+                    value = member_default;
+                    changed.push_back(child_path(path, key));
+                }
+            } else if (ot == old.end()) {
+                /* Member was added */
+                deserialize_replacement(*jt, value, member_default, on_error);
+                changed.push_back(child_path(path, key));
+            } else if (*ot != *jt) {
+                deserialize_changed_node(*ot, *jt, value, member_default, child_path(path, key), changed, on_error);
+            }
+        };
+
+        [&update_member]<size_t ...I>(std::index_sequence<I...>) {
+            (update_member(std::integral_constant<size_t, I>{}), ...);
+        }(std::make_index_sequence<member_count<T>>{});
+    } else if constexpr (traits::convertible_map<T>) {
+        using key_type = typename T::key_type;
+        using mapped_type = typename T::mapped_type;
+
+        if (!old.is_object() || !j.is_object()) {
+            deserialize_replacement(j, node, initial, on_error);
+            changed.push_back(path);
+            return;
+        }
+
+        /* Entries are compared by key, so only added, removed, and changed entries are deserialized */
+        for (auto ot = old.begin(); ot != old.end(); ++ot) {
+            if (!j.contains(ot.key())) {
+                node.erase(key_type(ot.key()));
+                changed.push_back(child_path(path, ot.key()));
+            }
+        }
+
+        for (auto jt = j.begin(); jt != j.end(); ++jt) {
+            auto ot = old.find(jt.key());
+
+            if (ot != old.end() && *ot == *jt) {
+                continue;
+            }
+
+            auto it = node.find(key_type(jt.key()));
+            const mapped_type element = make_element<mapped_type>(node);
+
+            if (ot == old.end() || it == node.end()) {
+                /* Entry was added */
+                mapped_type value = element;
+
+                deserialize(*jt, value, on_error);
+                node.insert_or_assign(key_type(jt.key()), std::move(value));
+                changed.push_back(child_path(path, jt.key()));
+            } else {
+                deserialize_changed_node(*ot, *jt, it->second, element, child_path(path, jt.key()), changed, on_error);
+            }
+        }
+    } else if constexpr (traits::lazy<T>) {
+        if (node.loaded()) {
+            deserialize_changed_node(old, j, node.get(), initial.get(), path, changed, on_error);
+        } else {
+            deserialize(j, node, on_error);
+            changed.push_back(path);
+        }
+    } else {
+        /*
+         * Array elements are not necessarily identified by index (e.g.
+         * std::set), and entries with non-string keys are not identified by
+         * path, so arrays, such maps, and leaf values are replaced.
+         */
+        deserialize_replacement(j, node, initial, on_error);
+        changed.push_back(path);
+    }
+}
+
+/*
+ * Incremental deserialization.
+ *
+ * Update `root`, which holds the content deserialized from `old`, to the
+ * content of `j`. Only the nodes whose serialized content differs are
+ * deserialized: struct members and map entries are compared by key, while
+ * arrays, maps with non-string keys, and leaf values are replaced as a
+ * whole. Nodes that changed have the same value as after a full
+ * deserialization from `j` into a new tree: a value that fails to
+ * deserialize has its default value.
+ *
+ * Returns the paths of the nodes that were replaced, added, or removed. The
+ * root itself is never replaced, so if `old` and `j` do not have the
+ * expected type, `j` is deserialized over the root (see deserialize()), and
+ * the empty path is returned.
+ */
+template <typename T>
+std::vector<std::string> deserialize_changes(const json &old, const json &j, T &root, const error_func &on_error = {})
+{
+    std::vector<std::string> changed;
+
+    if (old == j) {
+        return changed;
+    }
+
+    constexpr bool keyed = traits::visitable<T> || traits::convertible_map<T>;
+
+    if (!keyed || !old.is_object() || !j.is_object()) {
+        deserialize(j, root, on_error);
+        changed.emplace_back();
+        return changed;
+    }
+
+    if constexpr (traits::visitable<T>) {
+        deserialize_changed_node(old, j, root, default_value<T>(), std::string{}, changed, on_error);
+    } else if constexpr (keyed) {
+        deserialize_changed_node(old, j, root, T(root.get_allocator()), std::string{}, changed, on_error);
+    }
+
+    return changed;
+}
+
+} /* namespace jstore */
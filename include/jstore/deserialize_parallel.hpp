@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <visit_struct/visit_struct.hpp>
+
+#include <jstore/defaults.hpp>
+#include <jstore/lazy.hpp>
+#include <jstore/members.hpp>
+#include <jstore/serialization.hpp>
+#include <jstore/traits.hpp>
+#include <jstore/utilities.hpp>
+
+namespace jstore {
+
+using json = nlohmann::json;
+
+/* Minimum number of elements deserialized by each thread */
+inline constexpr size_t PARALLEL_MIN_CHUNK = 256;
+
+/*
+ * Parallel deserializer forward declarations.
+ *
+ * Equivalent to deserialize(), but the elements of large arrays and maps are
+ * deserialized by up to `threads` threads. Each thread deserializes a
+ * contiguous chunk of elements, and the chunks are merged into the container
+ * in order. Errors are buffered per chunk and reported from the calling
+ * thread in element order, so `on_error` receives the same messages, in the
+ * same order, as it would from deserialize(). With `in_place`, containers too
+ * small to split are updated in place (see deserialize()).
+ *
+ * As with deserialize(), elements are constructed with their container's
+ * allocator. Chunks allocate concurrently, so the memory resource of
+ * std::pmr containers must be thread-safe (e.g. synchronized_pool_resource).
+ */
+template <traits::array T>
+bool deserialize_parallel(const json &j, T &container, size_t threads, const error_func &on_error = {}, bool in_place = false);
+template <traits::convertible_map T>
+bool deserialize_parallel(const json &j, T &container, size_t threads, const error_func &on_error = {}, bool in_place = false);
+template <traits::not_convertible_map T>
+bool deserialize_parallel(const json &j, T &container, size_t threads, const error_func &on_error = {}, bool in_place = false);
+template <traits::visitable T>
+bool deserialize_parallel(const json &j, T &container, size_t threads, const error_func &on_error = {}, bool in_place = false);
+template <traits::lazy T>
+bool deserialize_parallel(const json &j, T &value, size_t threads, const error_func &on_error = {}, bool in_place = false);
+template <traits::leaf T>
+bool deserialize_parallel(const json &j, T &value, size_t threads, const error_func &on_error = {}, bool in_place = false);
+
+/*
+ * Invoke `func(index, on_error)` for each element index in [0, count),
+ * split into `chunks` contiguous chunks that are processed concurrently.
+ * Returns the elements produced by each chunk, in order. Errors reported by
+ * `func` are forwarded to `on_error` in index order.
+ */
+template <typename Element, typename Func>
+std::vector<std::vector<Element>> deserialize_chunks(size_t count, size_t chunks, const error_func &on_error, const Func &func)
+{
+    struct chunk_result {
+        std::vector<Element> elements;
+        std::vector<std::string> errors;
+    };
+
+    auto run_chunk = [count, chunks, &on_error, &func](size_t chunk) {
+        chunk_result result;
+        size_t begin = count * chunk / chunks;
+        size_t end = count * (chunk + 1) / chunks;
+
+        /* Messages are buffered, and only formatted if they will be reported */
+        error_func buffer_error;
+
+        /* The buffer does not outlive the chunk, so lazy nodes are deserialized now */
+        lazy_scope scope(lazy_scope::eager);
+
+        if (on_error) {
+            buffer_error = [&result](std::string &&msg) {
+                result.errors.push_back(std::move(msg));
+            };
+        }
+
+        result.elements.reserve(end - begin);
+
+        for (size_t i = begin; i < end; ++i) {
+            std::optional<Element> element = func(i, buffer_error);
+
+            if (element.has_value()) {
+                result.elements.push_back(std::move(element.value()));
+            }
+        }
+
+        return result;
+    };
+
+    std::vector<std::future<chunk_result>> futures;
+
+    for (size_t chunk = 1; chunk < chunks; ++chunk) {
+        futures.push_back(std::async(std::launch::async, run_chunk, chunk));
+    }
+
+    std::vector<std::vector<Element>> elements;
+    std::vector<chunk_result> results;
+
+    results.push_back(run_chunk(0));
+    for (auto &future : futures) {
+        results.push_back(future.get());
+    }
+
+    for (auto &result : results) {
+        for (auto &msg : result.errors) {
+            on_error(std::move(msg));
+        }
+
+        elements.push_back(std::move(result.elements));
+    }
+
+    return elements;
+}
+
+/*
+ * Return the number of chunks to split `count` elements into.
+ */
+inline size_t parallel_chunks(size_t count, size_t threads)
+{
+    return std::min(threads, count / PARALLEL_MIN_CHUNK);
+}
+
+/*
+ * Unpack an array-like type.
+ */
+template <traits::array T>
+bool deserialize_parallel(const json &j, T &container, size_t threads, const error_func &on_error, bool in_place)
+{
+    using value_type = typename T::value_type;
+
+    size_t chunks = j.is_array() ? parallel_chunks(j.size(), threads) : 0;
+
+    if (chunks <= 1) {
+        return deserialize(j, container, on_error, in_place);
+    }
+
+    auto results = deserialize_chunks<value_type>(j.size(), chunks, on_error, [&j, &container](size_t index, const error_func &err) {
+        std::optional<value_type> value{make_element<value_type>(container)};
+
+        deserialize(j[index], value.value(), err);
+        return value;
+    });
+
+    container.clear();
+
+    if constexpr (requires { container.reserve(j.size()); }) {
+        container.reserve(j.size());
+    }
+
+    for (auto &chunk : results) {
+        for (auto &value : chunk) {
+            container.insert(container.end(), std::move(value));
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Unpack a map-like type with string keys.
+ */
+template <traits::convertible_map T>
+bool deserialize_parallel(const json &j, T &container, size_t threads, const error_func &on_error, bool in_place)
+{
+    using mapped_type = typename T::mapped_type;
+
+    size_t chunks = j.is_object() ? parallel_chunks(j.size(), threads) : 0;
+
+    if (chunks <= 1) {
+        return deserialize(j, container, on_error, in_place);
+    }
+
+    /* Object members are not randomly accessible, so index them first */
+    std::vector<std::pair<const std::string *, const json *>> members;
+
+    members.reserve(j.size());
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        members.emplace_back(&it.key(), &it.value());
+    }
+
+    auto results = deserialize_chunks<mapped_type>(members.size(), chunks, on_error, [&members, &container](size_t index, const error_func &err) {
+        std::optional<mapped_type> value{make_element<mapped_type>(container)};
+
+        deserialize(*members[index].second, value.value(), err);
+        return value;
+    });
+
+    container.clear();
+
+    if constexpr (requires { container.reserve(j.size()); }) {
+        container.reserve(j.size());
+    }
+
+    size_t index = 0;
+
+    for (auto &chunk : results) {
+        for (auto &value : chunk) {
+            container.emplace_hint(container.end(), *members[index++].first, std::move(value));
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Unpack a map-like type with non-string keys.
+ */
+template <traits::not_convertible_map T>
+bool deserialize_parallel(const json &j, T &container, size_t threads, const error_func &on_error, bool in_place)
+{
+    using entry_type = std::pair<typename T::key_type, typename T::mapped_type>;
+
+    size_t chunks = j.is_array() ? parallel_chunks(j.size(), threads) : 0;
+
+    if (chunks <= 1) {
+        return deserialize(j, container, on_error, in_place);
+    }
+
+    auto results = deserialize_chunks<entry_type>(j.size(), chunks, on_error, [&j, &container](size_t index, const error_func &err) {
+        const json &v = j[index];
+        std::optional<entry_type> entry;
+
+        if (!v.is_array() || v.size() != 2) {
+            handle_error(err, "ignoring unexpected map entry: {}[{}]", j.type_name(), j.size());
+            return entry;
+        }
+
+        auto key = make_element<typename T::key_type>(container);
+
+        if (deserialize(v[0], key, err)) {
+            entry.emplace(std::move(key), make_element<typename T::mapped_type>(container));
+            deserialize(v[1], entry->second, err);
+        }
+
+        return entry;
+    });
+
+    container.clear();
+
+    if constexpr (requires { container.reserve(j.size()); }) {
+        container.reserve(j.size());
+    }
+
+    for (auto &chunk : results) {
+        for (auto &[key, value] : chunk) {
+            container.emplace_hint(container.end(), std::move(key), std::move(value));
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Unpack a visitable struct. Members are deserialized in parallel, so large
+ * containers nested in structs are split too.
+ */
+template <traits::visitable T>
+bool deserialize_parallel(const json &j, T &container, size_t threads, const error_func &on_error, bool in_place)
+{
+    if (!j.is_object()) {
+        return deserialize(j, container, on_error, in_place);
+    }
+
+    deserialize_members(j, container, in_place, [threads, &on_error, in_place](const json &v, auto &value) {
+        return deserialize_parallel(v, value, threads, on_error, in_place);
+    });
+
+    return true;
+}
+
+/*
+ * Unpack a lazy node, which is deserialized on first access (on the accessing thread).
+ */
+template <traits::lazy T>
+bool deserialize_parallel(const json &j, T &value, size_t, const error_func &on_error, bool in_place)
+{
+    return deserialize(j, value, on_error, in_place);
+}
+
+/*
+ * Unpack a leaf node.
+ */
+template <traits::leaf T>
+bool deserialize_parallel(const json &j, T &value, size_t, const error_func &on_error, bool in_place)
+{
+    return deserialize(j, value, on_error, in_place);
+}
+
+} /* namespace jstore */
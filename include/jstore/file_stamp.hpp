@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+#include <ctime>
+#include <filesystem>
+#include <optional>
+
+namespace jstore {
+
+/*
+ * Identifies a specific version of a file on disk.
+ *
+ * Writers that atomically replace a file change its inode, while in-place
+ * writers change its size and/or modification time. Comparing stamps
+ * allows cached file content to be reused until another process modifies
+ * the file.
+ */
+struct file_stamp {
+    dev_t dev = 0;
+    ino_t ino = 0;
+    off_t size = 0;
+    timespec mtime = {};
+
+    bool operator==(const file_stamp &rhs) const
+    {
+        return dev == rhs.dev &&
+               ino == rhs.ino &&
+               size == rhs.size &&
+               mtime.tv_sec == rhs.mtime.tv_sec &&
+               mtime.tv_nsec == rhs.mtime.tv_nsec;
+    }
+
+    /*
+     * Return the stamp of the file described by `st`.
+     */
+    static file_stamp of(const struct stat &st)
+    {
+        return { st.st_dev, st.st_ino, st.st_size, st.st_mtim };
+    }
+
+    /*
+     * Return the stamp of an open file, or std::nullopt on failure.
+     */
+    static std::optional<file_stamp> of(int fd)
+    {
+        struct stat st;
+
+        if (::fstat(fd, &st) < 0) {
+            return std::nullopt;
+        }
+
+        return of(st);
+    }
+
+    /*
+     * Return the stamp of the file at `path`, or std::nullopt if it does not exist.
+     */
+    static std::optional<file_stamp> of(const std::filesystem::path &path)
+    {
+        struct stat st;
+
+        if (::stat(path.c_str(), &st) < 0) {
+            return std::nullopt;
+        }
+
+        return of(st);
+    }
+};
+
+} /* namespace jstore */
@@ -7,7 +7,12 @@
 
 #pragma once
 
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <fmt/core.h>
 #include <visit_struct/visit_struct.hpp>
@@ -34,6 +39,8 @@ template <traversal Traversal, traits::map T, typename Func>
 void for_each(T &container, const std::string &path, const Func &func);
 template <traversal Traversal, traits::visitable T, typename Func>
 void for_each(T &container, const std::string &path, const Func &func);
+template <traversal Traversal, traits::lazy T, typename Func>
+void for_each(T &value, const std::string &path, const Func &func);
 template <traversal Traversal, traits::leaf T, typename Func>
 void for_each(T &value, const std::string &path, const Func &func);
 
@@ -86,6 +93,15 @@ void for_each(T &container, const std::string &path, const Func &func)
     });
 }
 
+/*
+ * Tree traversal for lazy nodes, which are deserialized to be traversed.
+ */
+template <traversal Traversal, traits::lazy T, typename Func>
+void for_each(T &value, const std::string &path, const Func &func)
+{
+    for_each<Traversal>(value.get(), path, func);
+}
+
 /*
  * Leaf node handler.
  */
@@ -106,4 +122,156 @@ void for_each(T &container, const Func &func)
     for_each<Traversal>(container, std::string{}, func);
 }
 
+
+/*
+ * Lazily formatted node path.
+ *
+ * Holds a reference to each key on the path to the current node, and only
+ * formats the path string on demand. Segments are stored in a buffer that is
+ * reused for the whole traversal. A lazy_path is only valid for the duration
+ * of the callback it is passed to; call str() to keep a copy.
+ */
+class lazy_path {
+public:
+    /*
+     * Return the number of segments in the path.
+     */
+    size_t size() const
+    {
+        return segments_.size();
+    }
+
+    /*
+     * Return true if this is the path to the root node.
+     */
+    bool empty() const
+    {
+        return segments_.empty();
+    }
+
+    /*
+     * Append the path string to `out`.
+     */
+    void append_to(std::string &out) const
+    {
+        for (size_t i = 0; i < segments_.size(); ++i) {
+            if (i > 0) {
+                out += '/';
+            }
+            segments_[i].append(out, segments_[i].key);
+        }
+    }
+
+    /*
+     * Return the path string.
+     */
+    std::string str() const
+    {
+        std::string out;
+
+        append_to(out);
+        return out;
+    }
+
+    operator std::string() const
+    {
+        return str();
+    }
+
+    friend bool operator==(const lazy_path &path, std::string_view str)
+    {
+        return path.str() == str;
+    }
+
+private:
+    template <traversal Traversal, typename T, typename Func>
+    friend void for_each_lazy(T &container, const Func &func);
+
+    template <traversal Traversal, typename T, typename Func>
+    friend void for_each_lazy(T &node, lazy_path &path, const Func &func);
+
+    /*
+     * Reference to a path segment key, and a function to format it.
+     */
+    struct segment {
+        const void *key;
+        void (*append)(std::string &out, const void *key);
+    };
+
+    template <typename Key>
+    void push(const Key &key)
+    {
+        segments_.push_back({ &key, [](std::string &out, const void *key) {
+            const Key &value = *static_cast<const Key *>(key);
+
+            if constexpr (std::is_convertible_v<const Key &, std::string_view>) {
+                out += std::string_view(value);
+            } else {
+                fmt::format_to(std::back_inserter(out), "{}", value);
+            }
+        } });
+    }
+
+    void pop()
+    {
+        segments_.pop_back();
+    }
+
+    std::vector<segment> segments_;
+};
+
+/*
+ * Tree traversal with lazily formatted paths.
+ *
+ * Equivalent to for_each(), but `func` is invoked with a `const lazy_path &`
+ * instead of a `const std::string &`. Use this when the callback reads few
+ * (or no) paths, to avoid formatting a path string for every node.
+ */
+template <traversal Traversal, typename T, typename Func>
+void for_each_lazy(T &node, lazy_path &path, const Func &func)
+{
+    using type = std::remove_const_t<T>;
+
+    if constexpr (traits::lazy<type>) {
+        for_each_lazy<Traversal>(node.get(), path, func);
+    } else if constexpr (traits::container<type>) {
+        if constexpr (Traversal & NON_LEAF) {
+            func(std::as_const(path), node);
+        }
+
+        if constexpr (traits::array<type>) {
+            size_t index = 0;
+
+            for (auto &value : node) {
+                path.push(index);
+                for_each_lazy<Traversal>(value, path, func);
+                path.pop();
+                ++index;
+            }
+        } else if constexpr (traits::map<type>) {
+            for (auto &[key, value] : node) {
+                path.push(key);
+                for_each_lazy<Traversal>(value, path, func);
+                path.pop();
+            }
+        } else {
+            visit_struct::for_each(node, [&path, &func](const char *key, auto &value) {
+                path.push(key);
+                for_each_lazy<Traversal>(value, path, func);
+                path.pop();
+            });
+        }
+    } else if constexpr (Traversal & LEAF) {
+        func(std::as_const(path), node);
+    }
+}
+
+template <traversal Traversal, typename T, typename Func>
+void for_each_lazy(T &container, const Func &func)
+{
+    lazy_path path;
+
+    for_each_lazy<Traversal>(container, path, func);
+}
+
 } /* namespace jstore */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <nlohmann/json.hpp>
+
+namespace jstore {
+
+using json = nlohmann::json;
+
+/*
+ * On-disk encodings.
+ *
+ * A format policy converts the serialized tree to and from the bytes
+ * persisted in the file. Formats other than text JSON are more compact and
+ * faster to parse, but are not human-readable. Exported (D-Bus) values are
+ * always text JSON, regardless of the on-disk format.
+ */
+
+/*
+ * Text JSON (default).
+ */
+struct json_format {
+    static std::string encode(const json &j)
+    {
+        return j.dump();
+    }
+
+    static json decode(std::string_view data)
+    {
+        return json::parse(data.begin(), data.end());
+    }
+};
+
+/*
+ * Concise Binary Object Representation (RFC 8949).
+ */
+struct cbor_format {
+    static std::string encode(const json &j)
+    {
+        std::string data;
+        json::to_cbor(j, data);
+        return data;
+    }
+
+    static json decode(std::string_view data)
+    {
+        return json::from_cbor(data.begin(), data.end());
+    }
+};
+
+/*
+ * MessagePack.
+ */
+struct msgpack_format {
+    static std::string encode(const json &j)
+    {
+        std::string data;
+        json::to_msgpack(j, data);
+        return data;
+    }
+
+    static json decode(std::string_view data)
+    {
+        return json::from_msgpack(data.begin(), data.end());
+    }
+};
+
+/*
+ * Binary JSON.
+ *
+ * Note: BSON documents must be objects, so the tree root must serialize to
+ * a JSON object (e.g. a visitable struct or a map with string keys).
+ */
+struct bson_format {
+    static std::string encode(const json &j)
+    {
+        std::string data;
+        json::to_bson(j, data);
+        return data;
+    }
+
+    static json decode(std::string_view data)
+    {
+        return json::from_bson(data.begin(), data.end());
+    }
+};
+
+} /* namespace jstore */
@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+namespace jstore {
+
+/*
+ * Selects how lazy nodes are deserialized on the current thread while in
+ * scope (see deserialize()).
+ *
+ * Deferred errors are reported after deserialize() returns, so they are not
+ * reported to its error handler, which may not live that long. Instead, a
+ * deferring scope supplies a handler shared with the nodes. The tree opens
+ * one while it loads, with its own error handler. Outside any scope, lazy
+ * nodes are deferred and their errors are ignored.
+ *
+ * An eager scope deserializes lazy nodes immediately, reporting errors to
+ * deserialize()'s handler, so a value that fails to deserialize fails the
+ * call (e.g. for a D-Bus Set).
+ */
+class lazy_scope {
+public:
+    using handler_ptr = std::shared_ptr<const std::function<void(std::string &&)>>;
+
+    struct eager_t {};
+    static constexpr eager_t eager{};
+
+    /*
+     * Defer deserialization, and report errors found on first access to
+     * `on_error`.
+     */
+    explicit lazy_scope(handler_ptr on_error) :
+        saved_(std::exchange(current_, state{ std::move(on_error), false }))
+    {
+    }
+
+    /*
+     * Deserialize lazy nodes immediately.
+     */
+    explicit lazy_scope(eager_t) :
+        saved_(std::exchange(current_, state{ nullptr, true }))
+    {
+    }
+
+    lazy_scope(const lazy_scope &) = delete;
+    lazy_scope &operator=(const lazy_scope &) = delete;
+
+    ~lazy_scope()
+    {
+        current_ = std::move(saved_);
+    }
+
+    static bool is_eager()
+    {
+        return current_.eager;
+    }
+
+    /*
+     * Return the handler for errors found on first access, or nullptr.
+     */
+    static const handler_ptr &deferred_handler()
+    {
+        return current_.on_error;
+    }
+
+private:
+    struct state {
+        handler_ptr on_error;
+        bool eager;
+    };
+
+    static inline thread_local state current_;
+
+    state saved_;
+};
+
+/*
+ * Tree node that is deserialized on first access.
+ *
+ * When a lazy node is loaded, it keeps the JSON content of the node, and
+ * only deserializes it when the value is first accessed through get(),
+ * operator*, operator->, or a path (e.g. visit_path(), modify(), or a D-Bus
+ * Get). Until then, saves write the JSON content back as-is. Errors found
+ * when the value is deserialized are reported to the tree's error handler
+ * (see lazy_scope).
+ *
+ * For example, a rarely used history map:
+ *
+ *   struct state {
+ *       std::string name;
+ *       jstore::lazy<std::map<std::string, record>> history;
+ *   };
+ *
+ * Lazy nodes save load time, not memory: until it is deserialized, a node
+ * holds a copy of its JSON content, which the tree also caches for saves.
+ *
+ * Concurrent const accesses (e.g. from read() and D-Bus requests) are safe,
+ * and deserialize the value once. Comparison deserializes both values,
+ * unless both hold the same JSON content.
+ */
+template <typename T>
+class lazy {
+public:
+    using value_type = T;
+    using loader_func = std::function<void(const nlohmann::json &, T &)>;
+
+    lazy() :
+        value_(std::in_place)
+    {
+    }
+
+    lazy(T value) :
+        value_(std::move(value))
+    {
+    }
+
+    lazy(const lazy &other)
+    {
+        std::lock_guard lock(other.mutex_);
+
+        value_ = other.value_;
+        raw_ = other.raw_;
+        loader_ = other.loader_;
+        loaded_.store(other.loaded_.load());
+    }
+
+    /*
+     * Containers of lazy nodes move them on reallocation, rather than copying.
+     * Moved nodes MUST NOT be accessed concurrently, so they are not locked
+     * (locking may throw).
+     */
+    lazy(lazy &&other) noexcept(std::is_nothrow_move_constructible_v<T>) :
+        value_(std::move(other.value_)),
+        raw_(std::move(other.raw_)),
+        loader_(std::move(other.loader_)),
+        loaded_(other.loaded_.load())
+    {
+    }
+
+    lazy &operator=(const lazy &other)
+    {
+        if (this != &other) {
+            std::scoped_lock lock(mutex_, other.mutex_);
+
+            value_ = other.value_;
+            raw_ = other.raw_;
+            loader_ = other.loader_;
+            loaded_.store(other.loaded_.load());
+        }
+
+        return *this;
+    }
+
+    lazy &operator=(lazy &&other) noexcept(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_move_assignable_v<T>)
+    {
+        if (this != &other) {
+            value_ = std::move(other.value_);
+            raw_ = std::move(other.raw_);
+            loader_ = std::move(other.loader_);
+            loaded_.store(other.loaded_.load());
+        }
+
+        return *this;
+    }
+
+    lazy &operator=(T value)
+    {
+        std::lock_guard lock(mutex_);
+
+        value_ = std::move(value);
+        raw_ = nullptr;
+        loader_ = {};
+        loaded_.store(true);
+
+        return *this;
+    }
+
+    /*
+     * Return the value, deserializing it on first access.
+     */
+    T &get()
+    {
+        load();
+        return *value_;
+    }
+
+    const T &get() const
+    {
+        load();
+        return *value_;
+    }
+
+    T &operator*()
+    {
+        return get();
+    }
+
+    const T &operator*() const
+    {
+        return get();
+    }
+
+    T *operator->()
+    {
+        return &get();
+    }
+
+    const T *operator->() const
+    {
+        return &get();
+    }
+
+    /*
+     * Return true if the value was deserialized (or assigned).
+     */
+    bool loaded() const
+    {
+        return loaded_.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Replace the value with JSON content, which is deserialized by `loader`
+     * on first access.
+     */
+    void defer(nlohmann::json raw, loader_func loader)
+    {
+        std::lock_guard lock(mutex_);
+
+        value_.reset();
+        raw_ = std::move(raw);
+        loader_ = std::move(loader);
+        loaded_.store(false);
+    }
+
+    /*
+     * If the value was not loaded yet, invoke `func` with its JSON content
+     * and return true. The value is not deserialized meanwhile.
+     */
+    template <typename Func>
+    bool visit_raw(Func &&func) const
+    {
+        if (loaded()) {
+            return false;
+        }
+
+        std::lock_guard lock(mutex_);
+
+        if (loaded_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        std::forward<Func>(func)(raw_);
+        return true;
+    }
+
+    bool operator==(const lazy &other) const
+    {
+        if (this == &other) {
+            return true;
+        }
+
+        if (!loaded() && !other.loaded()) {
+            std::scoped_lock lock(mutex_, other.mutex_);
+
+            if (!loaded_.load() && !other.loaded_.load() && raw_ == other.raw_) {
+                return true;
+            }
+        }
+
+        return get() == other.get();
+    }
+
+private:
+    void load() const
+    {
+        if (loaded()) {
+            return;
+        }
+
+        std::lock_guard lock(mutex_);
+
+        if (loaded_.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        value_.emplace();
+
+        if (loader_) {
+            loader_(raw_, *value_);
+        }
+
+        /* Release the JSON content, as the value now holds it */
+        raw_ = nullptr;
+        loader_ = {};
+        loaded_.store(true, std::memory_order_release);
+    }
+
+    mutable std::optional<T> value_;
+    mutable nlohmann::json raw_;
+    mutable loader_func loader_;
+    mutable std::atomic<bool> loaded_{true};
+    mutable std::mutex mutex_;
+};
+
+} /* namespace jstore */
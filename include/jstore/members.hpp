@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include <visit_struct/visit_struct.hpp>
+
+#include <jstore/traits.hpp>
+
+namespace jstore {
+
+/*
+ * Compile-time tables describing the members of visitable structs.
+ */
+
+template <traits::visitable T>
+inline constexpr size_t member_count = visit_struct::field_count<T>();
+
+/*
+ * Member names, indexed by declaration order.
+ */
+template <traits::visitable T>
+inline constexpr std::array<std::string_view, member_count<T>> member_names =
+    []<size_t ...I>(std::index_sequence<I...>) {
+        return std::array<std::string_view, sizeof...(I)>{ visit_struct::get_name<static_cast<int>(I), T>()... };
+    }(std::make_index_sequence<member_count<T>>{});
+
+/*
+ * Member indices, sorted by name. This is the order in which nlohmann::json
+ * objects store (and dump) their keys.
+ */
+template <traits::visitable T>
+inline constexpr std::array<size_t, member_count<T>> sorted_members =
+    []() {
+        std::array<size_t, member_count<T>> order{};
+
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+
+        std::sort(order.begin(), order.end(), [](size_t a, size_t b) {
+            return member_names<T>[a] < member_names<T>[b];
+        });
+
+        return order;
+    }();
+
+/*
+ * FNV-1a hash of a member name (or JSON key).
+ */
+constexpr uint32_t member_hash(std::string_view name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (char c : name) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Member name hashes, indexed by declaration order.
+ */
+template <traits::visitable T>
+inline constexpr std::array<uint32_t, member_count<T>> member_hashes =
+    []() {
+        std::array<uint32_t, member_count<T>> hashes{};
+
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            hashes[i] = member_hash(member_names<T>[i]);
+        }
+
+        return hashes;
+    }();
+
+/*
+ * Open addressing hash table of member indices (plus one, so that zero marks
+ * an empty slot). At most half of the slots are used, so probes are short.
+ */
+template <traits::visitable T>
+inline constexpr std::array<size_t, std::bit_ceil(2 * member_count<T> + 1)> member_table =
+    []() {
+        std::array<size_t, std::bit_ceil(2 * member_count<T> + 1)> table{};
+
+        for (size_t i = 0; i < member_count<T>; ++i) {
+            size_t slot = member_hashes<T>[i] & (table.size() - 1);
+
+            while (table[slot] != 0) {
+                slot = (slot + 1) & (table.size() - 1);
+            }
+
+            table[slot] = i + 1;
+        }
+
+        return table;
+    }();
+
+/*
+ * Return the declaration index of the member named `name`, or std::nullopt
+ * if there is no such member. Performs a constant time hash table lookup.
+ */
+template <traits::visitable T>
+constexpr std::optional<size_t> find_member(std::string_view name)
+{
+    constexpr size_t mask = member_table<T>.size() - 1;
+    uint32_t hash = member_hash(name);
+
+    for (size_t slot = hash & mask; member_table<T>[slot] != 0; slot = (slot + 1) & mask) {
+        size_t index = member_table<T>[slot] - 1;
+
+        if (member_hashes<T>[index] == hash && member_names<T>[index] == name) {
+            return index;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/*
+ * Invoke `func` with std::integral_constant<size_t, I>, where I is the
+ * run-time member index `index`. Dispatches through a jump table generated
+ * for each member, so the member may be accessed at compile time (e.g.
+ * using visit_struct::get<I>()). `index` must be less than member_count<T>.
+ */
+template <traits::visitable T, typename Func>
+decltype(auto) dispatch_member(size_t index, Func &&func)
+{
+    using result_type = decltype(func(std::integral_constant<size_t, 0>{}));
+    using visitor_type = result_type (*)(Func &);
+
+    static constexpr auto visitors = []<size_t ...I>(std::index_sequence<I...>) {
+        return std::array<visitor_type, sizeof...(I)>{
+            [](Func &f) -> result_type {
+                return f(std::integral_constant<size_t, I>{});
+            }...
+        };
+    }(std::make_index_sequence<member_count<T>>{});
+
+    return visitors[index](func);
+}
+
+} /* namespace jstore */
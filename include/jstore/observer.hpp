@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string_view>
+
+namespace jstore {
+
+/*
+ * Instrumented phases of tree I/O and D-Bus requests.
+ */
+enum class io_phase {
+    READ,               /* File read (bytes read) */
+    DECODE,             /* Decompression and parsing of file content */
+    DESERIALIZE,        /* Tree deserialization on load() */
+    SERIALIZE,          /* Tree serialization and comparison with the cached content on save() */
+    SKIP_WRITE,         /* save() with unchanged content, so nothing is written (no duration) */
+    ENCODE,             /* Encoding and compression of file content (bytes encoded) */
+    WRITE,              /* File write (bytes written) */
+    FSYNC,              /* File flush to storage */
+    RENAME,             /* Atomic replacement of the file */
+    DBUS_CALL,          /* D-Bus method call or signal emission (name is the member) */
+    DBUS_SERIALIZE,     /* Serialization of a value returned or emitted over D-Bus (bytes serialized) */
+};
+
+inline constexpr size_t IO_PHASE_COUNT = static_cast<size_t>(io_phase::DBUS_SERIALIZE) + 1;
+
+/*
+ * A measured phase. `name` is the file path or D-Bus method, if applicable,
+ * and is only valid for the duration of the observer call.
+ */
+struct io_event {
+    io_phase phase;
+    std::chrono::nanoseconds duration{0};
+    size_t bytes = 0;
+    std::string_view name;
+};
+
+/*
+ * Observer invoked after each phase. It may be invoked concurrently (e.g.
+ * by background saves, parallel shard reads, and D-Bus requests), and MUST
+ * NOT throw.
+ */
+using observer_func = std::function<void(const io_event &)>;
+
+/*
+ * Measures a phase, and reports it to the observer when stopped or
+ * destroyed. Without an observer, the clock is never read.
+ */
+class phase_timer {
+public:
+    phase_timer(const observer_func &observer, io_phase phase, std::string_view name = {}) :
+        observer_(observer ? &observer : nullptr),
+        phase_(phase),
+        name_(name)
+    {
+        if (observer_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    phase_timer(const phase_timer &) = delete;
+    phase_timer &operator=(const phase_timer &) = delete;
+
+    ~phase_timer()
+    {
+        stop();
+    }
+
+    /*
+     * Report the phase now, with the number of bytes processed.
+     */
+    void stop(size_t bytes = 0)
+    {
+        if (!observer_) {
+            return;
+        }
+
+        auto duration = std::chrono::steady_clock::now() - start_;
+
+        (*observer_)(io_event{ phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(duration), bytes, name_ });
+        observer_ = nullptr;
+    }
+
+private:
+    const observer_func *observer_;
+    io_phase phase_;
+    std::string_view name_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/*
+ * Report an event without a duration.
+ */
+inline void observe(const observer_func &observer, io_phase phase, size_t bytes = 0, std::string_view name = {})
+{
+    if (observer) {
+        observer(io_event{ phase, std::chrono::nanoseconds{0}, bytes, name });
+    }
+}
+
+/*
+ * Per-phase counters, accumulated by an observer. For example:
+ *
+ *   jstore::io_stats stats;
+ *   jstore::tree<config> conf{path, { .observer = stats.observer() }};
+ *   ...
+ *   auto writes = stats.get(jstore::io_phase::WRITE);
+ *
+ * The io_stats object must outlive the tree.
+ */
+class io_stats {
+public:
+    struct counters {
+        uint64_t count = 0;
+        uint64_t bytes = 0;
+        std::chrono::nanoseconds duration{0};
+    };
+
+    /*
+     * Return an observer that accumulates events into this object.
+     */
+    observer_func observer()
+    {
+        return [this](const io_event &event) {
+            add(event);
+        };
+    }
+
+    void add(const io_event &event)
+    {
+        std::lock_guard lock(mutex_);
+        counters &c = counters_[static_cast<size_t>(event.phase)];
+
+        ++c.count;
+        c.bytes += event.bytes;
+        c.duration += event.duration;
+    }
+
+    counters get(io_phase phase) const
+    {
+        std::lock_guard lock(mutex_);
+
+        return counters_[static_cast<size_t>(phase)];
+    }
+
+    void reset()
+    {
+        std::lock_guard lock(mutex_);
+
+        counters_ = {};
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::array<counters, IO_PHASE_COUNT> counters_{};
+};
+
+} /* namespace jstore */
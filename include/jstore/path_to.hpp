@@ -7,30 +7,191 @@
 
 #pragma once
 
+#include <cstddef>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#include <jstore/for_each.hpp>
+#include <fmt/core.h>
+#include <visit_struct/visit_struct.hpp>
+
+#include <jstore/members.hpp>
+#include <jstore/traits.hpp>
 
 namespace jstore {
 
+/* Recursion limit for type analysis of (possibly recursive) tree types */
+inline constexpr size_t PATH_TO_MAX_DEPTH = 16;
+
+/*
+ * Return true if a node of type Node may be found in a tree of type T.
+ */
+template <typename T, typename Node, size_t Depth = 0>
+consteval bool may_contain()
+{
+    if constexpr (std::is_same_v<T, Node> || Depth > PATH_TO_MAX_DEPTH) {
+        return true;
+    } else if constexpr (traits::array<T>) {
+        return may_contain<std::remove_cv_t<typename T::value_type>, Node, Depth + 1>();
+    } else if constexpr (traits::map<T>) {
+        return may_contain<typename T::mapped_type, Node, Depth + 1>();
+    } else if constexpr (traits::visitable<T>) {
+        return []<size_t ...I>(std::index_sequence<I...>) {
+            return (may_contain<std::remove_cv_t<visit_struct::type_at<static_cast<int>(I), T>>, Node, Depth + 1>() || ...);
+        }(std::make_index_sequence<member_count<T>>{});
+    } else if constexpr (traits::lazy<T>) {
+        return may_contain<typename T::value_type, Node, Depth + 1>();
+    } else {
+        return false;
+    }
+}
+
+/*
+ * Return true if all nodes of a tree of type T are stored within the T
+ * object itself (i.e. there are no dynamically allocated containers).
+ */
+template <typename T, size_t Depth = 0>
+consteval bool is_inline_tree()
+{
+    if constexpr (Depth > PATH_TO_MAX_DEPTH) {
+        return false;
+    } else if constexpr (traits::leaf<T>) {
+        return true;
+    } else if constexpr (traits::visitable<T>) {
+        return []<size_t ...I>(std::index_sequence<I...>) {
+            return (is_inline_tree<std::remove_cv_t<visit_struct::type_at<static_cast<int>(I), T>>, Depth + 1>() && ...);
+        }(std::make_index_sequence<member_count<T>>{});
+    } else {
+        return false;
+    }
+}
+
+/*
+ * Return true if `node` may be a descendant of `container`. Inline trees
+ * are pruned by address range; others by node type.
+ */
+template <typename T, typename Node>
+bool may_contain_node(const T &container, const Node &node)
+{
+    if constexpr (!may_contain<T, Node>()) {
+        return false;
+    } else if constexpr (is_inline_tree<T>()) {
+        auto begin = reinterpret_cast<const std::byte *>(std::addressof(container));
+        auto addr = reinterpret_cast<const std::byte *>(std::addressof(node));
+        std::less<const std::byte *> less;
+
+        return !less(addr, begin) && less(addr, begin + sizeof(T));
+    } else {
+        return true;
+    }
+}
+
+/*
+ * Search the tree for `node`. On success, path segments are appended to
+ * `segments` (deepest first).
+ */
+template <typename T, typename Node>
+bool find_path(const T &container, const Node &node, std::vector<std::string> &segments)
+{
+    if constexpr (std::is_same_v<T, Node>) {
+        if (std::addressof(container) == std::addressof(node)) {
+            return true;
+        }
+    }
+
+    if constexpr (traits::array<T>) {
+        using value_type = std::remove_cv_t<typename T::value_type>;
+
+        if constexpr (requires { container.data(); } && is_inline_tree<value_type>()) {
+            /* Contiguous storage: locate the element by address */
+            auto begin = reinterpret_cast<const std::byte *>(container.data());
+            auto addr = reinterpret_cast<const std::byte *>(std::addressof(node));
+            std::less<const std::byte *> less;
+
+            if (container.empty() || less(addr, begin) || !less(addr, begin + container.size() * sizeof(value_type))) {
+                return false;
+            }
+
+            size_t index = static_cast<size_t>(addr - begin) / sizeof(value_type);
+
+            if (!find_path(container.data()[index], node, segments)) {
+                return false;
+            }
+
+            segments.push_back(fmt::format("{}", index));
+            return true;
+        } else {
+            size_t index = 0;
+
+            for (auto &value : container) {
+                if (may_contain_node(value, node) && find_path(value, node, segments)) {
+                    segments.push_back(fmt::format("{}", index));
+                    return true;
+                }
+
+                ++index;
+            }
+        }
+    } else if constexpr (traits::map<T>) {
+        for (auto &[key, value] : container) {
+            if (may_contain_node(value, node) && find_path(value, node, segments)) {
+                segments.push_back(fmt::format("{}", key));
+                return true;
+            }
+        }
+    } else if constexpr (traits::visitable<T>) {
+        auto find_member_path = [&]<size_t I>(std::integral_constant<size_t, I>) {
+            auto &value = visit_struct::get<static_cast<int>(I)>(container);
+
+            if (may_contain_node(value, node) && find_path(value, node, segments)) {
+                segments.emplace_back(member_names<T>[I]);
+                return true;
+            }
+
+            return false;
+        };
+
+        return [&]<size_t ...I>(std::index_sequence<I...>) {
+            return (find_member_path(std::integral_constant<size_t, I>{}) || ...);
+        }(std::make_index_sequence<member_count<T>>{});
+    } else if constexpr (traits::lazy<T>) {
+        /* Nodes cannot be referenced in content that was not deserialized yet */
+        if (container.loaded()) {
+            return may_contain_node(container.get(), node) && find_path(container.get(), node, segments);
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Return the path to a node in the tree, or std::nullopt if the node is not
+ * part of the tree. The search ends at the first match, skips subtrees that
+ * cannot contain the node, and only formats the path segments leading to it.
+ */
 template <typename ContainerType, typename NodeType>
 std::optional<std::string> path_to(const ContainerType &container, const NodeType &node)
 {
-    std::optional<std::string> path_to_node;
+    std::vector<std::string> segments;
 
-    jstore::for_each<ALL>(container, [&node, &path_to_node](const std::string &path, const auto &member) {
-        using node_type = std::decay_t<decltype(node)>;
-        using member_type = std::decay_t<decltype(member)>;
+    if (!find_path(container, node, segments)) {
+        return std::nullopt;
+    }
 
-        if constexpr (std::is_same_v<node_type, member_type>) {
-            if (std::addressof(node) == std::addressof(member)) {
-                path_to_node = path;
-            }
+    std::string path;
+
+    for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+        if (!path.empty()) {
+            path += '/';
         }
-    });
+        path += *it;
+    }
 
-    return path_to_node;
+    return path;
 }
 
 } /* namespace jstore */
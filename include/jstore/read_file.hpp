@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <system_error>
+
+#include <jstore/file_stamp.hpp>
+
+namespace jstore {
+
+/*
+ * Read the entire file into a contiguous buffer, and set `stamp` to the
+ * version of the file that was read. Returns std::nullopt if the file does
+ * not exist. Throws std::system_error on failure.
+ *
+ * The buffer is sized from fstat(), so the content is normally read by a
+ * single read() call, avoiding the per-character overhead of iostreams.
+ */
+inline std::optional<std::string> read_file(const std::filesystem::path &path, file_stamp &stamp)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return std::nullopt;
+        }
+
+        throw std::system_error(errno, std::generic_category(), "failed to open file");
+    }
+
+    /* Closes the file on scope exit */
+    struct fd_guard {
+        int fd;
+
+        ~fd_guard()
+        {
+            ::close(fd);
+        }
+    } guard{fd};
+
+    struct stat st;
+
+    if (::fstat(fd, &st) < 0) {
+        throw std::system_error(errno, std::generic_category(), "failed to stat file");
+    }
+
+    /* Stamp is taken before reading, so concurrent changes are detected later */
+    stamp = file_stamp::of(st);
+
+    /* Spare byte allows EOF to be detected without growing the buffer */
+    std::string data(static_cast<size_t>(st.st_size) + 1, '\0');
+    size_t len = 0;
+
+    while (true) {
+        if (len == data.size()) {
+            data.resize(data.size() * 2);
+        }
+
+        ssize_t n = ::read(fd, data.data() + len, data.size() - len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw std::system_error(errno, std::generic_category(), "failed to read file");
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        len += static_cast<size_t>(n);
+    }
+
+    data.resize(len);
+    return data;
+}
+
+} /* namespace jstore */
@@ -7,12 +7,18 @@
 
 #pragma once
 
+#include <array>
 #include <concepts>
+#include <memory>
+#include <string_view>
 #include <utility>
 
 #include <nlohmann/json.hpp>
 #include <visit_struct/visit_struct.hpp>
 
+#include <jstore/defaults.hpp>
+#include <jstore/lazy.hpp>
+#include <jstore/members.hpp>
 #include <jstore/traits.hpp>
 #include <jstore/utilities.hpp>
 
@@ -31,6 +37,8 @@ template <traits::not_convertible_map T>
 bool serialize(json &j, const T &container, bool omit_defaults = false, const error_func &on_error = {});
 template <traits::visitable T>
 bool serialize(json &j, const T &container, bool omit_defaults = false, const error_func &on_error = {});
+template <traits::lazy T>
+bool serialize(json &j, const T &value, bool omit_defaults = false, const error_func &on_error = {});
 template <traits::leaf T>
 bool serialize(json &j, const T &value, bool omit_defaults = false, const error_func &on_error = {});
 
@@ -65,7 +73,7 @@ bool serialize(json &j, const T &container, bool omit_defaults, const error_func
         json v;
 
         serialize(v, value, omit_defaults, on_error);
-        j[key] = std::move(v);
+        j[json_key(key)] = std::move(v);
     }
 
     return !j.empty();
@@ -100,24 +108,20 @@ bool serialize(json &j, const T &container, bool omit_defaults, const error_func
 template <traits::visitable T>
 bool serialize(json &j, const T &container, bool omit_defaults, const error_func &on_error)
 {
-    /*
-     * Note: `defaults` is static to avoid default constructing it on each serialize() call.
-     * To avoid bugs, structs' initial values must not change.
-     */
-    static thread_local const T defaults{};
-
     /* To avoid overwriting unknown keys, only clear j if it is not the expected type */
     if (!j.is_object()) {
         j = json::object();
     }
 
-    visit_struct::for_each(container, defaults, [&j, omit_defaults, &on_error](const char *key, const auto &value, const auto &def) {
+    auto serialize_member = [&j, &container, omit_defaults, &on_error]<size_t I>(std::integral_constant<size_t, I>) {
+        const auto &value = visit_struct::get<static_cast<int>(I)>(container);
+        const std::string_view key = member_names<T>[I];
         bool written = false;
 
         using member_type = decltype(value);
         static_assert(std::equality_comparable<member_type>, "members of visitable_structs must be equality comparable");
 
-        if (!omit_defaults || value != def) {
+        if (!omit_defaults || !is_default_member<I>(container)) {
             json v;
 
             if (serialize(v, value, omit_defaults, on_error)) {
@@ -132,11 +136,32 @@ bool serialize(json &j, const T &container, bool omit_defaults, const error_func
                 j.erase(it);
             }
         }
-    });
+    };
+
+    [&serialize_member]<size_t ...I>(std::index_sequence<I...>) {
+        (serialize_member(std::integral_constant<size_t, I>{}), ...);
+    }(std::make_index_sequence<member_count<T>>{});
 
     return !j.empty();
 }
 
+/*
+ * Pack a lazy node. Content that was not deserialized yet is written as-is.
+ */
+template <traits::lazy T>
+bool serialize(json &j, const T &value, bool omit_defaults, const error_func &on_error)
+{
+    if (!value.visit_raw([&j](const json &raw) { j = raw; })) {
+        return serialize(j, value.get(), omit_defaults, on_error);
+    }
+
+    if constexpr (traits::container<typename T::value_type>) {
+        return !j.empty();
+    } else {
+        return true;
+    }
+}
+
 /*
  * Pack a leaf node.
  *
@@ -159,34 +184,135 @@ bool serialize(json &j, const T &value, bool omit_defaults, const error_func &on
 
 /*
  * Deserializer forward declarations.
+ *
+ * By default, containers are cleared and rebuilt. With `in_place`, existing
+ * array elements and map entries are reused: elements are deserialized over
+ * in place, map nodes are moved to their new position, and only the
+ * remainder is allocated or destroyed. The result is the same as a rebuild
+ * (values that fail to deserialize are reset to their defaults), provided
+ * that user-defined from_json() functions assign every field of the value.
  */
 template <traits::array T>
-bool deserialize(const json &j, T &container, const error_func &on_error = {});
+bool deserialize(const json &j, T &container, const error_func &on_error = {}, bool in_place = false);
 template <traits::convertible_map T>
-bool deserialize(const json &j, T &container, const error_func &on_error = {});
+bool deserialize(const json &j, T &container, const error_func &on_error = {}, bool in_place = false);
 template <traits::not_convertible_map T>
-bool deserialize(const json &j, T &container, const error_func &on_error = {});
+bool deserialize(const json &j, T &container, const error_func &on_error = {}, bool in_place = false);
 template <traits::visitable T>
-bool deserialize(const json &j, T &container, const error_func &on_error = {});
+bool deserialize(const json &j, T &container, const error_func &on_error = {}, bool in_place = false);
+template <traits::lazy T>
+bool deserialize(const json &j, T &value, const error_func &on_error = {}, bool in_place = false);
 template <traits::leaf T>
-bool deserialize(const json &j, T &value, const error_func &on_error = {});
+bool deserialize(const json &j, T &value, const error_func &on_error = {}, bool in_place = false);
+
+/*
+ * Construct a new element for a container. Allocator-aware elements are
+ * constructed with the container's allocator, so that elements of
+ * std::pmr containers use the container's memory resource and are moved,
+ * rather than copied, into it.
+ */
+template <typename Element, typename Container>
+Element make_element(const Container &container)
+{
+    return std::make_obj_using_allocator<Element>(container.get_allocator());
+}
+
+/*
+ * Deserialize over a reused element. As with a newly constructed element, an
+ * element that fails to deserialize is left default initialized.
+ */
+template <typename T>
+void deserialize_element(const json &j, T &value, const error_func &on_error)
+{
+    if (!deserialize(j, value, on_error, true)) {
+        value = T{};
+    }
+}
+
+
+/*
+ * Deserialize the members of visitable struct `container` from object `j`,
+ * using `func(json, member)`, in a single pass over the object's keys. Keys
+ * are matched to members by hash table lookup, and unknown keys are ignored.
+ * Members without a key are restored to their default value, as are members
+ * that fail to deserialize in place.
+ */
+template <traits::visitable T, typename Func>
+void deserialize_members(const json &j, T &container, bool in_place, Func &&func)
+{
+    std::array<bool, member_count<T>> found{};
+
+    if constexpr (member_count<T> > 0) {
+        for (auto it = j.begin(); it != j.end(); ++it) {
+            auto index = find_member<T>(it.key());
+
+            if (!index.has_value()) {
+                continue;
+            }
+
+            found[index.value()] = true;
+
+            dispatch_member<T>(index.value(), [&]<size_t I>(std::integral_constant<size_t, I>) {
+                auto &value = visit_struct::get<static_cast<int>(I)>(container);
+
+                if (!func(it.value(), value) && in_place) {
+                    /* As in a new struct, a member that fails to deserialize has its default value */
+                    value = default_member<I, T>();
+                }
+            });
+        }
+    }
+
+    auto restore_member = [&found, &container]<size_t I>(std::integral_constant<size_t, I>) {
+        if (!found[I] && !is_default_member<I>(container)) {
+            /* Restore default value for unsaved member */
+            visit_struct::get<static_cast<int>(I)>(container) = default_member<I, T>();
+        }
+    };
 
+    [&restore_member]<size_t ...I>(std::index_sequence<I...>) {
+        (restore_member(std::integral_constant<size_t, I>{}), ...);
+    }(std::make_index_sequence<member_count<T>>{});
+}
 
 /*
  * Unpack an array-like type.
  */
 template <traits::array T>
-bool deserialize(const json &j, T &container, const error_func &on_error)
+bool deserialize(const json &j, T &container, const error_func &on_error, bool in_place)
 {
+    using value_type = typename T::value_type;
+
     if (!j.is_array()) {
         handle_error(on_error, "failed to deserialize '{}': JSON type is {}", typestr<T>(), j.type_name());
         return false;
     }
 
+    /* Sequences of (non-proxy) elements are resized, and their elements reused */
+    if constexpr (requires { container.resize(j.size()); } &&
+                  std::is_same_v<decltype(*container.begin()), value_type &>) {
+        if (in_place) {
+            container.resize(j.size());
+
+            auto it = container.begin();
+
+            for (auto &v : j) {
+                deserialize_element(v, *it++, on_error);
+            }
+
+            return true;
+        }
+    }
+
     container.clear();
 
+    if constexpr (requires { container.reserve(j.size()); }) {
+        container.reserve(j.size());
+    }
+
+    /* Inserting at the end is constant time for sorted input to ordered sets */
     for (auto &v : j) {
-        typename T::value_type value {};
+        auto value = make_element<value_type>(container);
 
         deserialize(v, value, on_error);
         container.insert(container.end(), std::move(value));
@@ -199,21 +325,39 @@ bool deserialize(const json &j, T &container, const error_func &on_error)
  * Unpack a map-like type with string keys.
  */
 template <traits::convertible_map T>
-bool deserialize(const json &j, T &container, const error_func &on_error)
+bool deserialize(const json &j, T &container, const error_func &on_error, bool in_place)
 {
     if (!j.is_object()) {
         handle_error(on_error, "failed to deserialize '{}': JSON type is {}", typestr<T>(), j.type_name());
         return false;
     }
 
+    T previous(container.get_allocator());
+
+    if (in_place) {
+        previous.swap(container);
+    }
+
     container.clear();
 
-    /* Map serialization with string keys */
+    if constexpr (requires { container.reserve(j.size()); }) {
+        container.reserve(j.size());
+    }
+
+    /* Map serialization with string keys (ordered by key, so hinted at the end) */
     for (auto &[k, v] : j.items()) {
-        typename T::mapped_type value {};
+        if constexpr (requires { previous.extract(k); }) {
+            if (auto node = previous.extract(k); !node.empty()) {
+                deserialize_element(v, node.mapped(), on_error);
+                container.insert(container.end(), std::move(node));
+                continue;
+            }
+        }
+
+        auto value = make_element<typename T::mapped_type>(container);
 
         deserialize(v, value, on_error);
-        container.emplace(k, std::move(value));
+        container.emplace_hint(container.end(), k, std::move(value));
     }
 
     return true;
@@ -223,29 +367,47 @@ bool deserialize(const json &j, T &container, const error_func &on_error)
  * Unpack a map-like type with non-string keys.
  */
 template <traits::not_convertible_map T>
-bool deserialize(const json &j, T &container, const error_func &on_error)
+bool deserialize(const json &j, T &container, const error_func &on_error, bool in_place)
 {
     if (!j.is_array()) {
         handle_error(on_error, "failed to deserialize '{}': JSON type is {}", typestr<T>(), j.type_name());
         return false;
     }
 
+    T previous(container.get_allocator());
+
+    if (in_place) {
+        previous.swap(container);
+    }
+
     container.clear();
 
-    /* Map serialization with non-string keys */
+    if constexpr (requires { container.reserve(j.size()); }) {
+        container.reserve(j.size());
+    }
+
+    /* Map serialization with non-string keys (ordered by key, so hinted at the end) */
     for (auto &v : j) {
         if (!v.is_array() || v.size() != 2) {
             handle_error(on_error, "ignoring unexpected map entry: {}[{}]", j.type_name(), j.size());
             continue;
         }
 
-        typename T::key_type key;
+        auto key = make_element<typename T::key_type>(container);
 
         if (deserialize(v[0], key, on_error)) {
-            typename T::mapped_type value {};
+            if constexpr (requires { previous.extract(key); }) {
+                if (auto node = previous.extract(key); !node.empty()) {
+                    deserialize_element(v[1], node.mapped(), on_error);
+                    container.insert(container.end(), std::move(node));
+                    continue;
+                }
+            }
+
+            auto value = make_element<typename T::mapped_type>(container);
 
             deserialize(v[1], value, on_error);
-            container.emplace(std::move(key), std::move(value));
+            container.emplace_hint(container.end(), std::move(key), std::move(value));
         }
     }
 
@@ -256,21 +418,41 @@ bool deserialize(const json &j, T &container, const error_func &on_error)
  * Unpack a visitable struct.
  */
 template <traits::visitable T>
-bool deserialize(const json &j, T &container, const error_func &on_error)
+bool deserialize(const json &j, T &container, const error_func &on_error, bool in_place)
 {
     if (!j.is_object()) {
         handle_error(on_error, "failed to deserialize '{}': JSON type is {}", typestr<T>(), j.type_name());
         return false;
     }
 
-    static const T defaults{};
+    deserialize_members(j, container, in_place, [&on_error, in_place](const json &v, auto &value) {
+        return deserialize(v, value, on_error, in_place);
+    });
 
-    visit_struct::for_each(container, defaults, [&j, &on_error](const char *key, auto &value, const auto &def) {
-        if (j.contains(key)) {
-            deserialize(j.at(key), value, on_error);
-        } else if (value != def) {
-            /* Restore default value for unsaved member */
-            value = def;
+    return true;
+}
+
+/*
+ * Unpack a lazy node. The content is kept, and only deserialized on first
+ * access, with errors reported to the handler of the enclosing lazy_scope.
+ * In an eager scope, the node is deserialized now.
+ */
+template <traits::lazy T>
+bool deserialize(const json &j, T &value, const error_func &on_error, bool in_place)
+{
+    if (lazy_scope::is_eager()) {
+        typename T::value_type v{};
+        bool result = deserialize(j, v, on_error, in_place);
+
+        value = std::move(v);
+        return result;
+    }
+
+    value.defer(j, [on_error = lazy_scope::deferred_handler()](const json &raw, typename T::value_type &v) {
+        if (on_error) {
+            deserialize(raw, v, *on_error);
+        } else {
+            deserialize(raw, v, error_func{});
         }
     });
 
@@ -283,7 +465,7 @@ bool deserialize(const json &j, T &container, const error_func &on_error)
  * Note that `void from_json(const json &, T &)` MUST be defined for type T.
  */
 template <traits::leaf T>
-bool deserialize(const json &j, T &value, const error_func &on_error)
+bool deserialize(const json &j, T &value, const error_func &on_error, bool /* in_place */)
 {
     try {
         j.get_to(value);
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <nlohmann/json.hpp>
+#include <visit_struct/visit_struct.hpp>
+
+#include <jstore/defaults.hpp>
+#include <jstore/members.hpp>
+#include <jstore/serialization.hpp>
+#include <jstore/traits.hpp>
+#include <jstore/utilities.hpp>
+#include <jstore/visit_path.hpp>
+
+namespace jstore {
+
+using json = nlohmann::json;
+
+/*
+ * Incremental serialization.
+ *
+ * serialize_path() re-serializes the tree node at `path` into `j`, which must
+ * hold a previous serialization of `container`. All other content of `j` is
+ * left as-is. The result is identical to calling serialize() on the whole
+ * tree, provided that no other nodes were modified since `j` was written,
+ * and that `j` was written by serialize(): unknown keys, which serialize()
+ * only keeps at the root, are not removed from the other nodes.
+ *
+ * Returns the same value as serialize() would for `container` (true if `j`
+ * is not empty), or std::nullopt if the path does not exist in the tree.
+ * `changed` is set if `j` was modified.
+ */
+template <traits::array T>
+std::optional<bool> serialize_path(json &j, const T &container, std::string_view path, bool &changed,
+        bool omit_defaults = false, const error_func &on_error = {});
+template <traits::map T>
+std::optional<bool> serialize_path(json &j, const T &container, std::string_view path, bool &changed,
+        bool omit_defaults = false, const error_func &on_error = {});
+template <traits::visitable T>
+std::optional<bool> serialize_path(json &j, const T &container, std::string_view path, bool &changed,
+        bool omit_defaults = false, const error_func &on_error = {});
+template <traits::lazy T>
+std::optional<bool> serialize_path(json &j, const T &value, std::string_view path, bool &changed,
+        bool omit_defaults = false, const error_func &on_error = {});
+template <traits::leaf T>
+std::optional<bool> serialize_path(json &j, const T &value, std::string_view path, bool &changed,
+        bool omit_defaults = false, const error_func &on_error = {});
+
+
+/*
+ * Replace `j` with the serialization of `node`.
+ */
+template <typename T>
+bool serialize_node(json &j, const T &node, bool &changed, bool omit_defaults, const error_func &on_error)
+{
+    json v;
+    bool result = serialize(v, node, omit_defaults, on_error);
+
+    if (v != j) {
+        j = std::move(v);
+        changed = true;
+    }
+
+    return result;
+}
+
+/*
+ * Incremental serialization of array-like types.
+ *
+ * Array elements cannot necessarily be identified by index (e.g. std::set),
+ * so the entire array is re-serialized.
+ */
+template <traits::array T>
+std::optional<bool> serialize_path(json &j, const T &container, std::string_view, bool &changed,
+        bool omit_defaults, const error_func &on_error)
+{
+    return serialize_node(j, container, changed, omit_defaults, on_error);
+}
+
+/*
+ * Incremental serialization of map-like types.
+ */
+template <traits::map T>
+std::optional<bool> serialize_path(json &j, const T &container, std::string_view path, bool &changed,
+        bool omit_defaults, const error_func &on_error)
+{
+    using key_type = typename T::key_type;
+    auto [key, child_path] = split_path(path);
+
+    /* Re-serialize the whole map if the path ends here, or if the previous serialization is unexpected */
+    constexpr bool string_keys = traits::convertible_map<T>;
+    if (path.empty() || (string_keys ? !j.is_object() : !j.is_array())) {
+        return serialize_node(j, container, changed, omit_defaults, on_error);
+    }
+
+    std::optional<key_type> key_value;
+
+    if constexpr (traits::path_string_key<key_type>) {
+        key_value = make_key<key_type>(key);
+    } else {
+        key_type parsed{};
+
+        if (!parse_key(key, parsed)) {
+            handle_error(on_error, "malformed map key in path segment: '{}'", key);
+            return std::nullopt;
+        }
+
+        key_value = std::move(parsed);
+    }
+
+    auto it = container.find(*key_value);
+
+    if constexpr (string_keys) {
+        auto jt = j.find(key);
+
+        if (it == container.end()) {
+            /* Entry was removed */
+            if (jt != j.end()) {
+                j.erase(jt);
+                changed = true;
+            }
+        } else if (jt == j.end()) {
+            /* Entry was added */
+            serialize(j[json_key(it->first)], it->second, omit_defaults, on_error);
+            changed = true;
+        } else if (!serialize_path(*jt, it->second, child_path, changed, omit_defaults, on_error)) {
+            return std::nullopt;
+        }
+    } else {
+        /* Entries are serialized as [key, value] pairs */
+        json k;
+
+        if (!serialize(k, *key_value, false, on_error)) {
+            return !j.empty();
+        }
+
+        auto jt = j.begin();
+        for (; jt != j.end(); ++jt) {
+            if (jt->is_array() && jt->size() == 2 && (*jt)[0] == k) {
+                break;
+            }
+        }
+
+        if (it == container.end()) {
+            /* Entry was removed */
+            if (jt != j.end()) {
+                j.erase(jt);
+                changed = true;
+            }
+        } else if (jt == j.end()) {
+            if constexpr (requires { typename T::hasher; }) {
+                /* Entry was added: insertion may rehash, reordering all entries */
+                return serialize_node(j, container, changed, omit_defaults, on_error);
+            } else {
+                /* Entry was added: insert in container order */
+                json v;
+                auto pos = std::min<size_t>(std::distance(container.begin(), it), j.size());
+
+                serialize(v, it->second, omit_defaults, on_error);
+                j.insert(j.begin() + pos, json::array({ std::move(k), std::move(v) }));
+                changed = true;
+            }
+        } else if (!serialize_path((*jt)[1], it->second, child_path, changed, omit_defaults, on_error)) {
+            return std::nullopt;
+        }
+    }
+
+    return !j.empty();
+}
+
+/*
+ * Incremental serialization of visitable structs.
+ */
+template <traits::visitable T>
+std::optional<bool> serialize_path(json &j, const T &container, std::string_view path, bool &changed,
+        bool omit_defaults, const error_func &on_error)
+{
+    if (path.empty() || !j.is_object()) {
+        return serialize_node(j, container, changed, omit_defaults, on_error);
+    }
+
+    auto [member, child_path] = split_path(path);
+    auto index = find_member<T>(member);
+
+    if (!index.has_value()) {
+        handle_error(on_error, "unknown member in path segment: '{}'", member);
+        return std::nullopt;
+    }
+
+    bool valid = dispatch_member<T>(index.value(), [&]<size_t I>(std::integral_constant<size_t, I>) {
+        const auto &value = visit_struct::get<static_cast<int>(I)>(container);
+        const std::string_view key = member_names<T>[I];
+
+        auto jt = j.find(key);
+        bool written = false;
+        bool member_valid = true;
+
+        if (!omit_defaults || !is_default_member<I>(container)) {
+            if (jt == j.end()) {
+                /* Member was previously omitted */
+                json v;
+
+                if (serialize(v, value, omit_defaults, on_error)) {
+                    j[key] = std::move(v);
+                    changed = true;
+                    written = true;
+                }
+            } else {
+                auto result = serialize_path(*jt, value, child_path, changed, omit_defaults, on_error);
+
+                member_valid = result.has_value();
+                written = result.value_or(false);
+            }
+        }
+
+        if (!written) {
+            /* Clear existing element */
+            if (jt != j.end()) {
+                j.erase(jt);
+                changed = true;
+            }
+        }
+
+        return member_valid;
+    });
+
+    if (!valid) {
+        return std::nullopt;
+    }
+
+    return !j.empty();
+}
+
+/*
+ * Incremental serialization of lazy nodes. Content that was not deserialized
+ * yet is unchanged.
+ */
+template <traits::lazy T>
+std::optional<bool> serialize_path(json &j, const T &value, std::string_view path, bool &changed,
+        bool omit_defaults, const error_func &on_error)
+{
+    if (!value.loaded()) {
+        return serialize_node(j, value, changed, omit_defaults, on_error);
+    }
+
+    return serialize_path(j, value.get(), path, changed, omit_defaults, on_error);
+}
+
+/*
+ * Incremental serialization of non-container types.
+ */
+template <traits::leaf T>
+std::optional<bool> serialize_path(json &j, const T &value, std::string_view path, bool &changed,
+        bool omit_defaults, const error_func &on_error)
+{
+    if (!path.empty()) {
+        handle_error(on_error, "unreachable path segment: '{}' ({} is not a container)", path, typestr<T>());
+        return std::nullopt;
+    }
+
+    return serialize_node(j, value, changed, omit_defaults, on_error);
+}
+
+} /* namespace jstore */
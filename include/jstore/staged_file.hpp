@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include <jstore/file_stamp.hpp>
+#include <jstore/observer.hpp>
+#include <jstore/stdio_fstream.hpp>
+
+namespace jstore {
+
+/*
+ * New file content written to a temporary file next to the file, and not yet
+ * renamed into place. The temporary file is removed on destruction, unless
+ * it was installed. Each temporary file has a unique name, so concurrent
+ * saves (e.g. by other processes) do not overwrite each other's files.
+ */
+class staged_file {
+public:
+    /*
+     * Write `data` to the temporary file for `path`. Throws on failure.
+     */
+    staged_file(const std::filesystem::path &path, const std::string &data, bool create_directories,
+            const observer_func &observer) :
+        path_(path),
+        temp_path_(temp_path(path))
+    {
+        if (create_directories) {
+            /* Ensure parent directory exists */
+            std::filesystem::create_directories(path.parent_path());
+        }
+
+        file_ = std::make_unique<stdio_fstream>(temp_path_.c_str(), std::ios_base::out);
+
+        phase_timer write_timer(observer, io_phase::WRITE, path_.native());
+        file_->write(data.data(), data.size());
+        file_->flush();
+        write_timer.stop(data.size());
+
+        if (!*file_) {
+            discard();
+            throw std::runtime_error(fmt::format("failed to write {}", path_.string()));
+        }
+    }
+
+    staged_file(staged_file &&other) noexcept :
+        path_(std::move(other.path_)),
+        temp_path_(std::exchange(other.temp_path_, {})),
+        file_(std::move(other.file_))
+    {
+    }
+
+    staged_file &operator=(staged_file &&) = delete;
+
+    ~staged_file()
+    {
+        discard();
+    }
+
+    const std::filesystem::path &path() const
+    {
+        return path_;
+    }
+
+    /*
+     * Return the descriptor of the open temporary file.
+     */
+    int fd() const
+    {
+        return file_ ? file_->fd() : -1;
+    }
+
+    /*
+     * Flush the temporary file to storage. Throws on failure.
+     */
+    void fsync(const observer_func &observer)
+    {
+        phase_timer fsync_timer(observer, io_phase::FSYNC, path_.native());
+        file_->fsync();
+        fsync_timer.stop();
+
+        if (!*file_) {
+            throw std::runtime_error(fmt::format("failed to sync {}", path_.string()));
+        }
+    }
+
+    /*
+     * Atomically replace the file with the temporary file, which must have
+     * been flushed to storage. Returns the stamp of the new file.
+     */
+    std::optional<file_stamp> install(const observer_func &observer)
+    {
+        /* Rename preserves the inode and modification time, so the stamp stays valid */
+        auto stamp = file_stamp::of(file_->fd());
+
+        file_->close();
+        file_.reset();
+
+        phase_timer rename_timer(observer, io_phase::RENAME, path_.native());
+        std::filesystem::rename(temp_path_, path_);
+        rename_timer.stop();
+
+        temp_path_.clear();
+        return stamp;
+    }
+
+    /*
+     * Close and remove the temporary file, if not installed.
+     */
+    void discard() noexcept
+    {
+        file_.reset();
+
+        if (!temp_path_.empty()) {
+            std::error_code ec;
+            std::filesystem::remove(temp_path_, ec);
+            temp_path_.clear();
+        }
+    }
+
+private:
+    /*
+     * Return a temporary file path next to `path`, unique to this process and call.
+     */
+    static std::filesystem::path temp_path(const std::filesystem::path &path)
+    {
+        static std::atomic<uint64_t> counter{0};
+
+        return fmt::format("{}.{}.{}~", path.string(), ::getpid(), counter++);
+    }
+
+    std::filesystem::path path_;
+    std::filesystem::path temp_path_;
+    std::unique_ptr<stdio_fstream> file_;
+};
+
+/*
+ * Flush a directory to storage, so renames of the files in it are durable.
+ * Throws std::system_error on failure.
+ */
+inline void fsync_directory(const std::filesystem::path &dir)
+{
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "failed to open directory");
+    }
+
+    int ret = ::fsync(fd);
+    int err = errno;
+
+    ::close(fd);
+
+    if (ret < 0) {
+        throw std::system_error(err, std::generic_category(), "failed to sync directory");
+    }
+}
+
+/*
+ * Flush the staged files to storage with as few flushes as possible. Where
+ * several files share a filesystem, the whole filesystem is flushed once
+ * with syncfs(), rather than waiting for each file in turn. Throws on
+ * failure.
+ */
+inline void fsync_files(const std::vector<staged_file *> &files, const observer_func &observer)
+{
+    std::map<dev_t, std::vector<staged_file *>> devices;
+
+    for (staged_file *file : files) {
+        struct stat st;
+
+        if (::fstat(file->fd(), &st) < 0) {
+            throw std::system_error(errno, std::generic_category(), "failed to stat file");
+        }
+
+        devices[st.st_dev].push_back(file);
+    }
+
+    for (auto &[dev, device_files] : devices) {
+#if defined(__linux__)
+        if (device_files.size() > 1) {
+            phase_timer fsync_timer(observer, io_phase::FSYNC, device_files.front()->path().native());
+
+            if (::syncfs(device_files.front()->fd()) < 0) {
+                throw std::system_error(errno, std::generic_category(), "failed to sync filesystem");
+            }
+
+            continue;
+        }
+#endif
+        for (staged_file *file : device_files) {
+            file->fsync(observer);
+        }
+    }
+}
+
+/*
+ * Flush each directory to storage.
+ */
+inline void fsync_directories(const std::set<std::filesystem::path> &dirs, const observer_func &observer)
+{
+    for (auto &dir : dirs) {
+        phase_timer fsync_timer(observer, io_phase::FSYNC, dir.native());
+        fsync_directory(dir);
+    }
+}
+
+} /* namespace jstore */
@@ -17,12 +17,23 @@
 #include <unordered_set>
 #include <map>
 #include <unordered_map>
+#include <string>
 
 #include <nlohmann/json.hpp>
 #include <visit_struct/visit_struct.hpp>
 
+namespace jstore {
+
+template <typename T> class lazy;
+
+} /* namespace jstore */
+
 namespace jstore::traits {
 
+/*
+ * Containers are matched for any allocator, so std::pmr containers (which are
+ * aliases of the standard containers) are recognized too.
+ */
 template <typename T> struct is_array                                   : std::false_type {};
 template <typename ...Ts> struct is_array<std::array<Ts...>>            : std::true_type {};
 template <typename ...Ts> struct is_array<std::vector<Ts...>>           : std::true_type {};
@@ -39,8 +50,20 @@ template <typename ...Ts> struct is_map<std::unordered_map<Ts...>>      : std::t
 template <typename T> using is_map_t = typename is_map<T>::type;
 template <typename T> inline constexpr bool is_map_v = is_map<T>::value;
 
+/* Strings with any allocator (e.g. std::pmr::string) */
+template <typename T> struct is_string                                      : std::false_type {};
+template <typename ...Ts> struct is_string<std::basic_string<char, Ts...>>  : std::true_type {};
+template <typename T> using is_string_t = typename is_string<T>::type;
+template <typename T> inline constexpr bool is_string_v = is_string<T>::value;
+
+/* Nodes deserialized on first access (see lazy.hpp) */
+template <typename T> struct is_lazy                                    : std::false_type {};
+template <typename T> struct is_lazy<jstore::lazy<T>>                   : std::true_type {};
+template <typename T> using is_lazy_t = typename is_lazy<T>::type;
+template <typename T> inline constexpr bool is_lazy_v = is_lazy<T>::value;
+
 template <typename T>
-struct is_container : std::disjunction<is_array<T>, is_map<T>, visit_struct::traits::is_visitable<T>> {};
+struct is_container : std::disjunction<is_array<T>, is_map<T>, visit_struct::traits::is_visitable<T>, is_lazy<T>> {};
 template <typename T> using is_container_t = typename is_container<T>::type;
 template <typename T> inline constexpr bool is_container_v = is_container<T>::value;
 
@@ -50,17 +73,31 @@ concept array = is_array_v<std::decay_t<T>>;
 template <typename T>
 concept map = is_map_v<std::decay_t<T>>;
 
+/*
+ * Map keys serialized as JSON object keys, and used as-is in paths.
+ */
 template <typename T>
-concept convertible_map = map<T> &&
-        std::is_convertible_v<typename T::key_type, nlohmann::json::object_t::key_type>;
+concept string_key = is_string_v<std::decay_t<T>> ||
+        std::is_convertible_v<T, nlohmann::json::object_t::key_type>;
+
+/*
+ * Map keys constructed from path segments as-is, rather than parsed.
+ */
+template <typename T>
+concept path_string_key = is_string_v<std::decay_t<T>> || std::is_convertible_v<std::string, T>;
 
 template <typename T>
-concept not_convertible_map = map<T> &&
-        !std::is_convertible_v<typename T::key_type, nlohmann::json::object_t::key_type>;
+concept convertible_map = map<T> && string_key<typename T::key_type>;
+
+template <typename T>
+concept not_convertible_map = map<T> && !string_key<typename T::key_type>;
 
 template <typename T>
 concept visitable = visit_struct::traits::is_visitable<std::decay_t<T>>::value;
 
+template <typename T>
+concept lazy = is_lazy_v<std::decay_t<T>>;
+
 template <typename T>
 concept container = is_container_v<std::decay_t<T>>;
 
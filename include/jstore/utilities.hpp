@@ -9,9 +9,13 @@
 
 #include <functional>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 #include <fmt/core.h>
 
+#include <jstore/traits.hpp>
+
 namespace jstore {
 
 /*
@@ -19,6 +23,36 @@ namespace jstore {
  */
 using error_func = std::function<void(std::string &&)>;
 
+/*
+ * Construct a map key from a path segment or JSON object key (see
+ * traits::path_string_key).
+ */
+template <typename Key>
+Key make_key(std::string_view str)
+{
+    if constexpr (std::is_constructible_v<Key, std::string_view>) {
+        return Key(str);
+    } else {
+        return Key(std::string{str});
+    }
+}
+
+/*
+ * Return a map key as a JSON object key (see traits::string_key). Keys that
+ * are not a std::string are copied.
+ */
+template <typename Key>
+decltype(auto) json_key(const Key &key)
+{
+    if constexpr (std::is_same_v<Key, std::string>) {
+        return (key);
+    } else if constexpr (traits::is_string_v<Key>) {
+        return std::string(key.data(), key.size());
+    } else {
+        return std::string(key);
+    }
+}
+
 /*
  * If valid, invoke `func` with a formatted error message.
  */
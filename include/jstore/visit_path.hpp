@@ -9,6 +9,7 @@
 
 #include <charconv>
 #include <concepts>
+#include <istream>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -17,6 +18,7 @@
 
 #include <visit_struct/visit_struct.hpp>
 
+#include <jstore/members.hpp>
 #include <jstore/serialization.hpp>
 #include <jstore/traits.hpp>
 #include <jstore/utilities.hpp>
@@ -36,6 +38,76 @@ inline std::pair<std::string_view, std::string_view> split_path(std::string_view
     };
 }
 
+/*
+ * True for character types, which are formatted as characters rather than
+ * numbers.
+ */
+template <typename T>
+inline constexpr bool is_char_v = std::is_same_v<T, char> || std::is_same_v<T, signed char> ||
+        std::is_same_v<T, unsigned char>;
+
+/*
+ * Parser for path segments identifying non-string map keys.
+ *
+ * Arithmetic keys, and enum keys without a stream extraction operator, are
+ * parsed with std::from_chars. Other keys, including character keys (which
+ * are formatted as characters in paths), are parsed with operator>>.
+ * Specialize key_parser to provide a faster parser for a user-defined key type.
+ */
+template <typename Key>
+struct key_parser {
+    static bool parse(std::string_view str, Key &key)
+    {
+        if constexpr (std::is_same_v<Key, bool>) {
+            /* Consistent with stream extraction without std::boolalpha */
+            if (str != "0" && str != "1") {
+                return false;
+            }
+
+            key = (str == "1");
+            return true;
+        } else if constexpr (std::is_arithmetic_v<Key> && !is_char_v<Key>) {
+            auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), key);
+
+            return ec == std::errc{} && ptr == str.data() + str.size();
+        } else if constexpr (std::is_enum_v<Key> && !requires (std::istream &is, Key &k) { is >> k; }) {
+            std::underlying_type_t<Key> value{};
+
+            if (!key_parser<std::underlying_type_t<Key>>::parse(str, value)) {
+                return false;
+            }
+
+            key = static_cast<Key>(value);
+            return true;
+        } else {
+            std::istringstream ss{std::string{str}};
+
+            ss >> key;
+
+            /* The whole segment must be consumed (extracting a character does not set eof) */
+            return !ss.fail() && ss.peek() == std::istringstream::traits_type::eof();
+        }
+    }
+};
+
+/*
+ * Parse a path segment into a non-string map key.
+ */
+template <typename Key>
+bool parse_key(std::string_view str, Key &key)
+{
+    return key_parser<Key>::parse(str, key);
+}
+
+/*
+ * True if the map supports lookup by std::string_view (i.e. it has a
+ * transparent comparator, or transparent hash and equality functions).
+ */
+template <typename T>
+concept transparent_map = traits::map<T> && (
+        requires { typename T::key_compare::is_transparent; } ||
+        requires { typename T::hasher::is_transparent; typename T::key_equal::is_transparent; });
+
 
 /*
  * Visit path forward declarations
@@ -46,6 +118,8 @@ template <traits::map T, typename Func>
 bool visit_path(T &container, std::string_view path, const Func &func, bool insert_keys = false, const error_func &on_error = {});
 template <traits::visitable T, typename Func>
 bool visit_path(T &container, std::string_view path, const Func &func, bool insert_keys = false, const error_func &on_error = {});
+template <traits::lazy T, typename Func>
+bool visit_path(T &value, std::string_view path, const Func &func, bool insert_keys = false, const error_func &on_error = {});
 template <traits::leaf T, typename Func>
 bool visit_path(T &value, std::string_view path, const Func &func, bool insert_keys = false, const error_func &on_error = {});
 
@@ -109,21 +183,25 @@ bool visit_path(T &container, std::string_view path, const Func &func, bool inse
         return false;
     }
 
-    if constexpr (std::is_convertible_v<std::string, key_type>) {
+    if constexpr (transparent_map<T> && traits::path_string_key<key_type>) {
+        /* Look up without constructing a key string; only allocate on insertion */
+        it = container.find(key);
+
+        if (it == container.end() && insert_keys) {
+            it = container.try_emplace(make_key<key_type>(key)).first;
+        }
+    } else if constexpr (traits::path_string_key<key_type>) {
         /* Key is compatible with string */
         if (insert_keys) {
-            it = container.try_emplace(std::string{key}).first;
+            it = container.try_emplace(make_key<key_type>(key)).first;
         } else {
-            it = container.find(std::string{key});
+            it = container.find(make_key<key_type>(key));
         }
     } else {
         /* Key is not string-like; must parse */
-        std::istringstream ss{std::string{key}};
         key_type key_value{};
 
-        ss >> key_value;
-
-        if (ss.fail() || !ss.eof()) {
+        if (!parse_key(key, key_value)) {
             handle_error(on_error, "malformed map key in path segment: '{}'", key);
             return false;
         }
@@ -156,19 +234,27 @@ bool visit_path(T &container, std::string_view path, const Func &func, bool inse
         return true;
     }
 
+    using type = std::remove_cvref_t<T>;
     auto [member, child_path] = split_path(path);
-    bool found = false;
-    bool result = false;
-
-    /* If specified struct member is present, recurse */
-    visit_struct::for_each(container, [&](const char *key, auto &value) {
-        if (!found && member == key) {
-            found = true;
-            result = visit_path(value, child_path, func, insert_keys, on_error);
-        }
+    auto index = find_member<type>(member);
+
+    if (!index.has_value()) {
+        return false;
+    }
+
+    /* Specified struct member is present: recurse */
+    return dispatch_member<type>(index.value(), [&]<size_t I>(std::integral_constant<size_t, I>) {
+        return visit_path(visit_struct::get<static_cast<int>(I)>(container), child_path, func, insert_keys, on_error);
     });
+}
 
-    return result;
+/*
+ * Visit path for lazy nodes, which are deserialized to be visited.
+ */
+template <traits::lazy T, typename Func>
+bool visit_path(T &value, std::string_view path, const Func &func, bool insert_keys, const error_func &on_error)
+{
+    return visit_path(value.get(), path, func, insert_keys, on_error);
 }
 
 /*
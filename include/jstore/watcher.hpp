@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace jstore {
+
+/*
+ * Watches files for changes using inotify, and invokes a callback on a
+ * background thread after each batch of changes.
+ *
+ * Directories are watched, rather than files, so that files replaced by
+ * rename are detected. A change is reported when a watched name in a
+ * watched directory is created, renamed into place, closed after writing,
+ * or removed. Temporary files (names ending with '~') are ignored. If the
+ * event queue overflows, a change is reported.
+ * Directories that do not exist yet are watched once they are created.
+ */
+class file_watcher {
+public:
+    using change_func = std::function<void()>;
+
+    struct target {
+        std::filesystem::path dir;
+
+        /* Names of the watched files in the directory (empty for all files) */
+        std::set<std::string> names;
+    };
+
+    /*
+     * Start watching. Throws std::system_error on failure.
+     */
+    file_watcher(std::vector<target> targets, change_func on_change) :
+        on_change_(std::move(on_change))
+    {
+        for (auto &t : targets) {
+            watches_.push_back({ std::move(t), -1 });
+        }
+
+        inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), "failed to initialize inotify");
+        }
+
+        wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd_ < 0) {
+            int err = errno;
+            ::close(inotify_fd_);
+            throw std::system_error(err, std::generic_category(), "failed to create eventfd");
+        }
+
+        add_watches();
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    file_watcher(const file_watcher &) = delete;
+    file_watcher &operator=(const file_watcher &) = delete;
+
+    /*
+     * Stop watching. Waits for a callback in progress to return.
+     */
+    ~file_watcher()
+    {
+        uint64_t value = 1;
+
+        [[maybe_unused]] auto ret = ::write(wake_fd_, &value, sizeof(value));
+        thread_.join();
+
+        ::close(wake_fd_);
+        ::close(inotify_fd_);
+    }
+
+private:
+    static constexpr uint32_t EVENTS = IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM;
+    static constexpr int RETRY_MS = 1000;
+
+    struct watch {
+        target t;
+        int wd;
+    };
+
+    /*
+     * Add watches for directories that are not watched yet. Returns true if
+     * any were added.
+     */
+    bool add_watches()
+    {
+        bool added = false;
+
+        for (auto &w : watches_) {
+            if (w.wd < 0) {
+                w.wd = ::inotify_add_watch(inotify_fd_, w.t.dir.c_str(), EVENTS | IN_ONLYDIR);
+                added |= (w.wd >= 0);
+            }
+        }
+
+        return added;
+    }
+
+    /*
+     * Return true if the event concerns a watched file.
+     */
+    bool relevant(const struct inotify_event &event)
+    {
+        if (event.mask & IN_Q_OVERFLOW) {
+            /* Events were dropped, so any file may have changed */
+            return true;
+        }
+
+        for (auto &w : watches_) {
+            if (w.wd != event.wd) {
+                continue;
+            }
+
+            if (event.mask & IN_IGNORED) {
+                /* Directory was removed */
+                w.wd = -1;
+                return true;
+            }
+
+            if (event.len == 0) {
+                return false;
+            }
+
+            std::string name{event.name};
+
+            if (name.ends_with('~')) {
+                return false;
+            }
+
+            return w.t.names.empty() || w.t.names.contains(name);
+        }
+
+        return false;
+    }
+
+    void run()
+    {
+        alignas(struct inotify_event) char buf[4096];
+
+        while (true) {
+            struct pollfd fds[] = {
+                { inotify_fd_, POLLIN, 0 },
+                { wake_fd_, POLLIN, 0 }
+            };
+
+            /* Directories that do not exist yet are retried periodically */
+            int timeout = std::all_of(watches_.begin(), watches_.end(), [](auto &w) { return w.wd >= 0; }) ? -1 : RETRY_MS;
+
+            if (::poll(fds, 2, timeout) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+
+            if (fds[1].revents) {
+                return;
+            }
+
+            bool changed = false;
+
+            /* Drain all queued events, so a burst of changes is reported once */
+            while (true) {
+                ssize_t len = ::read(inotify_fd_, buf, sizeof(buf));
+
+                if (len <= 0) {
+                    break;
+                }
+
+                for (char *p = buf; p < buf + len; ) {
+                    auto *event = reinterpret_cast<struct inotify_event *>(p);
+
+                    changed |= relevant(*event);
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+
+            /* Directories created meanwhile may already hold files */
+            changed |= add_watches();
+
+            if (changed) {
+                on_change_();
+            }
+        }
+    }
+
+    change_func on_change_;
+    std::vector<watch> watches_;
+    int inotify_fd_ = -1;
+    int wake_fd_ = -1;
+    std::thread thread_;
+};
+
+} /* namespace jstore */
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace jstore {
+
+/*
+ * Background worker thread that runs the most recently submitted job.
+ *
+ * A submitted job is run once `delay` has elapsed since the first pending
+ * submission. Jobs submitted in the meantime replace the pending job, so a
+ * burst of submissions results in a single run. All coalesced submissions
+ * share a future, which completes when the job that replaced them has run.
+ * Errors are only reported through the futures of jobs that were pending or
+ * running when the future was obtained.
+ *
+ * Pending jobs are run before the worker is destroyed.
+ */
+class coalescing_worker {
+public:
+    using job_func = std::function<void()>;
+    using clock = std::chrono::steady_clock;
+
+    explicit coalescing_worker(clock::duration delay = {}) :
+        delay_(delay),
+        thread_([this]() { run(); })
+    {
+    }
+
+    coalescing_worker(const coalescing_worker &) = delete;
+    coalescing_worker &operator=(const coalescing_worker &) = delete;
+
+    ~coalescing_worker()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+
+        cond_.notify_all();
+        thread_.join();
+    }
+
+    /*
+     * Replace the pending job. If `immediate` is set, the job is run without
+     * waiting for the delay to elapse.
+     */
+    std::shared_future<void> submit(job_func job, bool immediate = false)
+    {
+        std::lock_guard lock(mutex_);
+
+        if (!job_) {
+            promise_ = std::promise<void>{};
+            future_ = promise_.get_future().share();
+            deadline_ = clock::now() + delay_;
+        }
+
+        job_ = std::move(job);
+
+        if (immediate) {
+            deadline_ = clock::now();
+        }
+
+        cond_.notify_all();
+        return future_;
+    }
+
+    /*
+     * Run the pending job immediately, and wait for all submitted jobs to
+     * complete. Returns the future of the job waited for (see future()).
+     */
+    std::shared_future<void> flush()
+    {
+        std::shared_future<void> future;
+
+        {
+            std::lock_guard lock(mutex_);
+
+            if (job_) {
+                deadline_ = clock::now();
+                cond_.notify_all();
+            }
+
+            future = current_future();
+        }
+
+        future.wait();
+        return future;
+    }
+
+    /*
+     * Return the future of the pending or running job, or a ready future if
+     * all submitted jobs have completed.
+     */
+    std::shared_future<void> future()
+    {
+        std::lock_guard lock(mutex_);
+
+        return current_future();
+    }
+
+private:
+    std::shared_future<void> current_future()
+    {
+        if (!future_.valid()) {
+            std::promise<void> promise;
+
+            promise.set_value();
+            return promise.get_future().share();
+        }
+
+        return future_;
+    }
+
+    void run()
+    {
+        std::unique_lock lock(mutex_);
+
+        while (true) {
+            if (!job_) {
+                if (stop_) {
+                    break;
+                }
+
+                cond_.wait(lock);
+                continue;
+            }
+
+            if (!stop_ && clock::now() < deadline_) {
+                cond_.wait_until(lock, deadline_);
+                continue;
+            }
+
+            job_func job = std::move(job_);
+            std::promise<void> promise = std::move(promise_);
+            std::exception_ptr error;
+
+            job_ = nullptr;
+            lock.unlock();
+
+            try {
+                job();
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+
+            /*
+             * Completed; unless replaced by a new submission, the error is not reported again.
+             * Reset before completing the promise, so waiters never see the completed future.
+             */
+            if (!job_) {
+                future_ = {};
+            }
+
+            if (error) {
+                promise.set_exception(error);
+            } else {
+                promise.set_value();
+            }
+        }
+    }
+
+    const clock::duration delay_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    job_func job_;
+    std::promise<void> promise_;
+    std::shared_future<void> future_;
+    clock::time_point deadline_;
+    bool stop_ = false;
+
+    /* Started last, after all other members are initialized */
+    std::thread thread_;
+};
+
+} /* namespace jstore */
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2024 David Leeds <davidesleeds@gmail.com>
+ *
+ * jstore is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <concepts>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <visit_struct/visit_struct.hpp>
+
+#include <jstore/defaults.hpp>
+#include <jstore/members.hpp>
+#include <jstore/serialization.hpp>
+#include <jstore/traits.hpp>
+#include <jstore/utilities.hpp>
+
+namespace jstore {
+
+using json = nlohmann::json;
+
+/*
+ * Streaming JSON text writer.
+ *
+ * Appends the serialization of a value directly to a string, without
+ * building an intermediate nlohmann::json tree for containers. The output
+ * is identical to serialize() followed by json::dump(), so object keys are
+ * written in sorted order. Leaf values are still converted by their
+ * nlohmann::json serializer.
+ *
+ * Returns false if the value has no serialized content (see serialize()).
+ */
+template <traits::array T>
+bool write_json(std::string &out, const T &container, bool omit_defaults = false, const error_func &on_error = {});
+template <traits::convertible_map T>
+bool write_json(std::string &out, const T &container, bool omit_defaults = false, const error_func &on_error = {});
+template <traits::not_convertible_map T>
+bool write_json(std::string &out, const T &container, bool omit_defaults = false, const error_func &on_error = {});
+template <traits::visitable T>
+bool write_json(std::string &out, const T &container, bool omit_defaults = false, const error_func &on_error = {});
+template <traits::lazy T>
+bool write_json(std::string &out, const T &value, bool omit_defaults = false, const error_func &on_error = {});
+template <traits::leaf T>
+bool write_json(std::string &out, const T &value, bool omit_defaults = false, const error_func &on_error = {});
+
+
+/*
+ * Write a quoted string. Strings that need escaping, or that may not be
+ * valid UTF-8, are written by the json string serializer.
+ */
+inline void write_string(std::string &out, std::string_view str)
+{
+    bool plain = std::all_of(str.begin(), str.end(), [](char c) {
+        return c >= 0x20 && c < 0x7f && c != '"' && c != '\\';
+    });
+
+    if (plain) {
+        out += '"';
+        out += str;
+        out += '"';
+    } else {
+        out += json(str).dump();
+    }
+}
+
+/*
+ * True if iterating the map visits keys in json object key order.
+ */
+template <typename T>
+inline constexpr bool in_key_order = false;
+template <typename V, typename A>
+inline constexpr bool in_key_order<std::map<std::string, V, std::less<std::string>, A>> = true;
+template <typename V, typename A>
+inline constexpr bool in_key_order<std::map<std::string, V, std::less<>, A>> = true;
+
+/*
+ * Write an object key.
+ */
+inline void write_key(std::string &out, std::string_view key)
+{
+    write_string(out, key);
+    out += ':';
+}
+
+/*
+ * Write an array-like type.
+ */
+template <traits::array T>
+bool write_json(std::string &out, const T &container, bool omit_defaults, const error_func &on_error)
+{
+    bool first = true;
+
+    out += '[';
+
+    for (auto &value : container) {
+        if (!first) {
+            out += ',';
+        }
+
+        write_json(out, value, omit_defaults, on_error);
+        first = false;
+    }
+
+    out += ']';
+    return !first;
+}
+
+/*
+ * Write a map-like type with string keys.
+ */
+template <traits::convertible_map T>
+bool write_json(std::string &out, const T &container, bool omit_defaults, const error_func &on_error)
+{
+    bool first = true;
+
+    auto write_entry = [&](std::string_view key, const auto &value) {
+        if (!first) {
+            out += ',';
+        }
+
+        write_key(out, key);
+        write_json(out, value, omit_defaults, on_error);
+        first = false;
+    };
+
+    out += '{';
+
+    if constexpr (in_key_order<T>) {
+        /* Already in json object key order */
+        for (auto &[key, value] : container) {
+            write_entry(json_key(key), value);
+        }
+    } else {
+        /* Sort keys to match json object key order (the last duplicate key wins) */
+        std::vector<std::pair<std::string, const typename T::mapped_type *>> entries;
+
+        entries.reserve(container.size());
+        for (auto &[key, value] : container) {
+            entries.emplace_back(json_key(key), &value);
+        }
+
+        std::stable_sort(entries.begin(), entries.end(), [](auto &a, auto &b) {
+            return a.first < b.first;
+        });
+
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (std::next(it) == entries.end() || std::next(it)->first != it->first) {
+                write_entry(it->first, *it->second);
+            }
+        }
+    }
+
+    out += '}';
+    return !first;
+}
+
+/*
+ * Write a map-like type with non-string keys.
+ */
+template <traits::not_convertible_map T>
+bool write_json(std::string &out, const T &container, bool omit_defaults, const error_func &on_error)
+{
+    bool first = true;
+
+    out += '[';
+
+    for (auto &[key, value] : container) {
+        size_t mark = out.size();
+
+        if (!first) {
+            out += ',';
+        }
+
+        out += '[';
+
+        if (!write_json(out, key, false, on_error)) {
+            /* Skip entries with keys that cannot be serialized */
+            out.resize(mark);
+            continue;
+        }
+
+        out += ',';
+        write_json(out, value, omit_defaults, on_error);
+        out += ']';
+        first = false;
+    }
+
+    out += ']';
+    return !first;
+}
+
+/*
+ * Write a visitable struct.
+ *
+ * Members are written in name order. Members without serialized content,
+ * and default values if `omit_defaults` is set, are not written.
+ */
+template <traits::visitable T>
+bool write_json(std::string &out, const T &container, bool omit_defaults, const error_func &on_error)
+{
+    bool first = true;
+
+    auto write_member = [&]<size_t I>(std::integral_constant<size_t, I>) {
+        const auto &value = visit_struct::get<static_cast<int>(I)>(container);
+
+        using member_type = decltype(value);
+        static_assert(std::equality_comparable<member_type>, "members of visitable_structs must be equality comparable");
+
+        if (omit_defaults && is_default_member<I>(container)) {
+            return;
+        }
+
+        size_t mark = out.size();
+
+        if (!first) {
+            out += ',';
+        }
+
+        write_key(out, member_names<T>[I]);
+
+        if (write_json(out, value, omit_defaults, on_error)) {
+            first = false;
+        } else {
+            out.resize(mark);
+        }
+    };
+
+    out += '{';
+
+    [&]<size_t ...I>(std::index_sequence<I...>) {
+        (write_member(std::integral_constant<size_t, sorted_members<T>[I]>{}), ...);
+    }(std::make_index_sequence<member_count<T>>{});
+
+    out += '}';
+    return !first;
+}
+
+/*
+ * Write a lazy node. Content that was not deserialized yet is written as-is.
+ */
+template <traits::lazy T>
+bool write_json(std::string &out, const T &value, bool omit_defaults, const error_func &on_error)
+{
+    bool populated = true;
+
+    bool raw = value.visit_raw([&out, &populated](const json &j) {
+        out += j.dump();
+
+        if constexpr (traits::container<typename T::value_type>) {
+            populated = !j.empty();
+        }
+    });
+
+    if (!raw) {
+        return write_json(out, value.get(), omit_defaults, on_error);
+    }
+
+    return populated;
+}
+
+/*
+ * Write a leaf node.
+ *
+ * Booleans and integers are formatted directly. Other types are converted by
+ * their nlohmann::json serializer (`void to_json(json &, const T &)` MUST be
+ * defined for type T).
+ */
+template <traits::leaf T>
+bool write_json(std::string &out, const T &value, bool omit_defaults, const error_func &on_error)
+{
+    if constexpr (std::is_same_v<T, bool>) {
+        out += value ? "true" : "false";
+    } else if constexpr (std::is_integral_v<T>) {
+        char buf[24];
+        auto [ptr, ec] = std::to_chars(std::begin(buf), std::end(buf), value);
+
+        out.append(buf, ptr);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        write_string(out, value);
+    } else {
+        json j;
+        bool populated = serialize(j, value, omit_defaults, on_error);
+
+        out += j.dump();
+        return populated;
+    }
+
+    return true;
+}
+
+/*
+ * Return the JSON text serialization of a value.
+ * Equivalent to serialize() followed by json::dump().
+ */
+template <typename T>
+std::string dump_json(const T &value, bool omit_defaults = false, const error_func &on_error = {})
+{
+    std::string out;
+
+    write_json(out, value, omit_defaults, on_error);
+    return out;
+}
+
+} /* namespace jstore */
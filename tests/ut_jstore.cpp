@@ -7,8 +7,14 @@
 
 #include <jstore.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <iostream>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
 
 #include <catch2/catch_test_macros.hpp>
 
@@ -56,10 +62,74 @@ struct visitable {
     bool operator==(const visitable &) const = default;
 };
 
+enum class color { RED, GREEN };
+
 } /* namespace test */
 
 VISITABLE_STRUCT(test::visitable, b, s, i, j, m);
 
+namespace test {
+
+/*
+ * Visitable struct with constant expression defaults
+ */
+struct constants {
+    int i                   = 7;
+    color c                 = color::GREEN;
+    string s                = "string";
+    vector<int> v;
+    vector<int> w           = { 1, 2 };
+
+    bool operator==(const constants &) const = default;
+};
+
+} /* namespace test */
+
+VISITABLE_STRUCT(test::constants, i, c, s, v, w);
+
+namespace test {
+
+/*
+ * Visitable struct with members deserialized on first access
+ */
+struct deferred {
+    string s                            = "string";
+    jstore::lazy<map<string, int>> m;
+    jstore::lazy<visitable> v;
+
+    bool operator==(const deferred &) const = default;
+};
+
+} /* namespace test */
+
+VISITABLE_STRUCT(test::deferred, s, m, v);
+
+namespace test {
+
+/*
+ * Map key type with a user-defined path parser
+ */
+struct point {
+    int x;
+    int y;
+
+    auto operator<=>(const point &) const = default;
+};
+
+} /* namespace test */
+
+template <>
+struct jstore::key_parser<test::point> {
+    static bool parse(std::string_view str, test::point &key)
+    {
+        auto comma = str.find(',');
+
+        return comma != string_view::npos &&
+               jstore::parse_key(str.substr(0, comma), key.x) &&
+               jstore::parse_key(str.substr(comma + 1), key.y);
+    }
+};
+
 
 /*
  * Error callback.
@@ -267,6 +337,307 @@ TEST_CASE("jstore::for_each", "[jstore]")
 } /* for_each */
 
 
+TEST_CASE("jstore::for_each_lazy", "[jstore]")
+{
+    SECTION("matches for_each() paths")
+    {
+        map<string, vector<test::visitable>> m;
+        map<int, list<string>> n = { { 1, { "a", "b" } }, { 2, {} } };
+
+        m["a"].resize(2);
+        m["b"].resize(1);
+
+        auto check = [&]<jstore::traversal Traversal>(auto &container) {
+            vector<string> paths;
+            vector<string> lazy_paths;
+
+            jstore::for_each<Traversal>(container, [&](const string &path, const auto &) {
+                paths.push_back(path);
+            });
+
+            jstore::for_each_lazy<Traversal>(container, [&](const jstore::lazy_path &path, const auto &) {
+                REQUIRE(path.empty() == path.str().empty());
+                lazy_paths.push_back(path.str());
+            });
+
+            REQUIRE_FALSE(paths.empty());
+            REQUIRE(lazy_paths == paths);
+        };
+
+        check.operator()<jstore::LEAF>(m);
+        check.operator()<jstore::NON_LEAF>(m);
+        check.operator()<jstore::ALL>(m);
+        check.operator()<jstore::LEAF>(n);
+        check.operator()<jstore::ALL>(n);
+    }
+
+    SECTION("segments")
+    {
+        test::visitable v;
+        size_t count = 0;
+
+        jstore::for_each_lazy<jstore::ALL>(v, [&](const jstore::lazy_path &path, const auto &value) {
+            using value_type = decay_t<decltype(value)>;
+
+            if constexpr (is_same_v<value_type, test::visitable>) {
+                REQUIRE(path.size() == 0);
+                REQUIRE(path == "");
+            } else if (static_cast<const void *>(&value) == &v.m.at("y")) {
+                REQUIRE(path.size() == 2);
+                REQUIRE(path == "m/y");
+
+                string out = "prefix:";
+                path.append_to(out);
+                REQUIRE(out == "prefix:m/y");
+            }
+            ++count;
+        });
+
+        REQUIRE(count == 8);
+    }
+
+    SECTION("modify values")
+    {
+        map<string, int> m = { { "x", 1 }, { "y", 2 } };
+
+        jstore::for_each_lazy<jstore::LEAF>(m, [](const string &path, auto &value) {
+            value += (path == "x") ? 10 : 20;
+        });
+
+        REQUIRE(m == map<string, int>{ { "x", 11 }, { "y", 22 } });
+    }
+}
+
+
+TEST_CASE("jstore::path_to", "[jstore]")
+{
+    SECTION("root")
+    {
+        test::visitable v;
+
+        REQUIRE(jstore::path_to(v, v) == "");
+        REQUIRE(jstore::path_to(v.i, v.i) == "");
+    }
+
+    SECTION("nodes not in the tree")
+    {
+        test::visitable v;
+        test::visitable other;
+        int n = 0;
+
+        REQUIRE_FALSE(jstore::path_to(v, other).has_value());
+        REQUIRE_FALSE(jstore::path_to(v, other.i).has_value());
+        REQUIRE_FALSE(jstore::path_to(v, n).has_value());
+        REQUIRE_FALSE(jstore::path_to(v, other.m.at("x")).has_value());
+
+        /* Node type does not occur in the tree */
+        double d = 0;
+        REQUIRE_FALSE(jstore::path_to(v, d).has_value());
+    }
+
+    SECTION("visitable struct")
+    {
+        test::visitable v;
+
+        REQUIRE(jstore::path_to(v, v.b) == "b");
+        REQUIRE(jstore::path_to(v, v.s) == "s");
+        REQUIRE(jstore::path_to(v, v.i) == "i");
+        REQUIRE(jstore::path_to(v, v.j) == "j");
+        REQUIRE(jstore::path_to(v, v.m) == "m");
+        REQUIRE(jstore::path_to(v, v.m.at("y")) == "m/y");
+    }
+
+    SECTION("contiguous arrays")
+    {
+        vector<int> a = { 1, 2, 3 };
+        vector<vector<int>> aa = { { 1, 2, 3 }, { 4, 5, 6 } };
+
+        REQUIRE(jstore::path_to(a, a[0]) == "0");
+        REQUIRE(jstore::path_to(a, a[2]) == "2");
+        REQUIRE(jstore::path_to(aa, aa[1]) == "1");
+        REQUIRE(jstore::path_to(aa, aa[1][2]) == "1/2");
+        REQUIRE(jstore::path_to(aa, aa[0][0]) == "0/0");
+        REQUIRE_FALSE(jstore::path_to(aa, a[0]).has_value());
+
+        vector<int> empty;
+        REQUIRE_FALSE(jstore::path_to(empty, a[0]).has_value());
+    }
+
+    SECTION("nested containers")
+    {
+        map<string, vector<test::visitable>> m;
+
+        m["a"].resize(2);
+        m["b"].resize(3);
+        m["b"][2].m["z"] = 5;
+
+        REQUIRE(jstore::path_to(m, m["a"]) == "a");
+        REQUIRE(jstore::path_to(m, m["b"][1]) == "b/1");
+        REQUIRE(jstore::path_to(m, m["b"][2].s) == "b/2/s");
+        REQUIRE(jstore::path_to(m, m["b"][2].m["z"]) == "b/2/m/z");
+
+        list<map<int, int>> l = { { { 1, 10 } }, { { 2, 20 }, { 3, 30 } } };
+
+        REQUIRE(jstore::path_to(l, l.back().at(3)) == "1/3");
+    }
+
+    SECTION("matches for_each() paths")
+    {
+        map<string, vector<test::visitable>> m;
+        size_t count = 0;
+
+        m["a"].resize(2);
+        m["b"].resize(1);
+
+        jstore::for_each<jstore::ALL>(m, [&](const string &path, const auto &node) {
+            REQUIRE(jstore::path_to(m, node) == path);
+            ++count;
+        });
+
+        REQUIRE(count > 20);
+    }
+}
+
+
+TEST_CASE("jstore::members", "[jstore]")
+{
+    STATIC_REQUIRE(jstore::member_count<test::visitable> == 5);
+    STATIC_REQUIRE(jstore::member_names<test::visitable>[1] == "s");
+    STATIC_REQUIRE(jstore::sorted_members<test::visitable> == array<size_t, 5>{ 0, 2, 3, 4, 1 });
+
+    SECTION("find_member")
+    {
+        STATIC_REQUIRE(jstore::find_member<test::visitable>("b") == 0);
+        STATIC_REQUIRE(jstore::find_member<test::visitable>("m") == 4);
+        STATIC_REQUIRE(jstore::find_member<test::visitable>("s") == 1);
+        STATIC_REQUIRE_FALSE(jstore::find_member<test::visitable>("").has_value());
+        STATIC_REQUIRE_FALSE(jstore::find_member<test::visitable>("a").has_value());
+        STATIC_REQUIRE_FALSE(jstore::find_member<test::visitable>("n").has_value());
+        STATIC_REQUIRE_FALSE(jstore::find_member<test::visitable>("z").has_value());
+        STATIC_REQUIRE_FALSE(jstore::find_member<test::visitable>("bb").has_value());
+    }
+
+    SECTION("member hash table")
+    {
+        STATIC_REQUIRE(jstore::member_hash("") == 2166136261u);
+        STATIC_REQUIRE(jstore::member_hash("a") == 0xe40c292cu);
+        STATIC_REQUIRE(jstore::member_hashes<test::visitable>[1] == jstore::member_hash("s"));
+        STATIC_REQUIRE(jstore::member_table<test::visitable>.size() == 16);
+        STATIC_REQUIRE(jstore::member_table<test::constants>.size() == 16);
+
+        /* Each member occupies one slot */
+        size_t used = 0;
+
+        for (size_t slot : jstore::member_table<test::visitable>) {
+            used += slot != 0;
+        }
+        REQUIRE(used == jstore::member_count<test::visitable>);
+    }
+
+    SECTION("dispatch_member")
+    {
+        test::visitable v;
+
+        for (size_t i = 0; i < jstore::member_count<test::visitable>; ++i) {
+            auto name = jstore::dispatch_member<test::visitable>(i, []<size_t I>(integral_constant<size_t, I>) {
+                return jstore::member_names<test::visitable>[I];
+            });
+
+            REQUIRE(name == jstore::member_names<test::visitable>[i]);
+        }
+
+        jstore::dispatch_member<test::visitable>(2, [&v](auto index) {
+            auto &member = visit_struct::get<static_cast<int>(decltype(index)::value)>(v);
+
+            if constexpr (is_same_v<decay_t<decltype(member)>, int>) {
+                member = 123;
+            }
+        });
+        REQUIRE(v.i == 123);
+    }
+}
+
+
+TEST_CASE("jstore::defaults", "[jstore]")
+{
+    SECTION("shared default instance")
+    {
+        REQUIRE(&jstore::default_value<test::visitable>() == &jstore::default_value<test::visitable>());
+        REQUIRE(jstore::default_value<test::visitable>() == test::visitable{});
+        REQUIRE(jstore::default_member<2, test::visitable>() == 99);
+    }
+
+    SECTION("constant defaults")
+    {
+        STATIC_REQUIRE(jstore::has_constant_default<test::constants, 0>);
+        STATIC_REQUIRE(jstore::has_constant_default<test::constants, 1>);
+        STATIC_REQUIRE(!jstore::has_constant_default<test::constants, 2>); /* not a structural type */
+        STATIC_REQUIRE(!jstore::has_constant_default<test::visitable, 2>); /* json member is not a literal type */
+    }
+
+    SECTION("empty defaults")
+    {
+        STATIC_REQUIRE(jstore::has_empty_check<test::constants, 2>);
+        STATIC_REQUIRE(jstore::has_empty_check<test::constants, 3>);
+        STATIC_REQUIRE(!jstore::has_empty_check<test::constants, 0>);
+        STATIC_REQUIRE(jstore::has_empty_check<test::visitable, 4>);
+        STATIC_REQUIRE(!jstore::has_empty_check<test::visitable, 3>); /* null json is not the only empty value */
+
+        REQUIRE(jstore::empty_defaults<test::constants>() == array<bool, 5>{ false, false, false, true, false });
+    }
+
+    SECTION("is_default_member")
+    {
+        test::constants c;
+
+        REQUIRE(jstore::is_default_member<0>(c));
+        REQUIRE(jstore::is_default_member<1>(c));
+        REQUIRE(jstore::is_default_member<2>(c));
+        REQUIRE(jstore::is_default_member<3>(c));
+        REQUIRE(jstore::is_default_member<4>(c));
+
+        c.i = 8;
+        c.c = test::color::RED;
+        c.s.clear();
+        c.v.push_back(1);
+        c.w.at(0) = 2;
+
+        REQUIRE(!jstore::is_default_member<0>(c));
+        REQUIRE(!jstore::is_default_member<1>(c));
+        REQUIRE(!jstore::is_default_member<2>(c));
+        REQUIRE(!jstore::is_default_member<3>(c));
+        REQUIRE(!jstore::is_default_member<4>(c));
+
+        test::visitable v;
+
+        v.j = json::array();
+        REQUIRE(!jstore::is_default_member<3>(v));
+    }
+
+    SECTION("serialization")
+    {
+        test::constants c;
+        json j;
+
+        REQUIRE(!jstore::serialize(j, c, true, on_error));
+        REQUIRE(j == json::object());
+
+        c.i = 8;
+        c.v = { 1 };
+        REQUIRE(jstore::serialize(j, c, true, on_error));
+        REQUIRE(j == json::parse(R"({"i":8,"v":[1]})"));
+        REQUIRE(jstore::dump_json(c, true) == j.dump());
+
+        test::constants d;
+
+        d.s = "changed";
+        d.w.clear();
+        REQUIRE(jstore::deserialize(j, d, on_error));
+        REQUIRE(d == c);
+    }
+}
+
+
 TEST_CASE("jstore::visit_path", "[jstore]")
 {
     SECTION("non-container")
@@ -637,6 +1008,71 @@ TEST_CASE("jstore::visit_path", "[jstore]")
         }
     }
 
+    SECTION("object-type container (parsed keys)")
+    {
+        auto visit = [](auto &m, string_view path) {
+            return jstore::visit_path(m, path, [](auto &value) {
+                if constexpr (is_same_v<decay_t<decltype(value)>, int>) {
+                    value = -1;
+                }
+            }, false, on_error);
+        };
+
+        map<int, int> mi = { { -3, 1 } };
+        REQUIRE(visit(mi, "-3"));
+        REQUIRE(mi.at(-3) == -1);
+        REQUIRE_FALSE(visit(mi, " -3"));
+        REQUIRE_FALSE(visit(mi, "-3x"));
+        REQUIRE_FALSE(visit(mi, "99999999999"));
+
+        map<unsigned, int> mu = { { 3, 1 } };
+        REQUIRE(visit(mu, "3"));
+        REQUIRE_FALSE(visit(mu, "-1"));
+
+        map<double, int> md = { { 1.5, 1 } };
+        REQUIRE(visit(md, "1.5"));
+        REQUIRE(md.at(1.5) == -1);
+
+        map<bool, int> mb = { { true, 1 } };
+        REQUIRE(visit(mb, "1"));
+        REQUIRE_FALSE(visit(mb, "true"));
+
+        map<test::color, int> me = { { test::color::GREEN, 1 } };
+        REQUIRE(visit(me, "1"));
+        REQUIRE(me.at(test::color::GREEN) == -1);
+
+        /* Character keys are parsed as characters, as for_each() formats them */
+        map<char, int> mc = { { 'a', 1 }, { '7', 2 } };
+        size_t char_count = 0;
+
+        jstore::for_each<jstore::LEAF>(mc, [&](const string &path, const int &) {
+            bool changed = false;
+            json j;
+
+            REQUIRE(visit(mc, path));
+            REQUIRE(jstore::compiled_path<map<char, int>>::compile(path, on_error).has_value());
+            REQUIRE(jstore::serialize(j, mc, false, on_error));
+            REQUIRE(jstore::serialize_path(j, mc, path, changed, false, on_error) == true);
+            ++char_count;
+        });
+        REQUIRE(char_count == 2);
+        REQUIRE(mc.at('a') == -1);
+        REQUIRE(mc.at('7') == -1);
+        REQUIRE_FALSE(visit(mc, "97"));
+
+        map<test::point, int> mp = { { { 1, 2 }, 1 } };
+        REQUIRE(visit(mp, "1,2"));
+        REQUIRE(mp.at({ 1, 2 }) == -1);
+        REQUIRE_FALSE(visit(mp, "1;2"));
+
+        /* Transparent comparator: looked up by string_view */
+        map<string, int, less<>> mt = { { "a", 1 } };
+        REQUIRE(visit(mt, "a"));
+        REQUIRE(mt.at("a") == -1);
+        REQUIRE(jstore::visit_path(mt, "b", [](auto &) {}, true));
+        REQUIRE(mt.contains("b"));
+    }
+
     SECTION("object-type container (non-string key)")
     {
         size_t call_count = 0;
@@ -860,6 +1296,139 @@ TEST_CASE("jstore::visit_path", "[jstore]")
 } /* visit_path */
 
 
+TEST_CASE("jstore::compiled_path", "[jstore]")
+{
+    using tree_type = map<unsigned, test::visitable>;
+    using path_type = jstore::compiled_path<tree_type>;
+
+    tree_type m{
+        { 1, test::visitable{} },
+        { 2, test::visitable{} }
+    };
+
+    SECTION("invalid paths")
+    {
+        REQUIRE_FALSE(path_type::compile("x", on_error).has_value());
+        REQUIRE_FALSE(path_type::compile("1/nonexistent", on_error).has_value());
+        REQUIRE_FALSE(path_type::compile("1/i/0", on_error).has_value());
+        REQUIRE_FALSE(path_type::compile("1/m//", on_error).has_value());
+        REQUIRE_FALSE(path_type::compile("1/s/0", on_error).has_value());
+    }
+
+    SECTION("visit")
+    {
+        auto path = path_type::compile("2/m/y", on_error);
+        REQUIRE(path.has_value());
+        REQUIRE(path->str() == "2/m/y");
+
+        /* Paths to the same node have the same canonical form */
+        REQUIRE(path_type::compile("02/m/y", on_error)->str() == "2/m/y");
+
+        size_t call_count = 0;
+
+        auto check = [&](auto &value) {
+            using value_type = decay_t<decltype(value)>;
+
+            if constexpr (is_same_v<value_type, int>) {
+                REQUIRE(addressof(value) == addressof(m.at(2).m.at("y")));
+            } else {
+                FAIL("callback for wrong element");
+            }
+
+            ++call_count;
+        };
+
+        /* Repeated visits */
+        REQUIRE(path->visit(m, check));
+        REQUIRE(path->visit(as_const(m), check));
+        REQUIRE(call_count == 2);
+
+        /* Paths remain valid as the tree changes */
+        m.erase(2);
+        REQUIRE_FALSE(path->visit(m, check));
+        REQUIRE(call_count == 2);
+
+        REQUIRE(path->visit(m, [](auto &value) {
+            if constexpr (is_same_v<decay_t<decltype(value)>, int>) {
+                value = 5;
+            }
+        }, true));
+        REQUIRE(m.at(2).m.at("y") == 5);
+    }
+
+    SECTION("visit copy")
+    {
+        auto path = path_type::compile("2/m/y", on_error);
+        REQUIRE(path.has_value());
+
+        auto modify = [](auto &value) {
+            if constexpr (is_same_v<decay_t<decltype(value)>, int>) {
+                REQUIRE(value == 22);
+                value = 5;
+            }
+        };
+
+        /* The tree is not modified */
+        REQUIRE(path->visit_copy(m, modify));
+        REQUIRE(m.at(2).m.at("y") == 22);
+
+        /* Missing map keys are default constructed */
+        auto missing = path_type::compile("3/i", on_error);
+        REQUIRE(missing.has_value());
+
+        size_t call_count = 0;
+        REQUIRE(missing->visit_copy(m, [&](auto &value) {
+            if constexpr (is_same_v<decay_t<decltype(value)>, int>) {
+                REQUIRE(value == 99);
+            }
+            ++call_count;
+        }));
+        REQUIRE(call_count == 1);
+        REQUIRE_FALSE(m.contains(3));
+
+        /* Missing values of pmr maps use the map's memory resource, as when inserted */
+        std::pmr::monotonic_buffer_resource arena;
+        std::pmr::map<string, std::pmr::vector<int>> p(&arena);
+
+        auto pmr_path = jstore::compiled_path<decltype(p)>::compile("x", on_error);
+        REQUIRE(pmr_path.has_value());
+
+        REQUIRE(pmr_path->visit_copy(p, [&](auto &value) {
+            if constexpr (is_same_v<decay_t<decltype(value)>, std::pmr::vector<int>>) {
+                REQUIRE(value.get_allocator().resource() == &arena);
+            }
+        }));
+    }
+
+    SECTION("root")
+    {
+        auto path = path_type::compile("", on_error);
+        REQUIRE(path.has_value());
+        REQUIRE(path->visit(m, [&](auto &value) {
+            REQUIRE(static_cast<void *>(addressof(value)) == addressof(m));
+        }));
+    }
+
+    SECTION("array")
+    {
+        auto path = jstore::compiled_path<vector<vector<int>>>::compile("1/0", on_error);
+        vector<vector<int>> v{ { 1 }, { 2, 3 } };
+        int found = 0;
+
+        REQUIRE(path.has_value());
+        REQUIRE(path->visit(v, [&](auto &value) {
+            if constexpr (is_same_v<decay_t<decltype(value)>, int>) {
+                found = value;
+            }
+        }));
+        REQUIRE(found == 2);
+
+        v.resize(1);
+        REQUIRE_FALSE(path->visit(v, [](auto &) {}));
+    }
+}
+
+
 TEST_CASE("jstore::serialize", "[jstore]")
 {
     /*
@@ -1149,65 +1718,260 @@ TEST_CASE("jstore::serialize", "[jstore]")
 } /* serialize */
 
 
-TEST_CASE("jstore::deserialize", "[jstore]")
+TEST_CASE("jstore::write_json", "[jstore]")
 {
-    /*
-     * Discrete value types
-     */
+    /* Output matches serialize() followed by json::dump() */
+    auto check = [](const auto &value, bool omit_defaults) {
+        json j;
+        bool populated = jstore::serialize(j, value, omit_defaults, on_error);
+        string out;
 
-    SECTION("boolean")
-    {
-        bool b {};
-        const json j = json::parse("true");
+        REQUIRE(jstore::write_json(out, value, omit_defaults, on_error) == populated);
+        REQUIRE(out == j.dump());
+        REQUIRE(jstore::dump_json(value, omit_defaults) == j.dump());
+    };
 
-        REQUIRE(jstore::deserialize(j, b, on_error));
-        REQUIRE(b);
+    SECTION("leaf")
+    {
+        check(true, false);
+        check(int8_t{-128}, false);
+        check(uint64_t{18446744073709551615u}, false);
+        check('c', false);
+        check(1.5, false);
+        check(string{"plain"}, false);
+        check(string{"esc\"aped\\\n\x01\x7f"}, false);
+        check(string{"utf-8 \xc3\xa9"}, false);
+        check(test::complex<int>{ 1, 2 }, false);
+        check(json::parse(R"({ "z": [ 1, 2 ], "a": null })"), false);
     }
 
-    SECTION("string")
+    SECTION("array")
     {
-        string s;
-        const json j = json::parse("\"string\"");
-
-        REQUIRE(jstore::deserialize(j, s, on_error));
-        REQUIRE(s == "string");
+        check(vector<int>{}, false);
+        check(vector<string>{ "a", "b" }, false);
+        check(set<int>{ 3, 1, 2 }, false);
+        check(vector<vector<int>>{ {}, { 1 } }, false);
     }
 
-    SECTION("int8")
+    SECTION("map")
     {
-        int8_t n {};
-        const json j = json::parse("-8");
-
-        REQUIRE(jstore::deserialize(j, n, on_error));
-        REQUIRE(n == -8);
+        check(map<string, int>{}, false);
+        check(map<string, int>{ { "b", 2 }, { "a", 1 }, { "\"q\"", 0 } }, false);
+        check(map<string, int, greater<>>{ { "a", 1 }, { "b", 2 } }, false);
+        check(unordered_map<string, int>{ { "x", 1 }, { "y", 2 }, { "a", 3 } }, false);
+        check(map<int, vector<string>>{ { 2, { "x" } }, { 1, {} } }, false);
     }
 
-    SECTION("int16")
+    SECTION("visitable_struct")
     {
-        int16_t n {};
-        const json j = json::parse("-1600");
+        test::visitable v;
 
-        REQUIRE(jstore::deserialize(j, n, on_error));
-        REQUIRE(n == -1600);
-    }
+        check(v, false);
+        check(v, true);
 
-    SECTION("int32")
-    {
-        int32_t n {};
-        const json j = json::parse("-320000");
+        v.s = "foo";
+        v.m.clear();
+        check(v, false);
+        check(v, true);
 
-        REQUIRE(jstore::deserialize(j, n, on_error));
-        REQUIRE(n == -320000);
+        check(map<string, test::visitable>{ { "a", {} }, { "b", v } }, true);
+        check(map<int, test::visitable>{ { 1, {} }, { 2, v } }, true);
+        check(vector<test::visitable>{ {}, v }, true);
     }
+}
 
-    SECTION("int64")
-    {
-        int64_t n {};
-        const json j = json::parse("-64000000000000");
 
-        REQUIRE(jstore::deserialize(j, n, on_error));
-        REQUIRE(n == -64000000000000);
-    }
+TEST_CASE("jstore::serialize_path", "[jstore]")
+{
+    /* Expect incremental serialization to match full serialization */
+    auto require_serialized = [](const json &j, const auto &container) {
+        json expected;
+        jstore::serialize(expected, container, true, on_error);
+        REQUIRE(j == expected);
+    };
+
+    SECTION("visitable_struct")
+    {
+        test::visitable v;
+        json j;
+        bool changed = false;
+
+        jstore::serialize(j, v, true, on_error);
+
+        v.i = 123;
+        REQUIRE(jstore::serialize_path(j, v, "i", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, v);
+
+        /* Restoring the default value removes the member */
+        changed = false;
+        v.i = 99;
+        REQUIRE(jstore::serialize_path(j, v, "i", changed, true, on_error) == false);
+        REQUIRE(changed);
+        REQUIRE(j.empty());
+
+        /* Nested map member */
+        changed = false;
+        v.m["z"] = 33;
+        REQUIRE(jstore::serialize_path(j, v, "m/z", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, v);
+
+        changed = false;
+        v.m.erase("x");
+        REQUIRE(jstore::serialize_path(j, v, "m/x", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, v);
+
+        /* Unchanged member */
+        changed = false;
+        REQUIRE(jstore::serialize_path(j, v, "s", changed, true, on_error) == true);
+        REQUIRE_FALSE(changed);
+        require_serialized(j, v);
+
+        /* Invalid paths */
+        REQUIRE_FALSE(jstore::serialize_path(j, v, "nonexistent", changed, true, on_error).has_value());
+        REQUIRE_FALSE(jstore::serialize_path(j, v, "m/y/0", changed, true, on_error).has_value());
+    }
+
+    SECTION("map of visitable_struct (non-string key)")
+    {
+        map<int, test::visitable> m = { { 1, {} }, { 3, {} } };
+        json j;
+        bool changed = false;
+
+        jstore::serialize(j, m, true, on_error);
+
+        m[3].s = "foo";
+        REQUIRE(jstore::serialize_path(j, m, "3/s", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, m);
+
+        /* Inserted entry */
+        changed = false;
+        m[2].i = 2;
+        REQUIRE(jstore::serialize_path(j, m, "2/i", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, m);
+
+        /* Removed entry */
+        changed = false;
+        m.erase(1);
+        REQUIRE(jstore::serialize_path(j, m, "1", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, m);
+
+        /* Malformed key */
+        REQUIRE_FALSE(jstore::serialize_path(j, m, "x/s", changed, true, on_error).has_value());
+    }
+
+    SECTION("map of arrays (string key)")
+    {
+        map<string, vector<int>> m = { { "a", { 1, 2 } } };
+        json j;
+        bool changed = false;
+
+        jstore::serialize(j, m, true, on_error);
+
+        /* Arrays are re-serialized as a whole */
+        m["a"].push_back(3);
+        REQUIRE(jstore::serialize_path(j, m, "a/2", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, m);
+
+        changed = false;
+        m["b"] = { 4 };
+        REQUIRE(jstore::serialize_path(j, m, "b", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, m);
+    }
+
+    SECTION("unordered map (non-string key)")
+    {
+        unordered_map<int, int> m = { { 1, 1 } };
+        json j;
+        bool changed = false;
+
+        jstore::serialize(j, m, true, on_error);
+
+        /* Inserted entries may rehash the map, reordering the serialized entries */
+        for (int i = 2; i < 100; ++i) {
+            changed = false;
+            m[i] = i;
+            REQUIRE(jstore::serialize_path(j, m, to_string(i), changed, true, on_error) == true);
+            REQUIRE(changed);
+            require_serialized(j, m);
+        }
+
+        changed = false;
+        m.erase(50);
+        REQUIRE(jstore::serialize_path(j, m, "50", changed, true, on_error) == true);
+        REQUIRE(changed);
+        require_serialized(j, m);
+    }
+
+} /* serialize_path */
+
+
+TEST_CASE("jstore::deserialize", "[jstore]")
+{
+    /*
+     * Discrete value types
+     */
+
+    SECTION("boolean")
+    {
+        bool b {};
+        const json j = json::parse("true");
+
+        REQUIRE(jstore::deserialize(j, b, on_error));
+        REQUIRE(b);
+    }
+
+    SECTION("string")
+    {
+        string s;
+        const json j = json::parse("\"string\"");
+
+        REQUIRE(jstore::deserialize(j, s, on_error));
+        REQUIRE(s == "string");
+    }
+
+    SECTION("int8")
+    {
+        int8_t n {};
+        const json j = json::parse("-8");
+
+        REQUIRE(jstore::deserialize(j, n, on_error));
+        REQUIRE(n == -8);
+    }
+
+    SECTION("int16")
+    {
+        int16_t n {};
+        const json j = json::parse("-1600");
+
+        REQUIRE(jstore::deserialize(j, n, on_error));
+        REQUIRE(n == -1600);
+    }
+
+    SECTION("int32")
+    {
+        int32_t n {};
+        const json j = json::parse("-320000");
+
+        REQUIRE(jstore::deserialize(j, n, on_error));
+        REQUIRE(n == -320000);
+    }
+
+    SECTION("int64")
+    {
+        int64_t n {};
+        const json j = json::parse("-64000000000000");
+
+        REQUIRE(jstore::deserialize(j, n, on_error));
+        REQUIRE(n == -64000000000000);
+    }
 
     SECTION("uint8")
     {
@@ -1398,392 +2162,2388 @@ TEST_CASE("jstore::deserialize", "[jstore]")
         REQUIRE(v.m == map<string, int>{ { "z", 33 } });
     }
 
-} /* deserialize */
+    SECTION("visitable_struct: unknown keys")
+    {
+        test::visitable v;
+        const json j = json::parse(R"({"a":1,"bb":true,"i":5,"m2":{},"s":"x","zz":null})");
 
+        v.b = false;
 
-TEST_CASE("jstore::load", "[jstore]")
-{
-    const filesystem::path file = "/tmp/test/jstore/data.json";
+        REQUIRE(jstore::deserialize(j, v, on_error));
+        REQUIRE(v.b == true); // Default value
+        REQUIRE(v.i == 5);
+        REQUIRE(v.s == "x");
+        REQUIRE(v.m == test::visitable{}.m);
+    }
 
-    filesystem::remove_all(file);
-    filesystem::create_directories(file.parent_path());
 
-    SECTION("no file")
+    /*
+     * In-place update
+     */
+
+    SECTION("in place: array type")
     {
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+        vector<string> c { "a", "b", "c", "d" };
+        const string *data = c.data();
+        const json j = json::parse(R"(["w", 2, "y"])");
 
-        REQUIRE(conf.root().empty());
+        REQUIRE(jstore::deserialize(j, c, on_error, true));
+        REQUIRE(c == vector<string>{ "w", "", "y" }); /* Failed element is default initialized */
+        REQUIRE(c.data() == data);
+
+        list<int> l { 1 };
+
+        REQUIRE(jstore::deserialize(json::parse("[4, 5, 6]"), l, on_error, true));
+        REQUIRE(l == list<int>{ 4, 5, 6 });
+
+        vector<bool> b { true, true };
+
+        REQUIRE(jstore::deserialize(json::parse("[false]"), b, on_error, true));
+        REQUIRE(b == vector<bool>{ false });
+
+        set<int> st { 1, 2 };
+
+        REQUIRE(jstore::deserialize(json::parse("[3, 2]"), st, on_error, true));
+        REQUIRE(st == set<int>{ 2, 3 });
     }
 
-    SECTION("empty file")
+    SECTION("in place: map type (string keys)")
     {
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+        map<string, test::visitable> c { { "a", {} }, { "b", {} } };
+        const test::visitable *a = &c.at("a");
+        const json j = json::parse(R"({"a":{"i":1},"c":{"s":"new"}})");
 
-        ofstream f(file);
-        f.close();
-        REQUIRE(filesystem::exists(file));
+        c.at("a").s = "changed";
 
-        REQUIRE(conf.root().empty());
-        REQUIRE_THROWS(conf.load());
-        REQUIRE(conf.root().empty());
+        REQUIRE(jstore::deserialize(j, c, on_error, true));
+        REQUIRE(c.size() == 2);
+        REQUIRE(&c.at("a") == a);
+        REQUIRE(c.at("a").i == 1);
+        REQUIRE(c.at("a").s == "string"); /* Default restored */
+        REQUIRE(c.at("c").s == "new");
+        REQUIRE(!c.contains("b"));
+
+        unordered_map<string, int> u { { "x", 1 }, { "y", 2 } };
+
+        REQUIRE(jstore::deserialize(json::parse(R"({"y":3,"z":"bad"})"), u, on_error, true));
+        REQUIRE(u == unordered_map<string, int>{ { "y", 3 }, { "z", 0 } });
     }
 
-    SECTION("corrupt file (parse failure)")
+    SECTION("in place: map type (non-string keys)")
     {
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
-
-        ofstream f(file);
-        f << "{{ 1234";
-        f.flush();
-        f.close();
-        REQUIRE(filesystem::exists(file));
+        map<int, vector<int>> c { { 1, { 1 } }, { 2, { 2 } } };
+        const vector<int> *two = &c.at(2);
+        const json j = json::parse(R"([[2,[20,21]],[3,[30]],[2,[99]]])");
 
-        /* Exception on parse failure */
-        REQUIRE_THROWS(conf.load());
-        REQUIRE(conf.root().empty());
+        REQUIRE(jstore::deserialize(j, c, on_error, true));
+        REQUIRE(c == map<int, vector<int>>{ { 2, { 20, 21 } }, { 3, { 30 } } });
+        REQUIRE(&c.at(2) == two);
     }
 
-    SECTION("corrupt file (tree mismatch)")
+    SECTION("in place: same result as rebuild")
     {
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+        map<string, vector<test::visitable>> in { { "a", vector<test::visitable>(3) }, { "b", {} } };
+        map<string, vector<test::visitable>> c { { "a", vector<test::visitable>(5) }, { "c", vector<test::visitable>(1) } };
 
-        ofstream f(file);
-        f << R"([ "abc", "def", 99 ])";
-        f.flush();
-        f.close();
-        REQUIRE(filesystem::exists(file));
+        in.at("a")[1].m = { { "q", 1 } };
+        c.at("a")[1].i = 7;
+        c.at("a")[2].j = nullptr;
 
-        /* Warn and continue for unexpected structure */
-        REQUIRE_NOTHROW(conf.load());
-        REQUIRE(conf->empty());
+        json j;
+
+        REQUIRE(jstore::serialize(j, in, true, on_error));
+        REQUIRE(jstore::deserialize(j, c, on_error, true));
+        REQUIRE(c == in);
+
+        /* Values that fail to deserialize are reset to their defaults */
+        REQUIRE(jstore::deserialize(json::parse(R"({"a":[null,{"i":"bad"}]})"), c, on_error, true));
+        REQUIRE(c.at("a") == vector<test::visitable>(2));
     }
 
-    SECTION("map entries, sparse values")
+
+    /*
+     * Polymorphic allocators
+     */
+
+    SECTION("pmr containers")
     {
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+        std::pmr::monotonic_buffer_resource arena;
+        std::pmr::map<string, std::pmr::vector<std::pmr::string>> c(&arena);
+        std::pmr::unordered_map<int, std::pmr::set<int>> u(&arena);
 
-        ofstream f(file);
-        f << R"({ "profile1": null, "profile2": {}, "profile3": { "b": true }, "profile4": { "i": 9876, "j": [9,9,9] } })";
-        f.flush();
-        f.close();
-        REQUIRE(filesystem::exists(file));
+        REQUIRE(jstore::traits::array<std::pmr::vector<std::pmr::string>>);
+        REQUIRE(jstore::traits::convertible_map<decltype(c)>);
+        REQUIRE(jstore::traits::not_convertible_map<decltype(u)>);
 
-        /* Expect map entries to be populated, even without content */
-        REQUIRE_NOTHROW(conf.load());
-        REQUIRE(conf->size() == 4);
+        REQUIRE(jstore::deserialize(json::parse(R"({"a":["x","y"],"b":[]})"), c, on_error));
+        REQUIRE(jstore::deserialize(json::parse(R"([[1,[1,2]],[2,[3]]])"), u, on_error));
 
-        REQUIRE(conf->at("profile1") == test::visitable{});
+        /* Elements are allocated from the container's memory resource */
+        REQUIRE(c.size() == 2);
+        REQUIRE(c.at("a").get_allocator().resource() == &arena);
+        REQUIRE(c.at("a").at(1) == "y");
+        REQUIRE(c.at("a").at(1).get_allocator().resource() == &arena);
+        REQUIRE(u.at(1) == std::pmr::set<int>{ 1, 2 });
+        REQUIRE(u.at(1).get_allocator().resource() == &arena);
 
-        REQUIRE(conf->at("profile2") == test::visitable{});
+        REQUIRE(jstore::deserialize(json::parse(R"({"a":["z"],"c":["w"]})"), c, on_error, true));
+        REQUIRE(c.at("a") == std::pmr::vector<std::pmr::string>{ "z" });
+        REQUIRE(c.at("c").at(0).get_allocator().resource() == &arena);
 
-        REQUIRE(conf->at("profile3") == test::visitable{});
+        json j;
 
-        REQUIRE(conf->at("profile4").i == 9876);
-        REQUIRE(conf->at("profile4").j == json::parse(R"([9,9,9])"));
+        REQUIRE(jstore::serialize(j, c, false, on_error));
+        REQUIRE(j == json::parse(R"({"a":["z"],"c":["w"]})"));
+
+        /* Maps with pmr string keys are serialized as objects, as with std::string keys */
+        std::pmr::map<std::pmr::string, int> p(&arena);
+        std::pmr::unordered_map<std::pmr::string, int> h(&arena);
+        const json in = json::parse(R"({"a":1,"b":2})");
+
+        REQUIRE(jstore::traits::convertible_map<decltype(p)>);
+        REQUIRE(jstore::deserialize(in, p, on_error));
+        REQUIRE(jstore::deserialize(in, h, on_error));
+        REQUIRE(p.at("b") == 2);
+        REQUIRE(p.begin()->first.get_allocator().resource() == &arena);
+
+        json out;
+
+        REQUIRE(jstore::serialize(out, p, false, on_error));
+        REQUIRE(out == in);
+        REQUIRE(jstore::dump_json(p, false, on_error) == in.dump());
+        REQUIRE(jstore::dump_json(h, false, on_error) == in.dump());
+
+        /* Path segments are used as keys */
+        REQUIRE(jstore::visit_path(p, "c", [](auto &node) {
+            if constexpr (is_same_v<decay_t<decltype(node)>, int>) {
+                node = 3;
+            }
+        }, true));
+        REQUIRE(p.at("c") == 3);
+
+        auto compiled = jstore::compiled_path<decltype(p)>::compile("a", on_error);
+
+        REQUIRE(compiled.has_value());
+        REQUIRE(compiled->visit(p, [](auto &node) {
+            if constexpr (is_same_v<decay_t<decltype(node)>, int>) {
+                node = 10;
+            }
+        }));
+        REQUIRE(p.at("a") == 10);
+
+        bool changed = false;
+
+        REQUIRE(jstore::serialize_path(out, p, "a", changed, false, on_error) == true);
+        REQUIRE(changed);
+        REQUIRE(out == json::parse(R"({"a":10,"b":2})"));
     }
 
-    SECTION("vector entries, sparse values")
-    {
-        jstore::tree<vector<test::visitable>> conf(file, on_error);
+} /* deserialize */
 
-        ofstream f(file);
-        f << R"([ null, {}, { "b": true }, { "i": 9876, "j": [9,9,9] } ])";
-        f.flush();
-        f.close();
-        REQUIRE(filesystem::exists(file));
 
-        /* Expect vector entries to be populated, even without content */
-        REQUIRE_NOTHROW(conf.load());
-        REQUIRE(conf->size() == 4);
+TEST_CASE("jstore::deserialize_parallel", "[jstore]")
+{
+    const size_t count = 4 * jstore::PARALLEL_MIN_CHUNK + 3;
 
-        REQUIRE(conf->at(0) == test::visitable{});
+    /* Collect the error messages generated by a deserializer */
+    auto errors_of = [](auto &&func) {
+        vector<string> errors;
 
-        REQUIRE(conf->at(1) == test::visitable{});
+        func([&errors](string &&msg) { errors.push_back(std::move(msg)); });
+        return errors;
+    };
 
-        REQUIRE(conf->at(2) == test::visitable{});
+    SECTION("array type")
+    {
+        json j = json::array();
 
-        REQUIRE(conf->at(3).i == 9876);
-        REQUIRE(conf->at(3).j == json::parse(R"([9,9,9])"));
+        for (size_t i = 0; i < count; ++i) {
+            j.push_back(i % 101 == 0 ? json("bad") : json(i));
+        }
+
+        vector<int> serial;
+        vector<int> parallel { 1, 2, 3 }; /* Pre-populate with content to overwrite */
+
+        auto serial_errors = errors_of([&](const jstore::error_func &err) { jstore::deserialize(j, serial, err); });
+        auto parallel_errors = errors_of([&](const jstore::error_func &err) { jstore::deserialize_parallel(j, parallel, 4, err); });
+
+        REQUIRE(parallel.size() == count);
+        REQUIRE(parallel == serial);
+        REQUIRE(!parallel_errors.empty());
+        REQUIRE(parallel_errors == serial_errors);
     }
 
-    SECTION("map of visitable structs: reload to pick up file change")
+    SECTION("set type")
     {
-        {
-            ofstream f(file);
-            f << R"({ "profile1": null, "profile2": { "s": "foo", "i": 9876 } })";
-            f.flush();
+        json j = json::array();
+
+        for (size_t i = 0; i < count; ++i) {
+            j.push_back(to_string(count - i));
         }
-        REQUIRE(filesystem::exists(file));
 
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+        set<string> serial;
+        set<string> parallel;
 
-        REQUIRE(conf.root().count("profile1") == 1);
-        REQUIRE(conf.root().at("profile2").b == true);
-        REQUIRE(conf.root().at("profile2").s == "foo");
-        REQUIRE(conf.root().at("profile2").i == 9876);
+        REQUIRE(jstore::deserialize(j, serial, on_error));
+        REQUIRE(jstore::deserialize_parallel(j, parallel, 3, on_error));
+        REQUIRE(parallel.size() == count);
+        REQUIRE(parallel == serial);
+    }
 
-        {
-            ofstream f(file);
-            f << R"({ "profile2": { "b": false, "s": "bar" } })";
-            f.flush();
+    SECTION("map type (string keys)")
+    {
+        json j = json::object();
+
+        for (size_t i = 0; i < count; ++i) {
+            j[fmt::format("key{}", i)] = i % 97 == 0 ? json::array() : json(i);
         }
 
-        conf.load();
+        unordered_map<string, int> serial;
+        unordered_map<string, int> parallel { { "x", 1 } };
 
-        REQUIRE(conf.root().count("profile1") == 0);
-        REQUIRE(conf.root().at("profile2").b == false);
-        REQUIRE(conf.root().at("profile2").s == "bar");
-        REQUIRE(conf.root().at("profile2").i == 99);
+        auto serial_errors = errors_of([&](const jstore::error_func &err) { jstore::deserialize(j, serial, err); });
+        auto parallel_errors = errors_of([&](const jstore::error_func &err) { jstore::deserialize_parallel(j, parallel, 4, err); });
+
+        REQUIRE(parallel.size() == count);
+        REQUIRE(parallel == serial);
+        REQUIRE(!parallel_errors.empty());
+        REQUIRE(parallel_errors == serial_errors);
     }
 
-    SECTION("visitable struct: load restores default value of unsaved members")
+    SECTION("map type (non-string keys)")
     {
-        {
-            ofstream f(file);
-            f << R"({ "b": false })";
-            f.flush();
+        json j = json::array();
+
+        for (size_t i = 0; i < count; ++i) {
+            j.push_back(i % 89 == 0 ? json("bad") : json::array({ i, fmt::format("{}", i) }));
         }
-        REQUIRE(filesystem::exists(file));
 
-        jstore::tree<test::visitable> conf(file, on_error);
-        REQUIRE(conf.root().b == false);
-        REQUIRE(conf.root().s == "string"); /* Default value */
-        REQUIRE(conf.root().i == 99); /* Default value */
+        map<int, string> serial;
+        map<int, string> parallel;
 
-        /* Change values in memory */
-        conf.root().b = true;
-        conf.root().s = "foo";
-        conf.root().i = 123;
+        auto serial_errors = errors_of([&](const jstore::error_func &err) { jstore::deserialize(j, serial, err); });
+        auto parallel_errors = errors_of([&](const jstore::error_func &err) { jstore::deserialize_parallel(j, parallel, 4, err); });
 
-        /* Reload to restore saved values. Unsaved values should revert to defaults. */
-        REQUIRE_NOTHROW(conf.load());
-        REQUIRE(conf.root().b == false);
-        REQUIRE(conf.root().s == "string"); /* Default value */
-        REQUIRE(conf.root().i == 99); /* Default value */
+        REQUIRE(!parallel.empty());
+        REQUIRE(parallel == serial);
+        REQUIRE(!parallel_errors.empty());
+        REQUIRE(parallel_errors == serial_errors);
     }
 
-} /* load */
+    SECTION("nested containers")
+    {
+        map<string, vector<test::visitable>> in;
 
+        for (size_t i = 0; i < count; ++i) {
+            test::visitable v;
 
-TEST_CASE("jstore::save", "[jstore]")
-{
-    const filesystem::path file = "/tmp/test/jstore/data.json";
+            v.i = static_cast<int>(i);
+            in["a"].push_back(v);
+        }
+        in["b"].resize(2);
 
-    filesystem::remove_all(file);
-    filesystem::create_directories(file.parent_path());
+        json j;
+        map<string, vector<test::visitable>> out;
 
-    SECTION("no file")
+        REQUIRE(jstore::serialize(j, in, false, on_error));
+        REQUIRE(jstore::deserialize_parallel(j, out, 8, on_error));
+        REQUIRE(out == in);
+    }
+
+    SECTION("small containers and serial fallback")
     {
-        REQUIRE_FALSE(filesystem::exists(file));
+        const json j = json::parse(R"([1, 2, 3])");
+        vector<int> c;
 
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+        REQUIRE(jstore::deserialize_parallel(j, c, 4, on_error));
+        REQUIRE(c == vector<int>{ 1, 2, 3 });
 
-        conf.save();
-        REQUIRE_FALSE(filesystem::exists(file));
+        REQUIRE_FALSE(jstore::deserialize_parallel(json("string"), c, 4));
+        REQUIRE(c == vector<int>{ 1, 2, 3 });
     }
 
-    SECTION("remove existing file when no content")
+    SECTION("pmr containers")
     {
-        {
+        std::pmr::synchronized_pool_resource pool;
+        std::pmr::vector<std::pmr::vector<int>> a(&pool);
+        std::pmr::map<string, std::pmr::vector<int>> m(&pool);
+        std::pmr::map<int, std::pmr::vector<int>> n(&pool);
+        json ja = json::array();
+        json jm = json::object();
+        json jn = json::array();
+
+        for (size_t i = 0; i < count; ++i) {
+            ja.push_back({ i });
+            jm[fmt::format("{}", i)] = { i };
+            jn.push_back({ i, { i } });
+        }
+
+        /* Elements deserialized on each thread are allocated from the container's memory resource */
+        std::pmr::memory_resource *default_resource = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+
+        REQUIRE(jstore::deserialize_parallel(ja, a, 4, on_error));
+        REQUIRE(jstore::deserialize_parallel(jm, m, 4, on_error));
+        REQUIRE(jstore::deserialize_parallel(jn, n, 4, on_error));
+
+        std::pmr::set_default_resource(default_resource);
+
+        REQUIRE(a.size() == count);
+        REQUIRE(m.size() == count);
+        REQUIRE(n.size() == count);
+        REQUIRE(std::ranges::all_of(a, [&pool](auto &v) { return v.get_allocator().resource() == &pool; }));
+        REQUIRE(std::ranges::all_of(m, [&pool](auto &e) { return e.second.get_allocator().resource() == &pool; }));
+        REQUIRE(std::ranges::all_of(n, [&pool](auto &e) { return e.second.get_allocator().resource() == &pool; }));
+        REQUIRE(n.at(count - 1) == std::pmr::vector<int>{ static_cast<int>(count - 1) });
+
+        /* Tree load with load_threads */
+        const filesystem::path file = "/tmp/test/jstore/parallel_pmr.json";
+
+        filesystem::remove_all(file);
+        filesystem::create_directories(file.parent_path());
+
+        {
+            jstore::tree<std::pmr::map<string, std::pmr::vector<int>>> conf(file, on_error, &pool);
+
+            conf.root() = m;
+            conf.save();
+        }
+
+        jstore::tree_options options;
+        options.load_threads = 4;
+
+        jstore::tree<std::pmr::map<string, std::pmr::vector<int>>> parallel(file, options, on_error, &pool);
+
+        REQUIRE(parallel.root() == m);
+        REQUIRE(std::ranges::all_of(parallel.root(), [&pool](auto &e) { return e.second.get_allocator().resource() == &pool; }));
+    }
+
+    SECTION("tree load")
+    {
+        const filesystem::path file = "/tmp/test/jstore/parallel.json";
+
+        filesystem::remove_all(file);
+        filesystem::create_directories(file.parent_path());
+
+        {
+            jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+            for (size_t i = 0; i < count; ++i) {
+                conf->emplace(fmt::format("{}", i), test::visitable{}).first->second.i = static_cast<int>(i);
+            }
+            conf.save();
+        }
+
+        jstore::tree_options parallel_options;
+        parallel_options.load_threads = 4;
+
+        jstore::tree<map<string, test::visitable>> serial(file, on_error);
+        jstore::tree<map<string, test::visitable>> parallel(file, parallel_options, on_error);
+
+        REQUIRE(parallel.root().size() == count);
+        REQUIRE(parallel.root() == serial.root());
+
+        /* Reload over the existing tree */
+        jstore::tree_options update_options;
+        update_options.update_in_place = true;
+
+        jstore::tree<map<string, test::visitable>> update(file, update_options, on_error);
+        const test::visitable *first = &update->begin()->second;
+
+        update.root().begin()->second.s = "changed";
+        update->emplace("extra", test::visitable{});
+        update.load();
+
+        REQUIRE(update.root() == serial.root());
+        REQUIRE(&update->begin()->second == first);
+    }
+
+} /* deserialize_parallel */
+
+
+TEST_CASE("jstore::deserialize_changes", "[jstore]")
+{
+    /* Incremental result must match a full deserialization */
+    auto check = [](auto &root, const json &old, const json &j, const vector<string> &expected) {
+        auto full = root;
+
+        jstore::deserialize(j, full, on_error);
+
+        REQUIRE(jstore::deserialize_changes(old, j, root, on_error) == expected);
+        REQUIRE(root == full);
+    };
+
+    SECTION("unchanged")
+    {
+        json j = json::parse(R"({ "b": false, "s": "foo" })");
+        test::visitable v;
+
+        REQUIRE(jstore::deserialize(j, v, on_error));
+        v.i = 1234; /* Unsaved change */
+
+        REQUIRE(jstore::deserialize_changes(j, j, v, on_error).empty());
+        REQUIRE(v.i == 1234);
+    }
+
+    SECTION("visitable struct members")
+    {
+        json old = json::parse(R"({ "b": false, "s": "foo", "m": { "x": 1, "y": 2 } })");
+        json j = json::parse(R"({ "s": "bar", "i": 5, "m": { "x": 1, "z": 3 } })");
+        test::visitable v;
+
+        REQUIRE(jstore::deserialize(old, v, on_error));
+        check(v, old, j, { "b", "s", "i", "m/y", "m/z" });
+        REQUIRE(v.b == true); /* Default value */
+        REQUIRE(v.s == "bar");
+        REQUIRE(v.i == 5);
+        REQUIRE(v.m == map<string, int>{ { "x", 1 }, { "z", 3 } });
+    }
+
+    SECTION("only changed nodes are deserialized")
+    {
+        json old = json::parse(R"({ "p1": { "i": 1 }, "p2": { "i": 2 }, "p3": { "s": "x" } })");
+        json j = json::parse(R"({ "p1": { "i": 1 }, "p2": { "i": 3 }, "p4": {} })");
+        map<string, test::visitable> m;
+
+        REQUIRE(jstore::deserialize(old, m, on_error));
+
+        /* Unsaved change to an unchanged node is kept */
+        m.at("p1").s = "unsaved";
+        const test::visitable *p2 = &m.at("p2");
+
+        REQUIRE(jstore::deserialize_changes(old, j, m, on_error) == vector<string>{ "p3", "p2/i", "p4" });
+        REQUIRE(m.size() == 3);
+        REQUIRE(m.at("p1").s == "unsaved");
+        REQUIRE(m.at("p2").i == 3);
+        REQUIRE(&m.at("p2") == p2); /* Updated in place */
+        REQUIRE(m.at("p4") == test::visitable{});
+    }
+
+    SECTION("arrays and leaf values are replaced")
+    {
+        json old = json::parse(R"({ "a": [ 1, 2, 3 ], "b": { "x": "y" } })");
+        json j = json::parse(R"({ "a": [ 1, 2 ], "b": { "x": "z" } })");
+        map<string, json> m;
+        map<string, vector<int>> v;
+
+        REQUIRE(jstore::deserialize(old, m, on_error));
+        check(m, old, j, { "a", "b" });
+
+        REQUIRE(jstore::deserialize(json::parse(R"({ "a": [ 1, 2, 3 ], "b": [] })"), v, on_error));
+        check(v, json::parse(R"({ "a": [ 1, 2, 3 ], "b": [] })"), json::parse(R"({ "a": [ 4 ], "b": [] })"), { "a" });
+        REQUIRE(v.at("a") == vector<int>{ 4 });
+    }
+
+    SECTION("values that fail to deserialize")
+    {
+        json old = json::parse(R"({ "p1": { "i": 1 } })");
+        json j = json::parse(R"({ "p1": { "i": "bad" } })");
+        map<string, test::visitable> m;
+        map<string, int> ints;
+
+        /* As in a new tree, members have their default value */
+        REQUIRE(jstore::deserialize(old, m, on_error));
+        REQUIRE(jstore::deserialize_changes(old, j, m) == vector<string>{ "p1/i" });
+        REQUIRE(m.at("p1").i == 99);
+
+        /* Map entries have the value of a new element */
+        REQUIRE(jstore::deserialize(json::parse(R"({ "a": 1 })"), ints, on_error));
+        REQUIRE(jstore::deserialize_changes(json::parse(R"({ "a": 1 })"), json::parse(R"({ "a": "bad" })"), ints) == vector<string>{ "a" });
+        REQUIRE(ints.at("a") == 0);
+    }
+
+    SECTION("type mismatch")
+    {
+        json old = json::parse(R"({ "p1": { "i": 1 } })");
+        json j = json::parse(R"({ "p1": [ 1, 2 ] })");
+        map<string, test::visitable> m;
+
+        REQUIRE(jstore::deserialize(old, m, on_error));
+        REQUIRE(jstore::deserialize_changes(old, j, m) == vector<string>{ "p1" });
+        REQUIRE(m.at("p1") == test::visitable{});
+
+        /* Root is deserialized as a whole */
+        check(m, j, json::array(), { "" });
+    }
+
+    SECTION("lazy members")
+    {
+        json old = json::parse(R"({ "m": { "x": 1 }, "v": { "i": 1 } })");
+        json j = json::parse(R"({ "m": { "x": 2 }, "v": { "i": 2 } })");
+        test::deferred d;
+
+        REQUIRE(jstore::deserialize(old, d, on_error));
+        REQUIRE(d.v->i == 1);
+
+        REQUIRE(jstore::deserialize_changes(old, j, d, on_error) == vector<string>{ "m", "v/i" });
+        REQUIRE(!d.m.loaded());
+        REQUIRE(d.m->at("x") == 2);
+        REQUIRE(d.v->i == 2);
+    }
+
+} /* deserialize_changes */
+
+
+TEST_CASE("jstore::lazy", "[jstore]")
+{
+    const json j = json::parse(R"({ "s": "x", "m": { "a": 1, "b": 2 }, "v": { "i": 5, "unknown": true } })");
+
+    SECTION("deserialize on first access")
+    {
+        test::deferred d;
+
+        REQUIRE(d.m.loaded());
+        REQUIRE(jstore::deserialize(j, d, on_error));
+        REQUIRE(d.s == "x");
+        REQUIRE_FALSE(d.m.loaded());
+        REQUIRE_FALSE(d.v.loaded());
+
+        REQUIRE(d.m->at("b") == 2);
+        REQUIRE(d.m.loaded());
+        REQUIRE_FALSE(d.v.loaded());
+        REQUIRE(d.v->i == 5);
+        REQUIRE(d.v->s == "string");
+    }
+
+    SECTION("serialize without deserializing")
+    {
+        test::deferred d;
+        json out;
+
+        jstore::deserialize(j, d, on_error);
+
+        /* Content is written as-is, including unknown keys */
+        REQUIRE(jstore::serialize(out, d, true, on_error));
+        REQUIRE(out == j);
+        REQUIRE(jstore::dump_json(d, true, on_error) == j.dump());
+        REQUIRE_FALSE(d.m.loaded());
+        REQUIRE_FALSE(d.v.loaded());
+
+        /* Accessed content is serialized */
+        d.m->erase("a");
+        out = json{};
+        jstore::serialize(out, d, true, on_error);
+
+        REQUIRE(out["m"] == json{ { "b", 2 } });
+        REQUIRE(out["v"] == j["v"]);
+        REQUIRE(jstore::dump_json(d, true, on_error) == out.dump());
+
+        /* Defaults are omitted */
+        d.m = map<string, int>{};
+        out = json{};
+        jstore::serialize(out, d, true, on_error);
+
+        REQUIRE_FALSE(out.contains("m"));
+    }
+
+    SECTION("errors are reported on first access")
+    {
+        test::deferred d;
+        vector<string> errors;
+        vector<string> deferred_errors;
+        jstore::error_func err = [&errors](string &&msg) { errors.push_back(std::move(msg)); };
+
+        {
+            jstore::lazy_scope scope(make_shared<const jstore::error_func>([&deferred_errors](string &&msg) {
+                deferred_errors.push_back(std::move(msg));
+            }));
+
+            jstore::deserialize(json::parse(R"({ "m": { "a": "x", "b": 2 } })"), d, err);
+        }
+
+        REQUIRE(deferred_errors.empty());
+
+        /* Errors go to the scope's handler, not to the handler of the call */
+        REQUIRE(d.m->size() == 2);
+        REQUIRE(d.m->at("b") == 2);
+        REQUIRE(errors.empty());
+        REQUIRE(deferred_errors.size() == 1);
+    }
+
+    SECTION("eager scope")
+    {
+        jstore::lazy<map<string, int>> m;
+        vector<string> errors;
+        jstore::error_func err = [&errors](string &&msg) { errors.push_back(std::move(msg)); };
+        jstore::lazy_scope scope(jstore::lazy_scope::eager);
+
+        REQUIRE(jstore::deserialize(json::parse(R"({ "a": "x", "b": 2 })"), m, err));
+        REQUIRE(m.loaded());
+        REQUIRE(errors.size() == 1);
+
+        /* Invalid content fails the call */
+        REQUIRE_FALSE(jstore::deserialize(json::array(), m, err));
+        REQUIRE(m->empty());
+    }
+
+    SECTION("parallel")
+    {
+        const size_t count = 4 * jstore::PARALLEL_MIN_CHUNK;
+        json in = json::object();
+        map<string, jstore::lazy<int>> m;
+        vector<string> errors;
+
+        for (size_t i = 0; i < count; ++i) {
+            in[fmt::format("key{}", i)] = i == 100 ? json("bad") : json(i);
+        }
+
+        /* Chunks are deserialized eagerly, so errors are reported in order */
+        REQUIRE(jstore::deserialize_parallel(in, m, 4, [&errors](string &&msg) { errors.push_back(std::move(msg)); }));
+        REQUIRE(m.size() == count);
+        REQUIRE(errors.size() == 1);
+        REQUIRE(*m.at("key101") == 101);
+    }
+
+    SECTION("paths")
+    {
+        test::deferred d;
+        int value = 0;
+
+        jstore::deserialize(j, d, on_error);
+
+        REQUIRE(jstore::visit_path(d, "m/a", [&value](auto &node) {
+            if constexpr (is_same_v<decay_t<decltype(node)>, int>) {
+                value = node;
+            }
+        }));
+        REQUIRE(value == 1);
+        REQUIRE(d.m.loaded());
+        REQUIRE_FALSE(jstore::visit_path(d, "v/unknown", [](auto &) {}));
+        REQUIRE(d.v.loaded());
+
+        auto compiled = jstore::compiled_path<test::deferred>::compile("m/b", on_error);
+
+        REQUIRE(compiled.has_value());
+        REQUIRE(compiled->visit(d, [](auto &node) {
+            if constexpr (is_same_v<decay_t<decltype(node)>, int>) {
+                node = 20;
+            }
+        }));
+        REQUIRE(d.m->at("b") == 20);
+
+        REQUIRE(jstore::path_to(d, d.m->at("b")) == "m/b");
+        REQUIRE(jstore::path_to(d, d.v->i) == "v/i");
+
+        vector<string> paths;
+
+        jstore::for_each<jstore::LEAF>(d, [&paths](const string &path, auto &) {
+            paths.push_back(path);
+        });
+        REQUIRE(find(paths.begin(), paths.end(), "m/a") != paths.end());
+        REQUIRE(find(paths.begin(), paths.end(), "v/i") != paths.end());
+    }
+
+    SECTION("serialize_path")
+    {
+        test::deferred d;
+        json out = j;
+        bool changed = false;
+
+        jstore::deserialize(j, d, on_error);
+
+        /* Content that was not accessed is unchanged */
+        REQUIRE(jstore::serialize_path(out, d, "v", changed, true, on_error) == true);
+        REQUIRE_FALSE(changed);
+        REQUIRE_FALSE(d.v.loaded());
+
+        d.m->at("a") = 10;
+        REQUIRE(jstore::serialize_path(out, d, "m/a", changed, true, on_error) == true);
+        REQUIRE(changed);
+        REQUIRE(out["m"] == json{ { "a", 10 }, { "b", 2 } });
+    }
+
+    SECTION("comparison")
+    {
+        test::deferred a, b;
+
+        jstore::deserialize(j, a, on_error);
+        jstore::deserialize(j, b, on_error);
+
+        /* Same content is compared without deserializing */
+        REQUIRE(a == b);
+        REQUIRE_FALSE(a.m.loaded());
+
+        b.m->at("a") = 10;
+        REQUIRE_FALSE(a == b);
+        REQUIRE(a.m.loaded());
+
+        /* Copies share no state */
+        test::deferred c = a;
+
+        c.m->at("a") = 10;
+        REQUIRE(a.m->at("a") == 1);
+    }
+
+    SECTION("move")
+    {
+        REQUIRE(is_nothrow_move_constructible_v<jstore::lazy<map<string, int>>>);
+        REQUIRE(is_nothrow_move_assignable_v<jstore::lazy<map<string, int>>>);
+
+        /* Content is not deserialized when a vector grows */
+        vector<jstore::lazy<map<string, int>>> v(1);
+
+        jstore::deserialize(j["m"], v[0], on_error);
+        REQUIRE_FALSE(v[0].loaded());
+
+        v.resize(v.capacity() + 1);
+        REQUIRE_FALSE(v[0].loaded());
+        REQUIRE(v[0]->at("a") == 1);
+    }
+
+    SECTION("concurrent access")
+    {
+        test::deferred d;
+        vector<thread> threads;
+        atomic<size_t> total = 0;
+
+        jstore::deserialize(j, d, on_error);
+
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&d, &total]() {
+                const test::deferred &c = d;
+                total += c.m->size();
+            });
+        }
+
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        REQUIRE(total == 8);
+    }
+
+    SECTION("tree")
+    {
+        const filesystem::path file = "/tmp/test/jstore/lazy.json";
+
+        filesystem::remove_all(file);
+        filesystem::create_directories(file.parent_path());
+
+        {
+            ofstream f(file);
+            f << j.dump();
+        }
+
+        jstore::tree_options options;
+        options.track_changes = true;
+
+        jstore::tree<test::deferred> conf(file, options, on_error);
+
+        REQUIRE(conf->s == "x");
+        REQUIRE_FALSE(conf->m.loaded());
+
+        REQUIRE(conf.modify("m/c", [](auto &node) {
+            if constexpr (is_same_v<decay_t<decltype(node)>, int>) {
+                node = 3;
+            }
+        }));
+        conf.save();
+
+        REQUIRE_FALSE(conf->v.loaded());
+
+        jstore::tree<test::deferred> reloaded(file, on_error);
+
+        REQUIRE(reloaded->m->at("c") == 3);
+        REQUIRE(reloaded->v->i == 5);
+        REQUIRE(reloaded.root() == conf.root());
+
+        /* Errors found on first access are reported to the tree's handler */
+        {
+            ofstream f(file);
+            f << R"({ "m": { "a": "x" } })";
+        }
+
+        vector<string> errors;
+        jstore::tree<test::deferred> invalid(file, [&errors](string &&msg) { errors.push_back(std::move(msg)); });
+
+        REQUIRE(errors.empty());
+        REQUIRE(invalid->m->at("a") == 0);
+        REQUIRE(errors.size() == 1);
+    }
+
+} /* lazy */
+
+TEST_CASE("jstore::load", "[jstore]")
+{
+    const filesystem::path file = "/tmp/test/jstore/data.json";
+
+    filesystem::remove_all(file);
+    filesystem::create_directories(file.parent_path());
+
+    SECTION("no file")
+    {
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        REQUIRE(conf.root().empty());
+    }
+
+    SECTION("empty file")
+    {
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        ofstream f(file);
+        f.close();
+        REQUIRE(filesystem::exists(file));
+
+        REQUIRE(conf.root().empty());
+        REQUIRE_THROWS(conf.load());
+        REQUIRE(conf.root().empty());
+    }
+
+    SECTION("corrupt file (parse failure)")
+    {
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        ofstream f(file);
+        f << "{{ 1234";
+        f.flush();
+        f.close();
+        REQUIRE(filesystem::exists(file));
+
+        /* Exception on parse failure */
+        REQUIRE_THROWS(conf.load());
+        REQUIRE(conf.root().empty());
+    }
+
+    SECTION("corrupt file (tree mismatch)")
+    {
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        ofstream f(file);
+        f << R"([ "abc", "def", 99 ])";
+        f.flush();
+        f.close();
+        REQUIRE(filesystem::exists(file));
+
+        /* Warn and continue for unexpected structure */
+        REQUIRE_NOTHROW(conf.load());
+        REQUIRE(conf->empty());
+    }
+
+    SECTION("map entries, sparse values")
+    {
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        ofstream f(file);
+        f << R"({ "profile1": null, "profile2": {}, "profile3": { "b": true }, "profile4": { "i": 9876, "j": [9,9,9] } })";
+        f.flush();
+        f.close();
+        REQUIRE(filesystem::exists(file));
+
+        /* Expect map entries to be populated, even without content */
+        REQUIRE_NOTHROW(conf.load());
+        REQUIRE(conf->size() == 4);
+
+        REQUIRE(conf->at("profile1") == test::visitable{});
+
+        REQUIRE(conf->at("profile2") == test::visitable{});
+
+        REQUIRE(conf->at("profile3") == test::visitable{});
+
+        REQUIRE(conf->at("profile4").i == 9876);
+        REQUIRE(conf->at("profile4").j == json::parse(R"([9,9,9])"));
+    }
+
+    SECTION("pmr root")
+    {
+        std::pmr::unsynchronized_pool_resource pool;
+        jstore::tree<std::pmr::map<string, std::pmr::vector<int>>> conf(file, on_error, &pool);
+
+        ofstream f(file);
+        f << R"({ "a": [1, 2, 3], "b": [] })";
+        f.close();
+
+        REQUIRE_NOTHROW(conf.load());
+        REQUIRE(conf->size() == 2);
+        REQUIRE(conf->at("a") == std::pmr::vector<int>{ 1, 2, 3 });
+        REQUIRE(conf->at("a").get_allocator().resource() == &pool);
+    }
+
+    SECTION("vector entries, sparse values")
+    {
+        jstore::tree<vector<test::visitable>> conf(file, on_error);
+
+        ofstream f(file);
+        f << R"([ null, {}, { "b": true }, { "i": 9876, "j": [9,9,9] } ])";
+        f.flush();
+        f.close();
+        REQUIRE(filesystem::exists(file));
+
+        /* Expect vector entries to be populated, even without content */
+        REQUIRE_NOTHROW(conf.load());
+        REQUIRE(conf->size() == 4);
+
+        REQUIRE(conf->at(0) == test::visitable{});
+
+        REQUIRE(conf->at(1) == test::visitable{});
+
+        REQUIRE(conf->at(2) == test::visitable{});
+
+        REQUIRE(conf->at(3).i == 9876);
+        REQUIRE(conf->at(3).j == json::parse(R"([9,9,9])"));
+    }
+
+    SECTION("map of visitable structs: reload to pick up file change")
+    {
+        {
+            ofstream f(file);
+            f << R"({ "profile1": null, "profile2": { "s": "foo", "i": 9876 } })";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        REQUIRE(conf.root().count("profile1") == 1);
+        REQUIRE(conf.root().at("profile2").b == true);
+        REQUIRE(conf.root().at("profile2").s == "foo");
+        REQUIRE(conf.root().at("profile2").i == 9876);
+
+        {
+            ofstream f(file);
+            f << R"({ "profile2": { "b": false, "s": "bar" } })";
+            f.flush();
+        }
+
+        conf.load();
+
+        REQUIRE(conf.root().count("profile1") == 0);
+        REQUIRE(conf.root().at("profile2").b == false);
+        REQUIRE(conf.root().at("profile2").s == "bar");
+        REQUIRE(conf.root().at("profile2").i == 99);
+    }
+
+    SECTION("visitable struct: load restores default value of unsaved members")
+    {
+        {
+            ofstream f(file);
+            f << R"({ "b": false })";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<test::visitable> conf(file, on_error);
+        REQUIRE(conf.root().b == false);
+        REQUIRE(conf.root().s == "string"); /* Default value */
+        REQUIRE(conf.root().i == 99); /* Default value */
+
+        /* Change values in memory */
+        conf.root().b = true;
+        conf.root().s = "foo";
+        conf.root().i = 123;
+
+        /* Reload to restore saved values. Unsaved values should revert to defaults. */
+        REQUIRE_NOTHROW(conf.load());
+        REQUIRE(conf.root().b == false);
+        REQUIRE(conf.root().s == "string"); /* Default value */
+        REQUIRE(conf.root().i == 99); /* Default value */
+    }
+
+} /* load */
+
+
+TEST_CASE("jstore::reload", "[jstore]")
+{
+    const filesystem::path file = "/tmp/test/jstore/data.json";
+
+    filesystem::remove_all(file);
+    filesystem::create_directories(file.parent_path());
+
+    /* Replace the file, as another process saving the tree would */
+    auto replace_file = [&file](const string &content) {
+        {
+            ofstream f(filesystem::path(file).concat("~"));
+            f << content;
+        }
+        filesystem::rename(filesystem::path(file).concat("~"), file);
+    };
+
+    SECTION("changed nodes")
+    {
+        replace_file(R"({ "p1": { "i": 1 }, "p2": { "i": 2 } })");
+
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        REQUIRE(conf.reload().empty());
+
+        /* Unsaved change to an unchanged node is kept */
+        conf->at("p1").s = "unsaved";
+
+        replace_file(R"({ "p1": { "i": 1 }, "p2": { "i": 3 }, "p3": {} })");
+
+        REQUIRE(conf.reload() == vector<string>{ "p2/i", "p3" });
+        REQUIRE(conf->at("p1").s == "unsaved");
+        REQUIRE(conf->at("p2").i == 3);
+        REQUIRE(conf->at("p3") == test::visitable{});
+        REQUIRE(conf.reload().empty());
+
+        /* Own saves are not reported */
+        conf.save();
+        REQUIRE(conf.reload().empty());
+    }
+
+    SECTION("file removed")
+    {
+        replace_file(R"({ "p1": { "i": 1 } })");
+
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        filesystem::remove(file);
+
+        /* As with load(), the tree is unchanged */
+        REQUIRE(conf.reload().empty());
+        REQUIRE(conf->at("p1").i == 1);
+
+        /* Content of a new file is compared to an empty file */
+        replace_file(R"({ "p2": { "i": 2 } })");
+        REQUIRE(conf.reload() == vector<string>{ "" });
+        REQUIRE(conf->size() == 1);
+        REQUIRE(conf->at("p2").i == 2);
+    }
+
+    SECTION("journaled tree is fully loaded")
+    {
+        jstore::tree_options options;
+        options.journal_limit = 1024;
+
+        jstore::tree<map<string, int>> conf(file, options, on_error);
+
+        conf->emplace("a", 1);
+        conf.save();
+        REQUIRE(conf.reload().empty());
+
+        replace_file(R"({ "a": 2 })");
+        REQUIRE(conf.reload() == vector<string>{ "" });
+        REQUIRE(conf->at("a") == 2);
+    }
+
+    SECTION("own save in flight")
+    {
+        unique_ptr<jstore::tree<map<string, int>>> conf;
+        thread reloader;
+        vector<string> changed { "not reloaded" };
+        atomic<bool> reloaded = false;
+
+        /* Reload from another thread once the file is renamed, and give it time to finish before the save completes */
+        jstore::observer_func observer = [&](const jstore::io_event &event) {
+            if (event.phase == jstore::io_phase::RENAME && !reloader.joinable()) {
+                reloader = thread([&]() {
+                    changed = conf->reload();
+                    reloaded = true;
+                });
+
+                for (int i = 0; i < 20 && !reloaded; ++i) {
+                    this_thread::sleep_for(chrono::milliseconds(10));
+                }
+            }
+        };
+
+        jstore::tree_options options;
+        options.journal_limit = 1024;
+        options.observer = observer;
+
+        conf = make_unique<jstore::tree<map<string, int>>>(file, options, on_error);
+        conf->root()["a"] = 1;
+        conf->save();
+        reloader.join();
+
+        REQUIRE(changed.empty());
+        REQUIRE(conf->root().at("a") == 1);
+    }
+
+    SECTION("watch")
+    {
+        replace_file(R"({ "a": 1 })");
+
+        jstore::tree<map<string, int>> conf(file, on_error);
+        mutex m;
+        vector<vector<string>> changes;
+
+        auto wait_for_changes = [&](size_t count) {
+            for (int i = 0; i < 500; ++i) {
+                {
+                    lock_guard lock(m);
+                    if (changes.size() >= count) {
+                        return true;
+                    }
+                }
+                this_thread::sleep_for(chrono::milliseconds(10));
+            }
+            return false;
+        };
+
+        conf.watch([&](const vector<string> &paths) {
+            lock_guard lock(m);
+            changes.push_back(paths);
+        });
+
+        replace_file(R"({ "a": 1, "b": 2 })");
+        REQUIRE(wait_for_changes(1));
+        REQUIRE(conf.read([](auto &root) { return root.at("b"); }) == 2);
+
+        /* Own saves are not reported */
+        conf.write([](auto &root) { root["c"] = 3; });
+        conf.save();
+
+        replace_file(R"({ "a": 4, "b": 2, "c": 3 })");
+        REQUIRE(wait_for_changes(2));
+        REQUIRE(conf.read([](auto &root) { return root.at("a"); }) == 4);
+
+        conf.unwatch();
+
+        lock_guard lock(m);
+        REQUIRE(changes == vector<vector<string>>{ { "b" }, { "a" } });
+    }
+
+} /* reload */
+
+
+TEST_CASE("jstore::save", "[jstore]")
+{
+    const filesystem::path file = "/tmp/test/jstore/data.json";
+
+    filesystem::remove_all(file);
+    filesystem::remove_all(file.string() + ".journal");
+    filesystem::remove_all(file.string() + ".d");
+    filesystem::create_directories(file.parent_path());
+
+    SECTION("observer")
+    {
+        jstore::io_stats stats;
+        vector<jstore::io_phase> phases;
+        jstore::tree_options options;
+        options.observer = [&](const jstore::io_event &event) {
+            stats.add(event);
+            phases.push_back(event.phase);
+        };
+
+        jstore::tree<map<string, test::visitable>> conf(file, options, on_error);
+
+        /* Changed content is written */
+        phases.clear();
+        conf->emplace("a", test::visitable{});
+        conf.save();
+
+        REQUIRE(phases == vector<jstore::io_phase>{ jstore::io_phase::SERIALIZE, jstore::io_phase::ENCODE,
+                jstore::io_phase::WRITE, jstore::io_phase::FSYNC, jstore::io_phase::RENAME });
+        REQUIRE(stats.get(jstore::io_phase::WRITE).count == 1);
+        REQUIRE(stats.get(jstore::io_phase::WRITE).bytes == filesystem::file_size(file));
+        REQUIRE(stats.get(jstore::io_phase::ENCODE).bytes == filesystem::file_size(file));
+
+        /* Unchanged content is not written */
+        phases.clear();
+        conf.save();
+
+        REQUIRE(phases == vector<jstore::io_phase>{ jstore::io_phase::SERIALIZE, jstore::io_phase::SKIP_WRITE });
+        REQUIRE(stats.get(jstore::io_phase::SKIP_WRITE).count == 1);
+        REQUIRE(stats.get(jstore::io_phase::SKIP_WRITE).duration.count() == 0);
+
+        /* Load */
+        phases.clear();
+        conf.load();
+
+        REQUIRE(phases == vector<jstore::io_phase>{ jstore::io_phase::READ, jstore::io_phase::DECODE, jstore::io_phase::DESERIALIZE });
+        REQUIRE(stats.get(jstore::io_phase::READ).bytes == filesystem::file_size(file));
+
+        stats.reset();
+        REQUIRE(stats.get(jstore::io_phase::READ).count == 0);
+    }
+
+    SECTION("no file")
+    {
+        REQUIRE_FALSE(filesystem::exists(file));
+
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        conf.save();
+        REQUIRE_FALSE(filesystem::exists(file));
+    }
+
+    SECTION("remove existing file when no content")
+    {
+        {
+            ofstream f(file);
+            f << R"([ "xxx", "yyy" ])";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        conf.save();
+        REQUIRE_FALSE(filesystem::exists(file));
+    }
+
+    SECTION("array: replace existing entries")
+    {
+        {
+            ofstream f(file);
+            f << R"([ "xxx", "yyy" ])";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<vector<string>> conf(file, on_error);
+        REQUIRE(conf.root().size() == 2);
+
+        conf.root().clear();
+
+        conf.root().push_back("zzz");
+
+        conf.save();
+        REQUIRE(filesystem::exists(file));
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        REQUIRE(j == json::parse(R"([ "zzz" ])"));
+    }
+
+    SECTION("map: replace existing string keys")
+    {
+        {
+            ofstream f(file);
+            f << R"({ "xxx": 1, "yyy": 2 })";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<map<string, int>> conf(file, on_error);
+        REQUIRE(conf.root().size() == 2);
+
+        conf.root().clear();
+
+        conf.root()["zzz"] = 3;
+
+        conf.save();
+        REQUIRE(filesystem::exists(file));
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        REQUIRE(j == json::parse(R"({ "zzz": 3 })"));
+    }
+
+    SECTION("map: replace existing non-string keys")
+    {
+        {
+            ofstream f(file);
+            f << R"([ [1, "xxx"], [2, "yyy"] ])";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<map<int, string>> conf(file, on_error);
+        REQUIRE(conf.root().size() == 2);
+
+        conf.root().clear();
+
+        conf.root()[3] = "zzz";
+
+        conf.save();
+        REQUIRE(filesystem::exists(file));
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        REQUIRE(j == json::parse(R"([ [3, "zzz"] ])"));
+    }
+
+    SECTION("map of visitable structs: omit defaults")
+    {
+        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+
+        conf.root()["profile1"];
+
+        conf.root()["profile2"];
+
+        conf.root()["profile3"];
+
+        conf.root()["profile4"].i = 9876;
+        conf.root()["profile4"].j = json::parse(R"([9,9,9])");
+
+        conf.save();
+        REQUIRE(filesystem::exists(file));
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        REQUIRE(j == json::parse(R"({ "profile1": {}, "profile2": {}, "profile3": {}, "profile4": { "i": 9876, "j": [9,9,9] } })"));
+    }
+
+    SECTION("vector of visitable struct: omit defaults")
+    {
+        jstore::tree<vector<test::visitable>> conf(file, on_error);
+
+        conf->push_back({});
+
+        conf->push_back({});
+
+        conf->push_back({});
+
+        test::visitable v;
+        v.i = 9876;
+        v.j = json::parse(R"([9,9,9])");
+        conf->push_back(move(v));
+
+        conf.save();
+        REQUIRE(filesystem::exists(file));
+
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        REQUIRE(j == json::parse(R"([ {}, {}, {}, { "i": 9876, "j": [9,9,9] } ])"));
+    }
+
+    SECTION("visitable struct: clear saved defaults")
+    {
+        {
             ofstream f(file);
-            f << R"([ "xxx", "yyy" ])";
+            f << R"({ "b": true, "s": "string", "i": 9876 })";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<test::visitable> conf(file, on_error);
+        REQUIRE(conf.root().b == true);
+        REQUIRE(conf.root().s == "string");
+        REQUIRE(conf.root().i == 9876);
+
+        conf.save();
+        REQUIRE(filesystem::exists(file));
+
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        REQUIRE(j == json::parse(R"({ "i": 9876 })"));
+    }
+
+    SECTION("visitable struct: preserve unknown keys")
+    {
+        {
+            ofstream f(file);
+            f << R"({ "s": "foo", "unknownKey": true })";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<test::visitable> conf(file, on_error);
+        REQUIRE(conf.root().s == "foo");
+
+        conf.save();
+        REQUIRE(filesystem::exists(file));
+
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        REQUIRE(j == json::parse(R"({ "s": "foo", "unknownKey": true })"));
+    }
+
+    SECTION("visitable struct: preserve unknown keys written by another process")
+    {
+        {
+            ofstream f(file);
+            f << R"({ "s": "foo" })";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree<test::visitable> conf(file, on_error);
+        REQUIRE(conf.root().s == "foo");
+
+        /* Modify file after it was cached */
+        {
+            ofstream f(file);
+            f << R"({ "s": "foo", "unknownKey": true })";
+            f.flush();
+        }
+
+        conf.root().i = 123;
+        conf.save();
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        REQUIRE(j == json::parse(R"({ "s": "foo", "i": 123, "unknownKey": true })"));
+    }
+
+    SECTION("visitable struct: sole writer does not re-read file")
+    {
+        {
+            ofstream f(file);
+            f << R"({ "s": "foo", "unknownKey": true })";
+            f.flush();
+        }
+        REQUIRE(filesystem::exists(file));
+
+        jstore::tree_options options;
+        options.sole_writer = true;
+
+        jstore::tree<test::visitable> conf(file, options, on_error);
+        REQUIRE(conf.root().s == "foo");
+
+        /* Modify file after it was cached */
+        {
+            ofstream f(file);
+            f << R"({ "s": "foo", "otherKey": true })";
+            f.flush();
+        }
+
+        conf.root().i = 123;
+        conf.save();
+
+        json j;
+        {
+            ifstream f(file);
+            f >> j;
+        }
+
+        /* Unknown keys are preserved from the cached content */
+        REQUIRE(j == json::parse(R"({ "s": "foo", "i": 123, "unknownKey": true })"));
+    }
+
+    SECTION("visitable struct: track changes")
+    {
+        {
+            ofstream f(file);
+            f << R"({ "s": "foo", "unknownKey": true })";
             f.flush();
         }
         REQUIRE(filesystem::exists(file));
 
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+        jstore::tree_options options;
+        options.track_changes = true;
+
+        jstore::tree<test::visitable> conf(file, options, on_error);
+        REQUIRE(conf.root().s == "foo");
+
+        auto read_file = [&file]() {
+            json j;
+            ifstream f(file);
+            f >> j;
+            return j;
+        };
+
+        /* Unreported changes are not saved */
+        conf.root().i = 123;
+        conf.save();
+        REQUIRE(read_file() == json::parse(R"({ "s": "foo", "unknownKey": true })"));
+
+        /* Reported by reference */
+        conf.mark_dirty(conf.root().i);
+        conf.save();
+        REQUIRE(read_file() == json::parse(R"({ "s": "foo", "i": 123, "unknownKey": true })"));
+
+        /* Reported by path */
+        REQUIRE(conf.modify("m/z", [](auto &value) {
+            if constexpr (is_same_v<decay_t<decltype(value)>, int>) {
+                value = 33;
+            }
+        }));
+        REQUIRE_FALSE(conf.modify("nonexistent", [](auto &) {}));
+        conf.save();
+        REQUIRE(read_file() == json::parse(R"({ "s": "foo", "i": 123, "m": { "x": 11, "y": 22, "z": 33 }, "unknownKey": true })"));
+
+        /* Restore defaults */
+        conf.root().s = "string";
+        conf.root().i = 99;
+        conf.root().m.erase("z");
+        conf.mark_dirty(conf.root().s);
+        conf.mark_dirty(conf.root().i);
+        conf.mark_dirty(conf.root().m);
+        conf.save();
+        REQUIRE(read_file() == json::parse(R"({ "unknownKey": true })"));
+
+        /* Nodes outside the tree are rejected */
+        int i = 0;
+        REQUIRE_THROWS(conf.mark_dirty(i));
+    }
+
+    SECTION("track changes matches full serialization")
+    {
+        auto save = [&file](bool track_changes) {
+            {
+                ofstream f(file);
+                f << R"({ "a": { "s": "foo", "unknownKey": true }, "b": { "unknownKey": true } })";
+            }
+
+            jstore::tree_options options;
+            options.track_changes = track_changes;
+
+            jstore::tree<map<string, test::visitable>> conf(file, options, on_error);
+
+            REQUIRE(conf.modify("a/i", [](auto &value) {
+                if constexpr (is_same_v<decay_t<decltype(value)>, int>) {
+                    value = 5;
+                }
+            }));
+            conf.save();
+
+            json j;
+            ifstream f(file);
+            f >> j;
+            return j;
+        };
+
+        /* Unknown keys below the root are dropped, including in unchanged nodes */
+        REQUIRE(save(true) == save(false));
+        REQUIRE(save(true) == json::parse(R"({ "a": { "s": "foo", "i": 5 }, "b": {} })"));
+    }
+
+    SECTION("visitable struct: concurrent access")
+    {
+        jstore::tree<test::visitable> conf(file, on_error);
+
+        constexpr int WRITERS = 4;
+        constexpr int WRITES = 200;
+        atomic<bool> done = false;
+        vector<thread> threads;
+
+        for (int n = 0; n < WRITERS; ++n) {
+            threads.emplace_back([&conf]() {
+                for (int i = 0; i < WRITES; ++i) {
+                    conf.write([&conf](test::visitable &v) {
+                        ++v.i;
+                        v.m["count"] = v.i;
+                        conf.mark_dirty(v.m);
+                    });
+                }
+            });
+        }
+
+        /* Readers observe consistent state */
+        atomic<bool> consistent = true;
+
+        for (int n = 0; n < 2; ++n) {
+            threads.emplace_back([&conf, &done, &consistent]() {
+                int last = 0;
+
+                while (!done) {
+                    auto [i, count] = conf.read([](const test::visitable &v) {
+                        auto it = v.m.find("count");
+                        return pair{ v.i, it == v.m.end() ? 99 : it->second };
+                    });
+
+                    if (i != count || i < last) {
+                        consistent = false;
+                    }
+                    last = i;
+                }
+            });
+        }
+
+        /* Saves serialize a consistent tree, and are written in turn */
+        vector<thread> savers;
+
+        savers.emplace_back([&conf, &done]() {
+            while (!done) {
+                conf.save();
+            }
+        });
+        savers.emplace_back([&conf, &done]() {
+            while (!done) {
+                conf.save_async().get();
+            }
+        });
+
+        for (int n = 0; n < WRITERS; ++n) {
+            threads[n].join();
+        }
+
+        done = true;
+
+        for (auto &t : savers) {
+            t.join();
+        }
+
+        for (auto &t : threads) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+
+        REQUIRE(consistent);
+
+        conf.save();
+
+        jstore::tree<test::visitable> loaded(file, on_error);
+        REQUIRE(loaded.read([](auto &v) { return v.i; }) == 99 + WRITERS * WRITES);
+        REQUIRE(loaded->m.at("count") == 99 + WRITERS * WRITES);
+    }
+
+    SECTION("visitable struct: concurrent saves")
+    {
+        jstore::tree<test::visitable> conf(file, on_error);
+
+        constexpr int SAVERS = 4;
+        constexpr int SAVES = 200;
+        atomic<size_t> errors = 0;
+        vector<thread> threads;
+
+        for (int n = 0; n < SAVERS; ++n) {
+            threads.emplace_back([&conf, &errors, n]() {
+                for (int i = 0; i < SAVES; ++i) {
+                    conf.write([](test::visitable &v) { ++v.i; });
+
+                    try {
+                        /* Half the threads start the background save thread on their first save */
+                        if (n % 2 == 0) {
+                            conf.save();
+                        } else {
+                            conf.save_async().get();
+                        }
+                    } catch (const exception &) {
+                        ++errors;
+                    }
+                }
+            });
+        }
+
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        REQUIRE(errors == 0);
+
+        /* The last save installed the latest content, without leaving temporary files */
+        jstore::tree<test::visitable> loaded(file, on_error);
+        REQUIRE(loaded->i == 99 + SAVERS * SAVES);
+
+        for (auto &entry : filesystem::directory_iterator(file.parent_path())) {
+            REQUIRE_FALSE(entry.path().string().ends_with("~"));
+        }
+    }
+
+    SECTION("visitable struct: background save")
+    {
+        auto read_file = [&file]() {
+            json j;
+            ifstream f(file);
+            f >> j;
+            return j;
+        };
+
+        {
+            jstore::tree_options options;
+            options.save_delay = chrono::hours(1);
+
+            jstore::tree<test::visitable> conf(file, options, on_error);
+
+            /* Saves are coalesced until flushed */
+            conf.root().s = "foo";
+            auto f1 = conf.save_async();
+            conf.root().i = 123;
+            auto f2 = conf.save_async();
+            REQUIRE_FALSE(filesystem::exists(file));
+
+            conf.flush();
+            REQUIRE(f1.wait_for(chrono::seconds(0)) == future_status::ready);
+            REQUIRE(f2.wait_for(chrono::seconds(0)) == future_status::ready);
+            REQUIRE(read_file() == json::parse(R"({ "s": "foo", "i": 123 })"));
+
+            /* Synchronous save completes pending saves */
+            conf.root().i = 99;
+            conf.save_async();
+            conf.root().s = "bar";
+            conf.save();
+            REQUIRE(read_file() == json::parse(R"({ "s": "bar" })"));
+
+            /* Unchanged content is not queued */
+            REQUIRE(conf.save_async().wait_for(chrono::seconds(0)) == future_status::ready);
+
+            /* Pending save is completed on destruction */
+            conf.root().s = "baz";
+            conf.save_async();
+        }
+
+        REQUIRE(read_file() == json::parse(R"({ "s": "baz" })"));
+
+        /* Background saves without delay */
+        jstore::tree<test::visitable> conf(file, on_error);
+        REQUIRE(conf.root().s == "baz");
+
+        conf.root().i = 7;
+        conf.save_async().get();
+        REQUIRE(read_file() == json::parse(R"({ "s": "baz", "i": 7 })"));
+    }
+
+    SECTION("background save failure")
+    {
+        const filesystem::path blocked = file.parent_path() / "blocked";
+
+        filesystem::remove_all(blocked);
+        {
+            ofstream f(blocked);
+        }
+
+        jstore::tree<map<string, int>> conf(blocked / "data.json", on_error);
+
+        conf->emplace("x", 1);
+        REQUIRE_THROWS(conf.save_async().get());
+
+        /* The content was written by another process, so nothing is pending */
+        filesystem::remove(blocked);
+        filesystem::create_directories(blocked);
+        {
+            ofstream f(blocked / "data.json");
+            f << R"({"x":1})";
+        }
+
+        /* The error is not reported again */
+        REQUIRE_NOTHROW(conf.save());
+        REQUIRE_NOTHROW(conf.flush());
+        REQUIRE_NOTHROW(conf.save_async().get());
+
+        filesystem::remove_all(blocked);
+    }
+
+    SECTION("visitable struct: shards")
+    {
+        const filesystem::path shard_j = file.string() + ".d/j";
+        const filesystem::path shard_m = file.string() + ".d/m";
+
+        auto read_json = [](const filesystem::path &path) {
+            json j;
+            ifstream f(path);
+            f >> j;
+            return j;
+        };
+
+        jstore::tree_options options;
+        options.shards = { "j", "m" };
+
+        {
+            jstore::tree<test::visitable> conf(file, options, on_error);
+
+            /* Shards are written separately */
+            conf->i = 1;
+            conf->j = { { "a", 1 } };
+            conf->m["z"] = 3;
+            conf.save();
+
+            REQUIRE(read_json(file) == json::parse(R"({ "i": 1 })"));
+            REQUIRE(read_json(shard_j) == json::parse(R"({ "a": 1 })"));
+            REQUIRE(read_json(shard_m) == json::parse(R"({ "x": 11, "y": 22, "z": 3 })"));
 
-        conf.save();
-        REQUIRE_FALSE(filesystem::exists(file));
-    }
+            /* Only files with changed content are rewritten */
+            auto main_stamp = jstore::file_stamp::of(file);
+            auto j_stamp = jstore::file_stamp::of(shard_j);
+            auto m_stamp = jstore::file_stamp::of(shard_m);
 
-    SECTION("array: replace existing entries")
-    {
+            conf->m["z"] = 4;
+            conf.save();
+
+            REQUIRE(jstore::file_stamp::of(file) == main_stamp);
+            REQUIRE(jstore::file_stamp::of(shard_j) == j_stamp);
+            REQUIRE(jstore::file_stamp::of(shard_m) != m_stamp);
+            REQUIRE(read_json(shard_m).at("z") == 4);
+
+            conf->i = 2;
+            conf.save();
+
+            REQUIRE(jstore::file_stamp::of(file) != main_stamp);
+            REQUIRE(jstore::file_stamp::of(shard_j) == j_stamp);
+            REQUIRE(read_json(file) == json::parse(R"({ "i": 2 })"));
+
+            /* Shards with default values are removed */
+            conf->j = test::visitable{}.j;
+            conf.save();
+
+            REQUIRE_FALSE(filesystem::exists(shard_j));
+            REQUIRE(filesystem::exists(shard_m));
+        }
+
+        /* Shards are merged on load */
         {
-            ofstream f(file);
-            f << R"([ "xxx", "yyy" ])";
-            f.flush();
+            jstore::tree<test::visitable> conf(file, options, on_error);
+
+            REQUIRE(conf->i == 2);
+            REQUIRE(conf->j == test::visitable{}.j);
+            REQUIRE(conf->m == map<string, int>{ { "x", 11 }, { "y", 22 }, { "z", 4 } });
         }
-        REQUIRE(filesystem::exists(file));
 
-        jstore::tree<vector<string>> conf(file, on_error);
-        REQUIRE(conf.root().size() == 2);
+        /* Shards are loaded without the file */
+        filesystem::remove(file);
 
-        conf.root().clear();
+        {
+            jstore::tree<test::visitable> conf(file, options, on_error);
 
-        conf.root().push_back("zzz");
+            REQUIRE(conf->i == 99);
+            REQUIRE(conf->m.at("z") == 4);
 
-        conf.save();
-        REQUIRE(filesystem::exists(file));
+            /* External changes to shards are detected, and overwritten by the tree */
+            ofstream(shard_m) << R"({ "w": 5 })";
 
-        json j;
+            conf->s = "foo";
+            conf.save();
+
+            REQUIRE(read_json(file) == json::parse(R"({ "s": "foo" })"));
+            REQUIRE(read_json(shard_m) == json::parse(R"({ "x": 11, "y": 22, "z": 4 })"));
+
+            /* Tree without content removes all files */
+            conf.root() = test::visitable{};
+            conf.save();
+
+            REQUIRE_FALSE(filesystem::exists(file));
+            REQUIRE_FALSE(filesystem::exists(shard_m));
+        }
+
+        /* Change tracking */
         {
-            ifstream f(file);
-            f >> j;
+            jstore::tree_options tracked = options;
+            tracked.track_changes = true;
+
+            jstore::tree<test::visitable> conf(file, tracked, on_error);
+
+            conf->i = 5;
+            conf->m["z"] = 6;
+            conf.mark_dirty(conf->i);
+            conf.mark_dirty(conf->m);
+            conf.save();
+
+            auto main_stamp = jstore::file_stamp::of(file);
+
+            conf->m["z"] = 7;
+            conf.mark_dirty(conf->m.at("z"));
+            conf.save();
+
+            REQUIRE(jstore::file_stamp::of(file) == main_stamp);
+            REQUIRE(read_json(file) == json::parse(R"({ "i": 5 })"));
+            REQUIRE(read_json(shard_m) == json::parse(R"({ "x": 11, "y": 22, "z": 7 })"));
         }
 
-        REQUIRE(j == json::parse(R"([ "zzz" ])"));
+        /* Invalid options */
+        jstore::tree_options nested;
+        nested.shards = { "a/b" };
+
+        jstore::tree_options journaled;
+        journaled.journal_limit = 1024;
+        journaled.shards = { "m" };
+
+        REQUIRE_THROWS_AS((jstore::tree<test::visitable>(file, nested)), invalid_argument);
+        REQUIRE_THROWS_AS((jstore::tree<test::visitable>(file, journaled)), invalid_argument);
     }
 
-    SECTION("map: replace existing string keys")
+    SECTION("visitable struct: journal")
     {
+        const filesystem::path journal = file.string() + ".journal";
+        jstore::tree_options options;
+        options.track_changes = true;
+        options.journal_limit = 256;
+
+        auto read_file = [&file]() {
+            json j;
+            ifstream f(file);
+            f >> j;
+            return j;
+        };
+
+        auto journal_lines = [&journal]() {
+            ifstream f(journal);
+            string line;
+            size_t count = 0;
+            while (getline(f, line)) {
+                ++count;
+            }
+            return count;
+        };
+
         {
             ofstream f(file);
-            f << R"({ "xxx": 1, "yyy": 2 })";
+            f << R"({ "s": "foo", "unknownKey": true })";
             f.flush();
         }
-        REQUIRE(filesystem::exists(file));
 
-        jstore::tree<map<string, int>> conf(file, on_error);
-        REQUIRE(conf.root().size() == 2);
+        {
+            jstore::tree<test::visitable> conf(file, options, on_error);
+
+            /* Changes are appended to the journal */
+            conf.root().i = 123;
+            conf.mark_dirty(conf.root().i);
+            conf.root().m["z"] = 33;
+            conf.mark_dirty(conf.root().m["z"]);
+            conf.save();
+            REQUIRE(read_file() == json::parse(R"({ "s": "foo", "unknownKey": true })"));
+            REQUIRE(journal_lines() == 3);
+
+            /* Removed nodes are recorded by their parent */
+            conf.root().m.erase("x");
+            conf.mark_dirty_path("m/x");
+            conf.save();
+            REQUIRE(journal_lines() == 4);
+        }
 
-        conf.root().clear();
+        {
+            /* Journal is applied on load */
+            jstore::tree<test::visitable> conf(file, options, on_error);
+            REQUIRE(conf.root().s == "foo");
+            REQUIRE(conf.root().i == 123);
+            REQUIRE(conf.root().m == map<string, int>{ { "y", 22 }, { "z", 33 } });
+
+            /* Journal is compacted when full */
+            for (int i = 0; i < 10; ++i) {
+                conf.root().s = "bar" + to_string(i);
+                conf.mark_dirty(conf.root().s);
+                conf.save();
+            }
+            REQUIRE(journal_lines() < 10);
+            REQUIRE(read_file()["unknownKey"] == true);
+            REQUIRE(read_file()["i"] == 123);
+        }
 
-        conf.root()["zzz"] = 3;
+        {
+            /* Truncated record is ignored */
+            jstore::tree<test::visitable> conf(file, options, on_error);
+            REQUIRE(conf.root().s == "bar9");
 
-        conf.save();
-        REQUIRE(filesystem::exists(file));
+            ofstream f(journal, ios_base::app);
+            f << R"({ "p": "s", "v": "tr)";
+        }
 
-        json j;
         {
-            ifstream f(file);
-            f >> j;
+            jstore::tree<test::visitable> conf(file, options, on_error);
+            REQUIRE(conf.root().s == "bar9");
+
+            /* Next save writes a new snapshot */
+            conf.root().b = false;
+            conf.mark_dirty(conf.root().b);
+            conf.save();
+            REQUIRE_FALSE(filesystem::exists(journal));
+            REQUIRE(read_file() == json::parse(R"({ "s": "bar9", "b": false, "i": 123, "m": { "y": 22, "z": 33 }, "unknownKey": true })"));
         }
 
-        REQUIRE(j == json::parse(R"({ "zzz": 3 })"));
-    }
+        {
+            /* Journal not matching the file is ignored */
+            jstore::tree<test::visitable> conf(file, options, on_error);
+            conf.root().i = 1;
+            conf.mark_dirty(conf.root().i);
+            conf.save();
+            REQUIRE(journal_lines() == 2);
+        }
 
-    SECTION("map: replace existing non-string keys")
-    {
         {
             ofstream f(file);
-            f << R"([ [1, "xxx"], [2, "yyy"] ])";
+            f << R"({ "s": "other" })";
             f.flush();
         }
-        REQUIRE(filesystem::exists(file));
 
-        jstore::tree<map<int, string>> conf(file, on_error);
-        REQUIRE(conf.root().size() == 2);
+        jstore::tree<test::visitable> conf(file, options, on_error);
+        REQUIRE(conf.root().s == "other");
+        REQUIRE(conf.root().i == 99);
+    }
 
-        conf.root().clear();
+} /* save */
 
-        conf.root()[3] = "zzz";
 
-        conf.save();
-        REQUIRE(filesystem::exists(file));
+TEST_CASE("jstore::save_group", "[jstore]")
+{
+    const filesystem::path dir = "/tmp/test/jstore/group";
+    const filesystem::path file_a = dir / "a.json";
+    const filesystem::path file_b = dir / "b.json";
+    const filesystem::path file_c = dir / "c.json";
+
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+
+    auto read_json = [](const filesystem::path &path) {
+        ifstream f(path);
+        return json::parse(f);
+    };
+
+    auto temp_files = [&dir]() {
+        size_t count = 0;
+
+        for (auto &entry : filesystem::recursive_directory_iterator(dir)) {
+            count += entry.path().string().ends_with("~");
+        }
+
+        return count;
+    };
+
+    SECTION("save")
+    {
+        jstore::tree_options sharded;
+        sharded.shards = { "m" };
+
+        jstore::tree<map<string, int>> a(file_a, on_error);
+        jstore::tree<map<string, int>> b(file_b, on_error);
+        jstore::tree<test::visitable> c(file_c, sharded, on_error);
+        jstore::save_group group;
+
+        group.add(a);
+        group.add(b);
+        group.add(c);
+
+        a->emplace("x", 1);
+        b->emplace("y", 2);
+        c->m.emplace("z", 3);
+        group.save();
+
+        REQUIRE(read_json(file_a) == json{ { "x", 1 } });
+        REQUIRE(read_json(file_b) == json{ { "y", 2 } });
+        REQUIRE(read_json(file_c.string() + ".d/m") == json{ { "x", 11 }, { "y", 22 }, { "z", 3 } });
+        REQUIRE(temp_files() == 0);
+
+        /* Only the changed tree is written */
+        auto stamp_a = jstore::file_stamp::of(file_a);
+        auto stamp_b = jstore::file_stamp::of(file_b);
+
+        b->at("y") = 20;
+        group.save();
+
+        REQUIRE(jstore::file_stamp::of(file_a) == stamp_a);
+        REQUIRE_FALSE(jstore::file_stamp::of(file_b) == stamp_b);
+        REQUIRE(read_json(file_b) == json{ { "y", 20 } });
+
+        /* Trees that are saved individually stay consistent with the group */
+        a->at("x") = 10;
+        a.save();
+        group.save();
+
+        REQUIRE(read_json(file_a) == json{ { "x", 10 } });
+
+        /* Content is removed */
+        a->clear();
+        group.save();
+
+        REQUIRE_FALSE(filesystem::exists(file_a));
+        REQUIRE(filesystem::exists(file_b));
+
+        jstore::tree<map<string, int>> b2(file_b, on_error);
+        jstore::tree<test::visitable> c2(file_c, sharded, on_error);
+
+        REQUIRE(b2.root() == b.root());
+        REQUIRE(c2.root() == c.root());
+    }
+
+    SECTION("no file is replaced on failure")
+    {
+        const filesystem::path blocked = dir / "blocked";
+        const filesystem::path file_d = blocked / "d.json";
+
+        jstore::tree<map<string, int>> a(file_a, on_error);
+
+        a->emplace("x", 1);
+        a.save();
 
-        json j;
         {
-            ifstream f(file);
-            f >> j;
+            ofstream f(blocked);
         }
 
-        REQUIRE(j == json::parse(R"([ [3, "zzz"] ])"));
+        jstore::tree<map<string, int>> d(file_d, on_error);
+        jstore::save_group group;
+
+        group.add(a);
+        group.add(d);
+
+        a->at("x") = 2;
+        d->emplace("y", 1);
+        REQUIRE_THROWS(group.save());
+
+        REQUIRE(read_json(file_a) == json{ { "x", 1 } });
+        REQUIRE(temp_files() == 0);
+
+        /* Unsaved changes are written by the next save */
+        filesystem::remove(blocked);
+        group.save();
+
+        REQUIRE(read_json(file_a) == json{ { "x", 2 } });
+        REQUIRE(read_json(file_d) == json{ { "y", 1 } });
     }
 
-    SECTION("map of visitable structs: omit defaults")
+    SECTION("single flush")
     {
-        jstore::tree<map<string, test::visitable>> conf(file, on_error);
+        vector<jstore::io_phase> tree_phases;
+        vector<pair<jstore::io_phase, string>> group_events;
+        jstore::tree_options options;
+        options.observer = [&](const jstore::io_event &event) {
+            tree_phases.push_back(event.phase);
+        };
 
-        conf.root()["profile1"];
+        jstore::tree<map<string, int>> a(file_a, options, on_error);
+        jstore::tree<map<string, int>> b(file_b, options, on_error);
+        jstore::save_group group([&](const jstore::io_event &event) {
+            group_events.emplace_back(event.phase, event.name);
+        });
 
-        conf.root()["profile2"];
+        group.add(a);
+        group.add(b);
 
-        conf.root()["profile3"];
+        a->emplace("x", 1);
+        b->emplace("y", 2);
+        tree_phases.clear();
+        group.save();
 
-        conf.root()["profile4"].i = 9876;
-        conf.root()["profile4"].j = json::parse(R"([9,9,9])");
+        /* Trees write and rename their files, but do not flush them */
+        REQUIRE(count(tree_phases.begin(), tree_phases.end(), jstore::io_phase::WRITE) == 2);
+        REQUIRE(count(tree_phases.begin(), tree_phases.end(), jstore::io_phase::RENAME) == 2);
+        REQUIRE(count(tree_phases.begin(), tree_phases.end(), jstore::io_phase::FSYNC) == 0);
 
-        conf.save();
-        REQUIRE(filesystem::exists(file));
+        /* Both files are in one filesystem and one directory */
+        REQUIRE(group_events.size() == 2);
+        REQUIRE(group_events[0].first == jstore::io_phase::FSYNC);
+        REQUIRE(group_events[1] == pair{ jstore::io_phase::FSYNC, dir.string() });
+    }
 
-        json j;
+    filesystem::remove_all(dir);
+}
+
+
+
+TEST_CASE("jstore::read_file", "[jstore]")
+{
+    const filesystem::path file = "/tmp/test/jstore/data.json";
+    jstore::file_stamp stamp;
+
+    filesystem::remove_all(file);
+    filesystem::create_directories(file.parent_path());
+
+    SECTION("no file")
+    {
+        REQUIRE_FALSE(jstore::read_file(file, stamp).has_value());
+    }
+
+    SECTION("empty file")
+    {
+        ofstream f(file);
+        f.close();
+
+        auto data = jstore::read_file(file, stamp);
+        REQUIRE(data == "");
+        REQUIRE(stamp == jstore::file_stamp::of(file));
+    }
+
+    SECTION("large file")
+    {
+        string content(3 * 1024 * 1024 + 7, 'x');
         {
-            ifstream f(file);
-            f >> j;
+            ofstream f(file);
+            f << content;
         }
 
-        REQUIRE(j == json::parse(R"({ "profile1": {}, "profile2": {}, "profile3": {}, "profile4": { "i": 9876, "j": [9,9,9] } })"));
+        auto data = jstore::read_file(file, stamp);
+        REQUIRE(data == content);
+        REQUIRE(stamp == jstore::file_stamp::of(file));
     }
 
-    SECTION("vector of visitable struct: omit defaults")
+    SECTION("not a file")
     {
-        jstore::tree<vector<test::visitable>> conf(file, on_error);
+        REQUIRE_THROWS_AS(jstore::read_file(file.parent_path(), stamp), system_error);
+    }
+}
 
-        conf->push_back({});
 
-        conf->push_back({});
+TEST_CASE("jstore::format", "[jstore]")
+{
+    const filesystem::path file = "/tmp/test/jstore/data.bin";
 
-        conf->push_back({});
+    filesystem::remove_all(file);
+    filesystem::create_directories(file.parent_path());
 
-        test::visitable v;
-        v.i = 9876;
-        v.j = json::parse(R"([9,9,9])");
-        conf->push_back(move(v));
+    auto read_file = [&file]() {
+        ifstream f(file, ios_base::binary);
+        return vector<uint8_t>{ istreambuf_iterator<char>(f), istreambuf_iterator<char>() };
+    };
 
-        conf.save();
-        REQUIRE(filesystem::exists(file));
+    const json expected = json::parse(R"({ "s": "foo", "i": 123, "m": { "z": 33 } })");
 
+    auto populate = [](test::visitable &v) {
+        v.s = "foo";
+        v.i = 123;
+        v.m = { { "z", 33 } };
+    };
 
-        json j;
+    SECTION("cbor")
+    {
         {
-            ifstream f(file);
-            f >> j;
+            jstore::tree<test::visitable, jstore::cbor_format> conf(file, on_error);
+            populate(conf.root());
+            conf.save();
         }
 
-        REQUIRE(j == json::parse(R"([ {}, {}, {}, { "i": 9876, "j": [9,9,9] } ])"));
+        REQUIRE(json::from_cbor(read_file()) == expected);
+
+        jstore::tree<test::visitable, jstore::cbor_format> conf(file, on_error);
+        REQUIRE(conf.root().s == "foo");
+        REQUIRE(conf.root().i == 123);
+        REQUIRE(conf.root().m == map<string, int>{ { "z", 33 } });
     }
 
-    SECTION("visitable struct: clear saved defaults")
+    SECTION("msgpack")
+    {
+        {
+            jstore::tree<test::visitable, jstore::msgpack_format> conf(file, on_error);
+            populate(conf.root());
+            conf.save();
+        }
+
+        REQUIRE(json::from_msgpack(read_file()) == expected);
+
+        jstore::tree<test::visitable, jstore::msgpack_format> conf(file, on_error);
+        REQUIRE(conf.root().s == "foo");
+        REQUIRE(conf.root().i == 123);
+        REQUIRE(conf.root().m == map<string, int>{ { "z", 33 } });
+    }
+
+    SECTION("bson")
+    {
+        {
+            jstore::tree<test::visitable, jstore::bson_format> conf(file, on_error);
+            populate(conf.root());
+            conf.save();
+        }
+
+        REQUIRE(json::from_bson(read_file()) == expected);
+
+        jstore::tree<test::visitable, jstore::bson_format> conf(file, on_error);
+        REQUIRE(conf.root().s == "foo");
+        REQUIRE(conf.root().i == 123);
+        REQUIRE(conf.root().m == map<string, int>{ { "z", 33 } });
+    }
+
+    SECTION("corrupt file")
     {
         {
             ofstream f(file);
-            f << R"({ "b": true, "s": "string", "i": 9876 })";
-            f.flush();
+            f << R"({ "s": "foo" })";
         }
-        REQUIRE(filesystem::exists(file));
 
-        jstore::tree<test::visitable> conf(file, on_error);
-        REQUIRE(conf.root().b == true);
+        jstore::tree<test::visitable, jstore::cbor_format> conf(file, on_error);
+        REQUIRE_THROWS(conf.load());
         REQUIRE(conf.root().s == "string");
-        REQUIRE(conf.root().i == 9876);
+    }
 
-        conf.save();
-        REQUIRE(filesystem::exists(file));
+} /* format */
 
 
-        json j;
+TEST_CASE("jstore::compression", "[jstore]")
+{
+    const filesystem::path file = "/tmp/test/jstore/data.json";
+
+    filesystem::remove_all(file);
+    filesystem::create_directories(file.parent_path());
+
+    auto read_file = [&file]() {
+        ifstream f(file, ios_base::binary);
+        return string{ istreambuf_iterator<char>(f), istreambuf_iterator<char>() };
+    };
+
+    const json expected = json::parse(R"({ "s": "foo", "i": 123 })");
+
+    SECTION("no compression")
+    {
         {
-            ifstream f(file);
-            f >> j;
+            jstore::tree_options options;
+            options.codec = jstore::compression::NONE;
+
+            jstore::tree<test::visitable> conf(file, options, on_error);
+            conf.root().s = "foo";
+            conf.root().i = 123;
+            conf.save();
         }
 
-        REQUIRE(j == json::parse(R"({ "i": 9876 })"));
+        REQUIRE_FALSE(jstore::is_compressed(read_file()));
+        REQUIRE(json::parse(read_file()) == expected);
     }
 
-    SECTION("visitable struct: preserve unknown keys")
+    SECTION("unsupported codec")
     {
+        string data = jstore::compress(expected.dump(), jstore::compression::NONE);
+        string header{jstore::COMPRESSION_MAGIC};
+        header.resize(jstore::COMPRESSION_HEADER_SIZE);
+        header[4] = 99;
+
         {
-            ofstream f(file);
-            f << R"({ "s": "foo", "unknownKey": true })";
-            f.flush();
+            ofstream f(file, ios_base::binary);
+            f << header << data;
         }
-        REQUIRE(filesystem::exists(file));
 
-        jstore::tree<test::visitable> conf(file, on_error);
-        REQUIRE(conf.root().s == "foo");
+        REQUIRE(jstore::is_compressed(read_file()));
 
-        conf.save();
-        REQUIRE(filesystem::exists(file));
+        jstore::tree<test::visitable> conf(file, on_error);
+        REQUIRE_THROWS(conf.load());
+        REQUIRE(conf.root().s == "string");
+    }
 
+    for (auto codec : { jstore::compression::ZSTD, jstore::compression::LZ4 }) {
+        if (!jstore::compression_supported(codec)) {
+            REQUIRE_THROWS(jstore::compress(expected.dump(), codec));
+            continue;
+        }
 
-        json j;
+        DYNAMIC_SECTION("codec " << static_cast<int>(codec))
         {
-            ifstream f(file);
-            f >> j;
-        }
+            {
+                jstore::tree_options options;
+                options.codec = codec;
+
+                jstore::tree<test::visitable> conf(file, options, on_error);
+                conf.root().s = "foo";
+                conf.root().i = 123;
+                conf.save();
+            }
 
-        REQUIRE(j == json::parse(R"({ "s": "foo", "unknownKey": true })"));
+            string data = read_file();
+            REQUIRE(jstore::is_compressed(data));
+            REQUIRE(json::parse(jstore::decompress(data)) == expected);
+
+            /* Load compressed file */
+            {
+                jstore::tree<test::visitable> conf(file, on_error);
+                REQUIRE(conf.root().s == "foo");
+                REQUIRE(conf.root().i == 123);
+            }
+
+            /* Truncated file */
+            {
+                ofstream f(file, ios_base::binary);
+                f << data.substr(0, data.size() - 1);
+            }
+
+            jstore::tree<test::visitable> conf(file, on_error);
+            REQUIRE_THROWS(conf.load());
+
+            /* Overwrite legacy file with compressed content */
+            {
+                ofstream f(file, ios_base::binary);
+                f << expected.dump();
+            }
+
+            jstore::tree_options options;
+            options.codec = codec;
+
+            jstore::tree<test::visitable> legacy(file, options, on_error);
+            REQUIRE(legacy.root().s == "foo");
+            legacy.root().i = 9876;
+            legacy.save();
+            REQUIRE(jstore::is_compressed(read_file()));
+        }
     }
 
-} /* save */
+} /* compression */
@@ -26,6 +26,7 @@ struct jstore_proxy {
                 .onInterface(jstore::DBUS_INTERFACE)
                 .call([this](const map<string, string> &values) {
                     last_values_changed = values;
+                    ++values_changed_count;
                 });
     }
 
@@ -48,6 +49,17 @@ struct jstore_proxy {
         return result;
     }
 
+    pair<map<string, string>, uint32_t> GetSubtree(const string &path, uint32_t offset = 0, uint32_t limit = 0)
+    {
+        map<string, string> result;
+        uint32_t next_offset = 0;
+        proxy_->callMethod("GetSubtree")
+                .onInterface(jstore::DBUS_INTERFACE)
+                .withArguments(path, offset, limit)
+                .storeResultsTo(result, next_offset);
+        return { result, next_offset };
+    }
+
     void Set(const string &path, const string &value)
     {
         proxy_->callMethod("Set")
@@ -55,8 +67,26 @@ struct jstore_proxy {
                 .withArguments(path, value);
     }
 
+    map<string, string> GetMany(const vector<string> &paths)
+    {
+        map<string, string> result;
+        proxy_->callMethod("GetMany")
+                .onInterface(jstore::DBUS_INTERFACE)
+                .withArguments(paths)
+                .storeResultsTo(result);
+        return result;
+    }
+
+    void SetMany(const map<string, string> &values)
+    {
+        proxy_->callMethod("SetMany")
+                .onInterface(jstore::DBUS_INTERFACE)
+                .withArguments(values);
+    }
+
 
     map<string, string> last_values_changed;
+    size_t values_changed_count = 0;
 
 private:
     unique_ptr<sdbus::IProxy> proxy_;
@@ -80,9 +110,20 @@ struct visitable {
     };
 };
 
+/*
+ * Visitable struct with a member deserialized on first access
+ */
+struct deferred {
+    int i                               = 1;
+    jstore::lazy<map<string, int>> m;
+
+    bool operator==(const deferred &) const = default;
+};
+
 } /* namespace test */
 
 VISITABLE_STRUCT(test_dbus::visitable, b, s, i, j, a, m, m2);
+VISITABLE_STRUCT(test_dbus::deferred, i, m);
 
 
 TEST_CASE("jstore::dbus", "[jstore]")
@@ -157,6 +198,107 @@ TEST_CASE("jstore::dbus", "[jstore]")
         REQUIRE(proxy.GetAll().at("m2/2/b") == R"(2)");
     }
 
+    SECTION("GetSubtree")
+    {
+        /* Entire tree */
+        REQUIRE(proxy.GetSubtree("").first == proxy.GetAll());
+        REQUIRE(proxy.GetSubtree("").second == 0);
+
+        /* Subtrees are expanded like GetAll */
+        REQUIRE(proxy.GetSubtree("m2") == pair{ map<string, string>{ { "m2/1/a", R"(1)" }, { "m2/2/b", R"(2)" } }, uint32_t{0} });
+        REQUIRE(proxy.GetSubtree("a").first == map<string, string>{ { "a", R"([1,2,3])" } });
+        REQUIRE(proxy.GetSubtree("i").first == map<string, string>{ { "i", R"(99)" } });
+
+        /* Throw on non-existent subtree */
+        REQUIRE_THROWS(proxy.GetSubtree("nonexistent"));
+        REQUIRE_THROWS(proxy.GetSubtree("m/z"));
+
+        /* Page through a large map */
+        for (int i = 0; i < 25; ++i) {
+            conf->m[fmt::format("k{:02}", i)] = i;
+        }
+
+        map<string, string> values;
+        uint32_t offset = 0;
+        size_t pages = 0;
+
+        do {
+            auto [page, next_offset] = proxy.GetSubtree("m", offset, 10);
+
+            REQUIRE(page.size() <= 10);
+            values.merge(page);
+            offset = next_offset;
+            ++pages;
+        } while (offset != 0);
+
+        REQUIRE(pages == 3);
+        REQUIRE(values == proxy.GetSubtree("m").first);
+        REQUIRE(values.size() == 27);
+        REQUIRE(values.at("m/k07") == R"(7)");
+
+        /* Page ends exactly at the last value */
+        auto [page, next_offset] = proxy.GetSubtree("m", 17, 10);
+        REQUIRE(page.size() == 10);
+        REQUIRE(next_offset == 0);
+    }
+
+    SECTION("value cache")
+    {
+        conf.dbus().set_value_cache(true);
+
+        REQUIRE(proxy.Get("i") == R"(99)");
+        REQUIRE(proxy.Get("m") == R"({"x":11,"y":22})");
+        REQUIRE(proxy.GetAll().at("m/x") == R"(11)");
+
+        /* Unreported changes are not visible */
+        conf->i = 5;
+        conf->m.at("x") = 1;
+        REQUIRE(proxy.Get("i") == R"(99)");
+        REQUIRE(proxy.GetAll().at("m/x") == R"(11)");
+
+        /* Reported changes invalidate the node, its ancestors, and its descendants */
+        conf.mark_dirty(conf->i);
+        REQUIRE(proxy.Get("i") == R"(5)");
+
+        conf.mark_dirty_path("m/x");
+        REQUIRE(proxy.Get("m") == R"({"x":1,"y":22})");
+        REQUIRE(proxy.GetAll().at("m/x") == R"(1)");
+        REQUIRE(proxy.GetMany({ "m/x" }).at("m/x") == R"(1)");
+
+        conf->m.at("x") = 2;
+        conf.dbus().emit_values_changed(conf->m);
+        REQUIRE(proxy.Get("m") == R"({"x":2,"y":22})");
+        REQUIRE(proxy.Get("m/x") == R"(2)");
+
+        conf->m.at("y") = 3;
+        conf.dbus().invalidate("m");
+        REQUIRE(proxy.Get("m/y") == R"(3)");
+
+        /* Remote sets invalidate cached values */
+        REQUIRE_NOTHROW(proxy.Set("m/x", R"(4)"));
+        REQUIRE(proxy.Get("m") == R"({"x":4,"y":3})");
+        REQUIRE_NOTHROW(proxy.SetMany({ { "m/y", R"(5)" }, { "i", R"(6)" } }));
+        REQUIRE(proxy.Get("m") == R"({"x":4,"y":5})");
+        REQUIRE(proxy.Get("i") == R"(6)");
+
+        /* Non-canonical paths share cached values with their canonical form */
+        REQUIRE(proxy.Get("m2/01/a") == R"(1)");
+        REQUIRE_NOTHROW(proxy.Set("m2/1/a", R"(7)"));
+        REQUIRE(proxy.Get("m2/01/a") == R"(7)");
+        REQUIRE_NOTHROW(proxy.Set("m2/001/a", R"(8)"));
+        REQUIRE(proxy.Get("m2/1/a") == R"(8)");
+        REQUIRE(proxy.GetMany({ "m2/01/a" }).at("m2/01/a") == R"(8)");
+
+        conf->s = "foo";
+        conf.dbus().invalidate_all();
+        REQUIRE(proxy.Get("s") == R"("foo")");
+
+        /* Disabling the cache always re-serializes values */
+        conf.dbus().set_value_cache(false);
+        conf->s = "bar";
+        REQUIRE(proxy.Get("s") == R"("bar")");
+    }
+
     SECTION("Set")
     {
         /* Set existing members */
@@ -199,6 +341,183 @@ TEST_CASE("jstore::dbus", "[jstore]")
         REQUIRE_NOTHROW(proxy.Set("m2/3/c", R"(999)"));
     }
 
+    SECTION("synchronized access")
+    {
+        /* Locks are released before callbacks, so they may access the tree */
+        conf.dbus().on_set([&conf](const string &path) {
+            conf.write([](test_dbus::visitable &v) {
+                v.i = static_cast<int>(v.s.size());
+            });
+            conf.save();
+        });
+
+        REQUIRE_NOTHROW(proxy.Set("s", R"("hello")"));
+        REQUIRE(conf.read([](auto &v) { return v.i; }) == 5);
+        REQUIRE(proxy.Get("i") == R"(5)");
+
+        conf.dbus().on_set_many([&conf](const vector<string> &paths) {
+            conf.save();
+        });
+
+        REQUIRE_NOTHROW(proxy.SetMany({ { "s", R"("foo")" }, { "b", R"(false)" } }));
+        REQUIRE(jstore::tree<test_dbus::visitable>{file}->s == "foo");
+    }
+
+    SECTION("observer")
+    {
+        vector<pair<jstore::io_phase, string>> events;
+
+        conf.dbus().set_observer([&events](const jstore::io_event &event) {
+            events.emplace_back(event.phase, string{event.name});
+        });
+
+        REQUIRE(proxy.Get("i") == R"(99)");
+        REQUIRE(events == vector<pair<jstore::io_phase, string>>{
+                { jstore::io_phase::DBUS_SERIALIZE, "" },
+                { jstore::io_phase::DBUS_CALL, "Get" } });
+
+        events.clear();
+        conf.dbus().emit_values_changed(conf->i);
+        REQUIRE(events == vector<pair<jstore::io_phase, string>>{
+                { jstore::io_phase::DBUS_SERIALIZE, "" },
+                { jstore::io_phase::DBUS_CALL, "ValuesChanged" } });
+
+        events.clear();
+        REQUIRE_THROWS(proxy.Get("nonexistent"));
+        REQUIRE(events == vector<pair<jstore::io_phase, string>>{ { jstore::io_phase::DBUS_CALL, "Get" } });
+
+        conf.dbus().set_observer({});
+    }
+
+    SECTION("lazy")
+    {
+        const filesystem::path lazy_file = file.parent_path() / "lazy.json";
+
+        {
+            ofstream f(lazy_file);
+            f << R"({ "i": 2, "m": { "x": 1 } })";
+        }
+
+        conf.unregister_dbus();
+
+        jstore::tree<test_dbus::deferred> lazy_conf{lazy_file};
+
+        REQUIRE_NOTHROW(lazy_conf.register_dbus(*service_object));
+
+        /* Content that was not deserialized is returned as-is */
+        REQUIRE(proxy.Get("") == R"({"i":2,"m":{"x":1}})");
+        REQUIRE_FALSE(lazy_conf->m.loaded());
+
+        /* Paths into the node deserialize it */
+        REQUIRE(proxy.Get("m/x") == R"(1)");
+        REQUIRE(lazy_conf->m.loaded());
+
+        /* Set content is deserialized immediately, so invalid values are rejected */
+        REQUIRE_THROWS(proxy.Set("m", R"([1, 2])"));
+        REQUIRE_THROWS(proxy.SetMany({ { "i", R"(3)" }, { "m", R"([1, 2])" } }));
+        REQUIRE(lazy_conf->i == 2);
+
+        REQUIRE_NOTHROW(proxy.Set("m", R"({ "y": 2 })"));
+        REQUIRE(lazy_conf->m.loaded());
+        REQUIRE(*lazy_conf->m == map<string, int>{ { "y", 2 } });
+
+        lazy_conf.unregister_dbus();
+    }
+
+    SECTION("change tracking")
+    {
+        const filesystem::path tracked_file = file.parent_path() / "tracked.json";
+
+        filesystem::remove(tracked_file);
+        conf.unregister_dbus();
+
+        jstore::tree<test_dbus::visitable> tracked{tracked_file, { .track_changes = true }};
+
+        REQUIRE_NOTHROW(tracked.register_dbus(*service_object));
+
+        /* Remote sets are saved without reporting them */
+        tracked.dbus().on_set([&tracked](const string &) { tracked.save(); });
+
+        REQUIRE_NOTHROW(proxy.Set("i", R"(5)"));
+        REQUIRE_NOTHROW(proxy.SetMany({ { "s", R"("foo")" }, { "m/z", R"(3)" } }));
+
+        jstore::tree<test_dbus::visitable> saved{tracked_file};
+
+        REQUIRE(saved->i == 5);
+        REQUIRE(saved->s == "foo");
+        REQUIRE(saved->m.at("z") == 3);
+
+        tracked.unregister_dbus();
+    }
+
+    SECTION("GetMany")
+    {
+        auto values = proxy.GetMany({ "b", "s", "a/1", "m/x", "m2/2/b" });
+
+        REQUIRE(values == map<string, string>{
+                { "b", R"(true)" },
+                { "s", R"("string")" },
+                { "a/1", R"(2)" },
+                { "m/x", R"(11)" },
+                { "m2/2/b", R"(2)" } });
+
+        /* Non-existent values are omitted */
+        values = proxy.GetMany({ "i", "nonexistent", "a/3", "m/z" });
+
+        REQUIRE(values == map<string, string>{ { "i", R"(99)" } });
+        REQUIRE(proxy.GetMany({}).empty());
+    }
+
+    SECTION("SetMany")
+    {
+        vector<vector<string>> set_many_paths;
+
+        conf.dbus().on_set_many([&](const vector<string> &paths) {
+            set_many_paths.push_back(paths);
+        });
+
+        /* Set existing members and insert map keys */
+        REQUIRE_NOTHROW(proxy.SetMany({
+                { "b", R"(false)" },
+                { "i", R"(123)" },
+                { "a/0", R"(100)" },
+                { "m/z", R"(33)" },
+                { "m2/3/c", R"(999)" } }));
+
+        REQUIRE(conf->b == false);
+        REQUIRE(conf->i == 123);
+        REQUIRE(conf->a == list<int>{ 100, 2, 3 });
+        REQUIRE(conf->m == map<string, int>{ { "x", 11 }, { "y", 22 }, { "z", 33 } });
+        REQUIRE(conf->m2.at(3).at("c") == 999);
+
+        /* Application is notified once */
+        REQUIRE(set_many_paths == vector<vector<string>>{ { "a/0", "b", "i", "m/z", "m2/3/c" } });
+
+        /* Nothing is set if any value is invalid */
+        REQUIRE_THROWS(proxy.SetMany({ { "s", R"("foo")" }, { "m/w", R"(1)" }, { "nonexistent", R"(1)" } }));
+        REQUIRE_THROWS(proxy.SetMany({ { "s", R"("foo")" }, { "m/w", R"(1)" }, { "a/3", R"(1)" } }));
+        REQUIRE_THROWS(proxy.SetMany({ { "s", R"("foo")" }, { "m/w", R"(1)" }, { "i", R"("bar")" } }));
+        REQUIRE_THROWS(proxy.SetMany({ { "s", R"("foo")" }, { "m/w", R"(1)" }, { "i", R"({)" } }));
+
+        REQUIRE(conf->s == "string");
+        REQUIRE(conf->i == 123);
+        REQUIRE_FALSE(conf->m.contains("w"));
+        REQUIRE(set_many_paths.size() == 1);
+
+        /* on_set() is invoked for each path if on_set_many() is not registered */
+        vector<string> set_paths;
+
+        conf.dbus().on_set_many({});
+        conf.dbus().on_set([&](const string &path) {
+            set_paths.push_back(path);
+        });
+
+        REQUIRE_NOTHROW(proxy.SetMany({ { "s", R"("foo")" }, { "m2/1/a", R"(10)" } }));
+        REQUIRE(conf->s == "foo");
+        REQUIRE(conf->m2.at(1).at("a") == 10);
+        REQUIRE(set_paths == vector<string>{ "m2/1/a", "s" });
+    }
+
     SECTION("ValuesChanged")
     {
         REQUIRE(proxy.last_values_changed.empty());
@@ -267,6 +586,130 @@ TEST_CASE("jstore::dbus", "[jstore]")
             REQUIRE(proxy.last_values_changed.at("m") == R"({})");
         }
 
+        SECTION("emit paths")
+        {
+            /* Removed map entry is replaced by the map */
+            conf.dbus().emit_paths_changed({ "i", "m/z" });
+
+            /* Wait for signal to be handled */
+            for (size_t i = 0; i < 100; ++i) {
+                this_thread::sleep_for(10ms);
+                if (!proxy.last_values_changed.empty()) {
+                    break;
+                }
+            }
+
+            REQUIRE(proxy.last_values_changed == map<string, string>{
+                    { "i", R"(99)" },
+                    { "m/x", R"(11)" },
+                    { "m/y", R"(22)" } });
+        }
+
+        SECTION("coalesced")
+        {
+            /* Wait for signals to be handled */
+            auto wait_for_signals = [&](size_t count) {
+                for (size_t i = 0; i < 100 && proxy.values_changed_count < count; ++i) {
+                    this_thread::sleep_for(10ms);
+                }
+            };
+
+            conf.dbus().set_values_changed_interval(1h);
+
+            for (int i = 0; i < 100; ++i) {
+                conf->i = i;
+                conf.dbus().emit_values_changed(conf->i);
+            }
+            conf.dbus().emit_values_changed(conf->b, conf->m);
+
+            /* Nothing is emitted until the interval elapses */
+            this_thread::sleep_for(50ms);
+            REQUIRE(proxy.values_changed_count == 0);
+
+            /* Flush emits a single merged signal with the latest values */
+            conf.dbus().flush_values_changed();
+            wait_for_signals(1);
+
+            REQUIRE(proxy.values_changed_count == 1);
+            REQUIRE(proxy.last_values_changed == map<string, string>{
+                    { "b", R"(true)" },
+                    { "i", R"(99)" },
+                    { "m/x", R"(11)" },
+                    { "m/y", R"(22)" } });
+
+            /* Nothing pending */
+            conf.dbus().flush_values_changed();
+            this_thread::sleep_for(50ms);
+            REQUIRE(proxy.values_changed_count == 1);
+
+            /* Pending values are emitted after the interval */
+            conf.dbus().set_values_changed_interval(20ms);
+            conf.dbus().emit_values_changed(conf->s);
+            conf.dbus().emit_values_changed(conf->b);
+
+            wait_for_signals(2);
+
+            REQUIRE(proxy.values_changed_count == 2);
+            REQUIRE(proxy.last_values_changed == map<string, string>{ { "b", R"(true)" }, { "s", R"("string")" } });
+
+            /* Interval of 0 emits immediately */
+            conf.dbus().set_values_changed_interval(0ms);
+            conf.dbus().emit_values_changed(conf->i);
+            wait_for_signals(3);
+            REQUIRE(proxy.values_changed_count == 3);
+        }
+
+        SECTION("delta")
+        {
+            /* Wait for signals to be handled */
+            auto wait_for_signals = [&](size_t count) {
+                for (size_t i = 0; i < 100 && proxy.values_changed_count < count; ++i) {
+                    this_thread::sleep_for(10ms);
+                }
+            };
+
+            conf.dbus().set_values_changed_delta(true);
+
+            /* All values are emitted the first time */
+            conf.dbus().emit_values_changed(conf.root());
+            wait_for_signals(1);
+            REQUIRE(proxy.last_values_changed.size() == 9);
+
+            /* Only changed values are emitted */
+            conf->i = 5;
+            conf->m.at("y") = 7;
+            conf.dbus().emit_values_changed(conf.root());
+            wait_for_signals(2);
+            REQUIRE(proxy.last_values_changed == map<string, string>{ { "i", R"(5)" }, { "m/y", R"(7)" } });
+
+            /* Nothing is emitted if nothing changed */
+            conf.dbus().emit_values_changed(conf.root());
+            this_thread::sleep_for(50ms);
+            REQUIRE(proxy.values_changed_count == 2);
+
+            /* Emitting a parent path supersedes values of its children */
+            conf->m.clear();
+            conf.dbus().emit_values_changed(conf->m);
+            wait_for_signals(3);
+            REQUIRE(proxy.last_values_changed == map<string, string>{ { "m", R"({})" } });
+
+            conf->m["x"] = 11;
+            conf.dbus().emit_values_changed(conf->m);
+            wait_for_signals(4);
+            REQUIRE(proxy.last_values_changed == map<string, string>{ { "m/x", R"(11)" } });
+
+            conf->m.clear();
+            conf.dbus().emit_values_changed(conf->m);
+            wait_for_signals(5);
+            REQUIRE(proxy.last_values_changed == map<string, string>{ { "m", R"({})" } });
+
+            /* Disabling delta mode emits all values */
+            conf.dbus().set_values_changed_delta(false);
+            conf.dbus().emit_values_changed(conf->b, conf->i);
+            wait_for_signals(6);
+            REQUIRE(proxy.last_values_changed.size() == 2);
+        }
+
         SECTION("emit all")
         {
             conf.dbus().emit_values_changed(conf.root());